@@ -0,0 +1,318 @@
+#ifndef SLIMMER_SHADOW_MEMORY_HPP
+#define SLIMMER_SHADOW_MEMORY_HPP
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+//===----------------------------------------------------------------------===//
+//                           Shadow Memory
+//===----------------------------------------------------------------------===//
+
+/// A direct-mapped shadow table that maps each byte of the address space to a
+/// value of type T (an unsigned integer), e.g., the ID of its last writer.
+///
+/// The value of a 8-byte granule is kept in a single slot. A granule whose
+/// bytes have different values is split, i.e., its slot refers to an array of
+/// 8 values. A granule is found by three array lookups,
+///
+///   directory -> page -> granule
+///
+/// where a page (4096 granules) that is entirely covered by one value, e.g.,
+/// by a huge memset or memmove, is not allocated but recorded as a fill value
+/// of its directory.
+///
+/// The value 0 means "never set", and the highest bit of T is reserved.
+///
+template <typename T> class ShadowMemory {
+public:
+  static const int GranuleBits = 3;
+  static const int PageBits = 12; // Granules per page
+  static const int DirBits = 16;  // Pages per directory
+  // Directories of the lower 2^48 bytes, the others are kept in a map
+  static const int TopBits = 48 - GranuleBits - PageBits - DirBits;
+
+  static const uint64_t GranuleBytes = 1lu << GranuleBits;
+  static const uint64_t PageBytes = 1lu << (GranuleBits + PageBits);
+  static const uint64_t DirBytes = 1lu << (GranuleBits + PageBits + DirBits);
+  static const T SplitBit = (T)1 << (sizeof(T) * 8 - 1);
+
+  ShadowMemory() : top(1lu << TopBits, (Directory *)NULL), pages(0) {}
+  ~ShadowMemory() { Clear(); }
+
+  /// Reset all the bytes to 0.
+  ///
+  void Clear() {
+    for (auto &d : top) {
+      FreeDirectory(d);
+      d = NULL;
+    }
+    for (auto &d : high)
+      FreeDirectory(d.second);
+    high.clear();
+    splits.clear();
+    free_splits.clear();
+    pages = 0;
+  }
+
+  /// Set a range [l, r) to be value v.
+  ///
+  void Set(uint64_t l, uint64_t r, T v) {
+    assert(v != 0 && (v & SplitBit) == 0);
+    while (l < r) {
+      Directory *dir = GetDirectory(l, true);
+      uint64_t p = PageIndex(l);
+
+      // The whole page is covered
+      if ((l & (PageBytes - 1)) == 0 && r - l >= PageBytes) {
+        FreePage(dir->page[p]);
+        dir->page[p] = NULL;
+        dir->fill[p] = v;
+        l += PageBytes;
+        if (l == 0)
+          break; // Overflowed
+        continue;
+      }
+
+      if (dir->page[p] == NULL)
+        dir->page[p] = NewPage(dir->fill[p]);
+      Page *page = dir->page[p];
+
+      uint64_t end = std::min(r, (l | (PageBytes - 1)) + 1);
+      if (end == 0)
+        end = r; // The last page of the address space
+      while (l < end) {
+        T &slot = page->granule[GranuleIndex(l)];
+        uint64_t granule_end = (l | (GranuleBytes - 1)) + 1;
+        if ((l & (GranuleBytes - 1)) == 0 && end - l >= GranuleBytes) {
+          FreeSplit(slot);
+          slot = v;
+          l += GranuleBytes;
+        } else {
+          // Only a part of the granule is covered
+          T *bytes = Split(slot);
+          for (; l < end && l != granule_end; ++l)
+            bytes[l & (GranuleBytes - 1)] = v;
+          Merge(slot);
+        }
+      }
+      if (l == 0)
+        break; // Overflowed
+    }
+  }
+
+  /// Get the value at point x.
+  ///
+  /// \param x - the point that the user want to get.
+  /// \return - the value, 0 if x is never set.
+  ///
+  T Get(uint64_t x) {
+    Directory *dir = GetDirectory(x, false);
+    if (dir == NULL)
+      return 0;
+    Page *page = dir->page[PageIndex(x)];
+    if (page == NULL)
+      return dir->fill[PageIndex(x)];
+    T slot = page->granule[GranuleIndex(x)];
+    if (slot & SplitBit)
+      return splits[slot & ~SplitBit].bytes[x & (GranuleBytes - 1)];
+    return slot;
+  }
+
+  /// Collect all the values in range [l, r).
+  /// A value may be appended more than once, but never twice in a row.
+  ///
+  /// \param out - the values are appended to it.
+  ///
+  void Collect(uint64_t l, uint64_t r, std::vector<T> &out) {
+    while (l < r) {
+      Directory *dir = GetDirectory(l, false);
+      if (dir == NULL) {
+        l = (l | (DirBytes - 1)) + 1;
+        if (l == 0)
+          break;
+        continue;
+      }
+
+      uint64_t p = PageIndex(l);
+      uint64_t end = std::min(r, (l | (PageBytes - 1)) + 1);
+      if (end == 0)
+        end = r;
+      Page *page = dir->page[p];
+      if (page == NULL) {
+        Append(out, dir->fill[p]);
+        l = end;
+      }
+      while (l < end) {
+        T slot = page->granule[GranuleIndex(l)];
+        uint64_t granule_end = (l | (GranuleBytes - 1)) + 1;
+        if (slot & SplitBit) {
+          T *bytes = splits[slot & ~SplitBit].bytes;
+          for (; l < end && l != granule_end; ++l)
+            Append(out, bytes[l & (GranuleBytes - 1)]);
+        } else {
+          Append(out, slot);
+          l = std::min(end, granule_end);
+        }
+        if (l == 0)
+          break;
+      }
+      if (l == 0)
+        break; // Overflowed
+    }
+  }
+
+  /// Replace every value v by f(v), e.g., for renumbering the values.
+  /// f is called on each distinct slot, hence a value may be seen more than
+  /// once. The value 0 is kept, and f should not map the others to 0.
+  ///
+  template <typename F> void Remap(F f) {
+    for (auto d : top)
+      RemapDirectory(d, f);
+    for (auto &d : high)
+      RemapDirectory(d.second, f);
+  }
+
+  /// Return the number of allocated pages.
+  uint64_t NumPages() { return pages; }
+
+private:
+  struct Page {
+    T granule[1 << PageBits];
+  };
+  struct Directory {
+    Page *page[1 << DirBits];
+    T fill[1 << DirBits]; // The value of each unallocated page
+  };
+  struct SplitGranule {
+    T bytes[GranuleBytes];
+  };
+
+  std::vector<Directory *> top;
+  std::map<uint64_t, Directory *> high; // Directories above 2^48
+  std::vector<SplitGranule> splits;
+  std::vector<T> free_splits;
+  uint64_t pages;
+
+  static uint64_t PageIndex(uint64_t x) {
+    return (x >> (GranuleBits + PageBits)) & ((1lu << DirBits) - 1);
+  }
+  static uint64_t GranuleIndex(uint64_t x) {
+    return (x >> GranuleBits) & ((1lu << PageBits) - 1);
+  }
+
+  template <typename F> void RemapDirectory(Directory *dir, F &f) {
+    if (dir == NULL)
+      return;
+    for (uint64_t p = 0; p < (1lu << DirBits); ++p) {
+      if (dir->page[p] == NULL) {
+        if (dir->fill[p])
+          dir->fill[p] = f(dir->fill[p]);
+        continue;
+      }
+      for (auto &slot : dir->page[p]->granule) {
+        if (slot & SplitBit) {
+          for (auto &v : splits[slot & ~SplitBit].bytes)
+            if (v)
+              v = f(v);
+        } else if (slot) {
+          slot = f(slot);
+        }
+      }
+    }
+  }
+
+  static void Append(std::vector<T> &out, T v) {
+    if (v != 0 && (out.empty() || out.back() != v))
+      out.push_back(v);
+  }
+
+  Directory *GetDirectory(uint64_t x, bool create) {
+    uint64_t d = x >> (GranuleBits + PageBits + DirBits);
+    Directory **dir;
+    if (d < top.size()) {
+      dir = &top[d];
+    } else {
+      auto it = high.find(d);
+      if (it == high.end() && !create)
+        return NULL;
+      dir = &high[d];
+    }
+    if (*dir == NULL && create) {
+      *dir = (Directory *)calloc(1, sizeof(Directory));
+      assert(*dir && "Failed to allocate the shadow memory!\n");
+    }
+    return *dir;
+  }
+
+  Page *NewPage(T fill) {
+    Page *page = new Page;
+    std::fill(page->granule, page->granule + (1 << PageBits), fill);
+    pages++;
+    return page;
+  }
+
+  void FreePage(Page *page) {
+    if (page == NULL)
+      return;
+    for (auto &slot : page->granule)
+      FreeSplit(slot);
+    delete page;
+    pages--;
+  }
+
+  void FreeDirectory(Directory *dir) {
+    if (dir == NULL)
+      return;
+    for (auto page : dir->page)
+      FreePage(page);
+    free(dir);
+  }
+
+  /// Turn a slot into a split granule.
+  ///
+  /// \return - the values of the bytes of the granule.
+  ///
+  T *Split(T &slot) {
+    if (slot & SplitBit)
+      return splits[slot & ~SplitBit].bytes;
+
+    T idx;
+    if (free_splits.empty()) {
+      idx = splits.size();
+      splits.push_back(SplitGranule());
+    } else {
+      idx = free_splits.back();
+      free_splits.pop_back();
+    }
+    std::fill(splits[idx].bytes, splits[idx].bytes + GranuleBytes, slot);
+    slot = idx | SplitBit;
+    return splits[idx].bytes;
+  }
+
+  /// Turn a split granule back into a single value if all its bytes are
+  /// equal.
+  ///
+  void Merge(T &slot) {
+    T *bytes = splits[slot & ~SplitBit].bytes;
+    for (uint64_t i = 1; i < GranuleBytes; ++i)
+      if (bytes[i] != bytes[0])
+        return;
+    T v = bytes[0];
+    FreeSplit(slot);
+    slot = v;
+  }
+
+  void FreeSplit(T &slot) {
+    if (slot & SplitBit) {
+      free_splits.push_back(slot & ~SplitBit);
+      slot = 0;
+    }
+  }
+};
+
+#endif
@@ -7,9 +7,33 @@
 //                           Forward declearation
 //===----------------------------------------------------------------------===//
 extern "C" void recordInit(const char *name);
+extern "C" void recordBBCounters(uint32_t n);
+extern "C" uint64_t *recordThreadBBCounters();
+extern "C" void recordUnit(const char *hash, uint32_t *bb_base,
+                           uint32_t *ins_base, uint32_t num_bb,
+                           uint32_t num_ins);
+
+// Whether the dual-version functions run their instrumented versions,
+// see slimmerSetTracing.
+extern "C" volatile int32_t slimmer_tracing;
+extern "C" void slimmerSetTracing(int32_t on);
 extern "C" void recordBasicBlockEvent(uint32_t id);
+extern "C" void recordPathEvent(uint32_t id, uint64_t path);
+extern "C" void recordFunctionEnter(uint32_t id);
+extern "C" void recordFunctionExit(uint32_t id);
 extern "C" void recordMemoryEvent(uint32_t id, void *addr, uint64_t length);
+extern "C" void recordLoadEvent(uint32_t id, void *addr, uint64_t length);
 extern "C" void recordStoreEvent(uint32_t id, void *addr, uint64_t length, int64_t value);
+extern "C" void recordLoad1(uint32_t id, void *addr);
+extern "C" void recordLoad2(uint32_t id, void *addr);
+extern "C" void recordLoad4(uint32_t id, void *addr);
+extern "C" void recordLoad8(uint32_t id, void *addr);
+extern "C" void recordLoad16(uint32_t id, void *addr);
+extern "C" void recordStore1(uint32_t id, void *addr, int64_t value);
+extern "C" void recordStore2(uint32_t id, void *addr, int64_t value);
+extern "C" void recordStore4(uint32_t id, void *addr, int64_t value);
+extern "C" void recordStore8(uint32_t id, void *addr, int64_t value);
+extern "C" void recordStore16(uint32_t id, void *addr, int64_t value);
 extern "C" void recordCallEvent(uint32_t id, void *fun);
 extern "C" void recordReturnEvent(uint32_t id, void *fun);
 extern "C" void recordArgumentEvent(void *arg);
@@ -18,4 +42,9 @@ extern "C" void recordMemmove(uint32_t id, void *dest, void *src, uint64_t lengt
 
 extern "C" void recordCallocEvent(uint32_t id, void *addr, uint64_t num, uint64_t length);
 
+extern "C" void recordStridedEvent(uint32_t id, void *last, int64_t stride, uint64_t size, uint64_t count, uint8_t store);
+extern "C" void recordSilentStore(uint32_t id, uint64_t iteration, uint64_t size);
+extern "C" void recordLoopEvent(uint32_t id, uint64_t count);
+extern "C" void recordBatchEvent(uint32_t id, const void *accesses, uint32_t n, const uint64_t *bases, uint32_t k, uint64_t silent);
+
 #endif // SLIMMER_RUNTIME_H
\ No newline at end of file
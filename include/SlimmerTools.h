@@ -3,6 +3,7 @@
 
 #include "SlimmerUtil.h"
 #include "SegmentTree.hpp"
+#include "ShadowMemory.hpp"
 
 #include <algorithm>
 #include <stack>
@@ -18,6 +19,20 @@ using namespace std;
 extern vector<InstInfo> Ins;
 // Map a basic block ID to all the instructions that belong to it
 extern vector<vector<uint32_t> > BB2Ins;
+// Map the entry basic block of each path-encoded function to its numbering
+extern map<uint32_t, PathNumbering> PathFuns;
+// Map a basic block ID to the entry basic block of its function,
+// empty if the trace has no function events
+extern vector<uint32_t> BB2Fun;
+// Map a batch ID to its memory accesses
+extern vector<vector<BatchAccess> > Batches;
+// Whether the loads are resolved by the runtime (SLIMMER_ONLINE_DEP)
+extern bool OnlineDependency;
+// The CPU cycles (from the TSC stamps) spent by each instruction, and how many
+// times it is executed within the timed part of the trace.
+extern vector<double> InsCycles;
+extern vector<uint64_t> InsTimedExecs;
+extern double TracedCycles;
 // A segment tree that maps a memory address to its group
 extern SegmentTree<int> *Addr2Group;
 // For each group, we use a segment tree to record all the memory addresses that
@@ -34,6 +49,18 @@ void throw_exception(std::exception const &e);
 
 pair<uint64_t, uint32_t> I(uint64_t tid, uint32_t id);
 
+/// Tag an address with the process whose trace it comes from, so that the
+/// merged traces of the forked processes have disjoint address spaces.
+/// The user addresses are below 2^48.
+///
+/// \param proc - the index of the trace.
+/// \param addr - the address in that process.
+/// \return - the tagged address.
+///
+inline uint64_t ProcAddr(uint32_t proc, uint64_t addr) {
+  return addr ^ ((uint64_t)proc << 48);
+}
+
 /// A smallest block is a continuous part of a basic block
 /// that will always be executed continuously.
 ///
@@ -73,7 +100,12 @@ struct SmallestBlock {
 
   int32_t LastBBID; // The basic block ID of the last executed basic block
 
-  SmallestBlock() {}
+  // The index of the trace, i.e., the process, of this SmallestBlock.
+  // The addresses of a process are tagged by ProcAddr, while the write
+  // numbers of the online dependency mode are counted per process.
+  uint32_t Proc;
+
+  SmallestBlock() : Proc(0) {}
   SmallestBlock(SmallestBlockType t, uint64_t tid, uint32_t bb_id,
                 uint32_t start, uint32_t end, pair<uint8_t, uint32_t> first,
                 int32_t last_bb_id);
@@ -88,12 +120,14 @@ struct TraceIter {
   char *decoded;
   size_t data_iter, decoded_iter, decoded_size;
   bool ended;
+  TraceCodec codec;
 
-  TraceIter(char *trace_file_name) : trace(trace_file_name) {
+  TraceIter(const char *trace_file_name) : trace(trace_file_name) {
     ended = false;
     data = trace.data();
     decoded = (char *)malloc(COMPRESS_BLOCK_SIZE);
-    data_iter = decoded_iter = decoded_size = 0;
+    decoded_iter = decoded_size = 0;
+    data_iter = codec.ReadHeader(data, trace.size());
   }
 
   /// Prepare the decompressed data
@@ -106,6 +140,64 @@ struct TraceIter {
                  const uint64_t *&length_ptr, const uint64_t *&addr2_ptr);
 };
 
+/// A k-way merge of several traces, e.g., of per-thread streams,
+/// by their StampEvents.
+///
+/// The events between two StampEvents of a trace are kept together, and
+/// the trace with the smallest stamp goes first (the lowest index on ties).
+/// The EndEvents and place holders are not returned.
+struct MergedTraceIter {
+  struct Stream {
+    TraceIter *Iter;
+    uint64_t Stamp; // The stamp of the current segment
+    bool Pending;   // The fetched event is not returned yet
+    bool Ended;
+    char Label;
+    const uint64_t *TID, *Addr, *Length, *Addr2;
+    const uint32_t *ID;
+  };
+  vector<Stream> streams;
+  size_t cur; // The trace that is currently read
+
+  MergedTraceIter(const vector<string> &trace_file_names);
+  ~MergedTraceIter();
+
+  /// Obtain the next event.
+  bool NextEvent(char &event_label, const uint64_t *&tid_ptr,
+                 const uint32_t *&id_ptr, const uint64_t *&addr_ptr,
+                 const uint64_t *&length_ptr, const uint64_t *&addr2_ptr);
+  /// Fetch the next event of a trace.
+  bool Fetch(Stream &s);
+  /// Pick the trace that goes next.
+  size_t Pick();
+};
+
+//===----------------------------------------------------------------------===//
+//                        Statistics
+//===----------------------------------------------------------------------===//
+
+/// The time and memory usage of one stage of print-bug.
+struct StageStat {
+  string Name;
+  string Unit;   // What the counted items are, e.g., events or blocks
+  uint64_t Items; // Number of processed items
+  double WallTime, CPUTime; // In seconds
+  long RSSBefore, RSSAfter, MaxRSS; // In KB
+  // Sizes of the main data structures after this stage
+  vector<pair<string, uint64_t> > Sizes;
+};
+
+// Print a progress line every ProgressInterval seconds, 0 for disabled.
+extern double ProgressInterval;
+extern vector<StageStat> Stages;
+
+void StatsBegin(const char *name, const char *unit);
+void StatsTick();
+void StatsEnd();
+void StatsSize(const char *name, uint64_t value);
+uint64_t CountNodes(SegmentTree<int> *tree);
+void StatsDump(const char *path);
+
 //===----------------------------------------------------------------------===//
 //                        Other
 //===----------------------------------------------------------------------===//
@@ -114,7 +206,7 @@ void ExtractImpactfulFunCall(
   char *pin_trace_file_name, set<uint64_t> &impactful_fun_call);
 
 void MergeTrace(
-  char *trace_file_name, set<uint64_t> &impactful_fun_call,
+  const vector<string> &trace_file_names, set<uint64_t> &impactful_fun_call,
   vector<SmallestBlock> &block_trace);
 
 void GroupMemory(vector<SmallestBlock> &block_trace);
@@ -4,12 +4,28 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 
+#include <string>
+#include <vector>
+
 using namespace llvm;
 
 namespace llvm {
   class ModulePass;
   ModulePass *createSlimmerTracePass ();
   void initializeSlimmerTracePass(PassRegistry&);
+
+  // The object files of the partitions generated in parallel but the first
+  // one, see -slimmer-codegen-threads.
+  std::vector<std::string> &SlimmerPartitionObjects();
+
+  // The hash of a module and the options, which names its information
+  // directory.
+  std::string SlimmerModuleHash(Module &module);
+  std::string SlimmerOptions();
+  // The options of the passes around SlimmerTrace, which change the objects
+  // but not the information directory.
+  std::string SlimmerBuilderOptions();
+  std::string SlimmerInfoDir(const std::string &hash);
 }
 
 #endif // SLIMMER_TRACE_H
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "llvm/IR/Module.h"
 
 #include "lz4.h"
+#include "TraceCodec.hpp"
 
 #include <assert.h>
 #include <stdio.h>
@@ -22,9 +23,11 @@
 #include <unistd.h>
 
 #include <iostream>
+#include <map>
 #include <set>
 #include <string>
 #include <sstream>
+#include <vector>
 
 // #define SLIMMER_PRINT_CODE
 // #define DEBUG_SLIMMER_UTILL
@@ -129,6 +132,9 @@ public:
 private:
   bool inited;
   char *buffer, *compressed;
+  TraceCodec codec;
+  uint32_t codec_id;
+  int codec_level;
   FILE *stream;
   size_t offset;
   size_t size; // Size of the event buffer in bytes
@@ -149,6 +155,30 @@ const static char SyscallEventLabel = 4;
 const static char ArgumentEventLabel = 5;
 const static char MemsetEventLabel = 6;
 const static char MemmoveEventLabel = 7;
+const static char GapEventLabel = 8;
+const static char ForkEventLabel = 9;
+const static char DepLoadEventLabel = 10;
+const static char DepEdgeEventLabel = 11;
+const static char StampEventLabel = 12;
+const static char LoopEventLabel = 13;
+const static char StridedEventLabel = 14;
+const static char SilentStoreEventLabel = 15;
+const static char PathEventLabel = 16;
+const static char FunctionEnterEventLabel = 17;
+const static char FunctionExitEventLabel = 18;
+const static char BatchEventLabel = 19;
+// The MemoryEvents of 1, 2, 4, 8 and 16 bytes, whose length is implied by the
+// label. They are decoded as MemoryEvents by GetEvent.
+const static char Memory1EventLabel = 20;
+const static char Memory2EventLabel = 21;
+const static char Memory4EventLabel = 22;
+const static char Memory8EventLabel = 23;
+const static char Memory16EventLabel = 24;
+// The compact events of the PIN tool, which are a label, the thread ID and
+// the function (except SyscallEvents), without the padding of the old ones.
+const static char PinCallEventLabel = 25;
+const static char PinReturnEventLabel = 26;
+const static char PinSyscallEventLabel = 27;
 const static char EndEventLabel = 125;
 const static char PlaceHolderLabel = 126;
 
@@ -161,9 +191,144 @@ const static size_t SizeOfReturnEvent = SizeOfEventCommon + 8;
 const static size_t SizeOfArgumentEvent = 2 + 8 + 8;
 const static size_t SizeOfMemsetEvent = SizeOfMemoryEvent;
 const static size_t SizeOfMemmoveEvent = SizeOfEventCommon + 3 * 8;
+// 2 label + dropped events + dropped bytes
+const static size_t SizeOfGapEvent = 2 + 2 * 8;
+// Common part (ID is the fork number) + parent PID + child PID
+const static size_t SizeOfForkEvent = SizeOfEventCommon + 2 * 8;
+// Common part + address + length + sequence number of the last writer
+const static size_t SizeOfDepLoadEvent = SizeOfEventCommon + 3 * 8;
+// 2 label + sequence number of a writer
+const static size_t SizeOfDepEdgeEvent = 2 + 8;
+// Common part (ID is the kind of the stamp) + stamp
+const static size_t SizeOfStampEvent = SizeOfEventCommon + 8;
+// Common part (ID is the basic block) + number of iterations
+const static size_t SizeOfLoopEvent = SizeOfEventCommon + 8;
+// Common part + base address + stride + size of each access
+const static size_t SizeOfStridedEvent = SizeOfEventCommon + 3 * 8;
+// Common part + iteration of the silent store
+const static size_t SizeOfSilentStoreEvent = SizeOfEventCommon + 8;
+// Common part (ID is the entry basic block of the function) + path number
+const static size_t SizeOfPathEvent = SizeOfEventCommon + 8;
+// Common part (ID is the entry basic block of the function)
+const static size_t SizeOfFunctionEvent = SizeOfEventCommon;
+// Common part (ID is the batch) + number of base addresses + silent stores,
+// followed by the base addresses and the number of them again
+const static size_t SizeOfBatchEvent = SizeOfEventCommon + 3 * 8;
+// Common part + address
+const static size_t SizeOfSizedMemoryEvent = SizeOfEventCommon + 8;
+// Label + thread ID (+ function)
+const static size_t SizeOfPinCallEvent = 1 + 2 * 8;
+const static size_t SizeOfPinSyscallEvent = 1 + 8;
+// The old events of the PIN tool, with a label at each end
+const static size_t SizeOfOldPinCallEvent = 130;
+const static size_t SizeOfOldPinSyscallEvent = 66;
+
+// The kinds of the ordering stamps
+const static uint32_t EpochStamp = 0; // A global counter
+const static uint32_t TSCStamp = 1;   // The time stamp counter of the CPU
 
 #define COMPRESS_BLOCK_CNT 150
 #define COMPRESS_BLOCK_SIZE 33554432lu
+// A thread is stamped again after this many events
+#define SLIMMER_STAMP_PERIOD 4096
+// The most memory accesses of a summarized loop
+#define SLIMMER_MAX_STRIDED 32
+// The most acyclic paths of a path-encoded function
+#define SLIMMER_MAX_PATHS (1lu << 62)
+// The most memory accesses of a batch, one bit of the silent stores for each
+#define SLIMMER_MAX_BATCH 64
+
+//===----------------------------------------------------------------------===//
+//                           Runtime Statistics
+//===----------------------------------------------------------------------===//
+// The runtime keeps its counters in a shared memory segment,
+// i.e., /dev/shm/slimmer-stat-<pid>, which can be polled by slimmer-stat.
+#define SLIMMER_STAT_PATH "/dev/shm/slimmer-stat-"
+#define SLIMMER_STAT_MAGIC "SLMSTAT"
+#define SLIMMER_STAT_MAX_THREAD 256
+#define SLIMMER_CACHE_LINE 64
+
+/// Counters of one application thread.
+/// Each thread only writes its own cache line.
+struct alignas(SLIMMER_CACHE_LINE) ThreadStat {
+  uint64_t TID;
+  uint64_t Events, Bytes; // Appended events and their bytes
+  uint64_t Stalls;        // Times of waiting for an empty block
+  uint64_t StallNanos;    // Time spent in waiting for an empty block
+};
+
+/// Counters of the compressing and dumping threads.
+/// The counters of each writer are kept in a cache line of their own.
+struct PipelineStat {
+  // Written by the application threads, under the append lock
+  alignas(SLIMMER_CACHE_LINE) uint64_t BlocksFilled; // Blocks handed to the
+                                                     // compressing thread
+  uint64_t BlocksDropped; // Blocks dropped in the lossy mode
+  uint64_t EventsDropped;
+
+  // Written by the compressing thread
+  alignas(SLIMMER_CACHE_LINE) uint64_t BlocksCompressed; // Blocks compressed
+  uint64_t RawBytes, CompressedBytes;
+  uint64_t CompressNanos; // Time spent in compressing
+  uint64_t CompressLevel; // The level of the last compressed block
+
+  // Written by the dumping thread
+  alignas(SLIMMER_CACHE_LINE) uint64_t BlocksDumped; // Blocks written to the
+                                                     // trace file
+  uint64_t DumpedBytes;
+  uint64_t DumpNanos; // Time spent in writing the trace file
+};
+
+/// The layout of the shared memory segment.
+struct RuntimeStat {
+  char Magic[8];
+  uint64_t PID;
+  uint64_t StartNanos; // CLOCK_REALTIME when the tracing started
+  uint64_t BlockSize, BlockCnt;
+  uint64_t NumThreads; // Number of used slots of Threads
+  char TracePath[256];
+  PipelineStat Pipeline;
+  // The last slot is shared by all the threads beyond the limit
+  ThreadStat Threads[SLIMMER_STAT_MAX_THREAD];
+};
+
+//===----------------------------------------------------------------------===//
+//                           Counting Profile
+//===----------------------------------------------------------------------===//
+// In the counting mode (SLIMMER_MODE=count), the runtime records no event but
+// counts the executions and the inefficacious writes of each instruction,
+// and writes them to TRACE.prof at exit, i.e., a ProfileHeader followed by a
+// ProfileRecord of each executed instruction. It is reported by
+// slimmer-report.
+#define SLIMMER_PROFILE_MAGIC "SLMPROF"
+// The instructions with larger IDs are not counted
+#define SLIMMER_MAX_COUNTED_INS (1lu << 24)
+
+/// The counters of an instruction.
+struct InsCounter {
+  uint64_t Execs;
+  uint64_t Silent; // The executions that write the same values
+  uint64_t Bytes;  // The bytes written by the stores, memsets and memmoves
+  uint64_t RedundantBytes; // The bytes written by the silent executions
+};
+
+// A profile is a header, followed by the records of the instructions and
+// then the ones of the basic blocks (with -slimmer-bb-counters).
+struct ProfileHeader {
+  char Magic[8];
+  uint64_t NumRecords;
+  uint64_t NumBBRecords;
+};
+
+struct ProfileRecord {
+  uint64_t ID; // The instruction ID
+  InsCounter Counter;
+};
+
+struct BBProfileRecord {
+  uint64_t BB; // The basic block ID
+  uint64_t Execs;
+};
 
 //===----------------------------------------------------------------------===//
 //                           Routines
@@ -220,8 +385,65 @@ int GetEvent(bool backward, const char *cur, char &event_label,
 void LoadInstrumentedFun(std::string path, std::set<std::string> &instrumented);
 void LoadInstInfo(std::string path, std::vector<InstInfo> &info,
                   std::vector<std::vector<uint32_t> > &bb2ins);
+void LoadFunEntry(std::string path, std::vector<uint32_t> &bb2fun);
+
+/// A memory access of a batch, whose address is a base address of the
+/// BatchEvent plus a constant offset. It is laid out as the descriptors
+/// emitted by SlimmerTrace.
+struct BatchAccess {
+  uint32_t ID;   // The instruction ID
+  uint32_t Base; // The index of the base address
+  int64_t Offset;
+  uint32_t Length;
+  uint32_t Store; // 1 for a store, 0 for a load
+};
+
+void LoadBatch(std::string path,
+               std::vector<std::vector<BatchAccess> > &batches);
 bool IsImpactfulFunction(std::string name);
 
+//===----------------------------------------------------------------------===//
+//                           Path Numbering
+//===----------------------------------------------------------------------===//
+
+/// The Ball-Larus numbering of the acyclic paths of a function, which is
+/// computed from the basic block IDs in the same way by SlimmerTrace and
+/// print-bug.
+///
+/// The back edges are found by a DFS from the entry in the order of the
+/// successors. Each back edge v->w is replaced by two dummy edges ENTRY->w and
+/// v->EXIT, and a path of the resulting DAG is numbered by the sum of the
+/// values of its edges, from 0 to NumPaths - 1.
+///
+struct PathNumbering {
+  struct Edge {
+    int64_t To; // -1 for EXIT
+    uint64_t Val;
+    Edge(int64_t to, uint64_t val) : To(to), Val(val) {}
+  };
+
+  uint32_t Entry;
+  uint64_t NumPaths;
+  // The edges of ENTRY, i.e., the entry block followed by the loop headers.
+  std::vector<Edge> EntryEdges;
+  // The edges of each reachable basic block, in the order of the successors.
+  std::map<uint32_t, std::vector<Edge> > Out;
+
+  // The values of the DAG edges, of the dummy edges ENTRY->w (HeaderVal) and
+  // v->EXIT (BackVal for each back edge, ReturnVal for a block without
+  // successors).
+  std::map<std::pair<uint32_t, uint32_t>, uint64_t> EdgeVal, BackVal;
+  std::map<uint32_t, uint64_t> HeaderVal, ReturnVal;
+
+  bool Build(uint32_t entry,
+             const std::map<uint32_t, std::vector<uint32_t> > &successor);
+  bool Decode(uint64_t path, std::vector<uint32_t> &blocks,
+              bool &returned) const;
+};
+
+void LoadPathFun(std::string path, std::string bbgraph,
+                 std::map<uint32_t, PathNumbering> &funs);
+
 //===----------------------------------------------------------------------===//
 //                           Dynamic Instruction
 //===----------------------------------------------------------------------===//
@@ -232,7 +454,7 @@ struct DynamicInst {
   DynamicInst() {}
   DynamicInst(uint64_t tid, int32_t id, int32_t cnt)
       : TID(tid), ID(id), Cnt(cnt) {}
-  bool operator==(const DynamicInst &rhs) {
+  bool operator==(const DynamicInst &rhs) const {
     return TID == rhs.TID && ID == rhs.ID && Cnt == rhs.Cnt;
   }
   bool operator<(const DynamicInst &rhs) const {
@@ -263,6 +485,9 @@ public:
 
 private:
   char *buffer, *compressed;
+  TraceCodec codec;
+  uint32_t codec_id;
+  int codec_level;
   FILE *stream;
   size_t offset;
   size_t size; // Size of the event buffer in bytes
@@ -0,0 +1,333 @@
+#ifndef SLIMMER_TRACE_CODEC_HPP
+#define SLIMMER_TRACE_CODEC_HPP
+
+#include "lz4.h"
+#include "lz4hc.h"
+#ifdef SLIMMER_HAVE_ZSTD
+#include "zstd.h"
+#include "zdict.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//===----------------------------------------------------------------------===//
+//                           Trace Codec
+//===----------------------------------------------------------------------===//
+//
+// A trace file is a header followed by the compressed blocks,
+//
+//   [TraceHeader][dictionary] ([length word][block][length word])*
+//
+// where the top byte of a length word is the codec of the block and the rest
+// is the length of the block. Traces written before the header was introduced
+// start with a length word directly, and all of their blocks are LZ4 blocks
+// (codec 0).
+
+const static uint32_t LZ4Codec = 0;
+const static uint32_t LZ4HCCodec = 1;
+const static uint32_t ZstdCodec = 2;
+const static uint32_t NumCodecs = 3;
+
+#define SLIMMER_TRACE_MAGIC "SLMTRAC"
+#define SLIMMER_CODEC_SHIFT 56
+// The size of a trained dictionary
+#define SLIMMER_DICT_SIZE (112lu << 10)
+
+struct TraceHeader {
+  char Magic[8];
+  uint32_t Codec;    // The codec of the blocks, unless the ring falls behind
+  uint32_t DictSize; // Bytes of the zstd dictionary following the header
+};
+
+/// Compress and decompress the blocks of a trace.
+///
+/// A TraceCodec keeps the zstd contexts, hence an object should only be used
+/// by one thread at a time. LZ4 and LZ4-HC blocks need no state, and
+/// compressing them never allocates memory.
+///
+class TraceCodec {
+public:
+  TraceCodec() {
+#ifdef SLIMMER_HAVE_ZSTD
+    cctx = NULL;
+    dctx = NULL;
+#endif
+  }
+  ~TraceCodec() {
+#ifdef SLIMMER_HAVE_ZSTD
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+#endif
+  }
+
+  static const char *Name(uint32_t codec) {
+    static const char *names[] = {"lz4", "lz4hc", "zstd"};
+    return codec < NumCodecs ? names[codec] : "unknown";
+  }
+
+  /// Is the codec compiled in?
+  static bool Supported(uint32_t codec) {
+#ifdef SLIMMER_HAVE_ZSTD
+    return codec < NumCodecs;
+#else
+    return codec < ZstdCodec;
+#endif
+  }
+
+  /// The range of the levels, where a higher level compresses better.
+  /// The LZ4 levels 1-9 are the accelerations 9-1 of LZ4_compress_fast.
+  static int MinLevel(uint32_t codec) { return 1; }
+  static int MaxLevel(uint32_t codec) {
+    return codec == LZ4Codec ? 9 : (codec == LZ4HCCodec ? 12 : 19);
+  }
+  static int DefaultLevel(uint32_t codec) {
+    return codec == LZ4Codec ? 9 : (codec == LZ4HCCodec ? 9 : 3);
+  }
+
+  /// The largest compressed size of size bytes by any codec.
+  static size_t Bound(size_t size) {
+    size_t bound = LZ4_compressBound(size);
+#ifdef SLIMMER_HAVE_ZSTD
+    if (ZSTD_compressBound(size) > bound)
+      bound = ZSTD_compressBound(size);
+#endif
+    return bound;
+  }
+
+  static uint64_t Length(uint64_t word) {
+    return word & ((1lu << SLIMMER_CODEC_SHIFT) - 1);
+  }
+  static uint32_t Codec(uint64_t word) { return word >> SLIMMER_CODEC_SHIFT; }
+
+  /// Choose the codec and its level by the environment variables
+  /// SLIMMER_CODEC and SLIMMER_CODEC_LEVEL, and load the dictionary given by
+  /// SLIMMER_ZSTD_DICT for zstd.
+  ///
+  /// \param codec - the chosen codec, LZ4 by default.
+  /// \param level - the chosen level.
+  ///
+  void Configure(uint32_t &codec, int &level) {
+    codec = LZ4Codec;
+    const char *codec_env = getenv("SLIMMER_CODEC");
+    if (codec_env) {
+      uint32_t c = 0;
+      while (c < NumCodecs && strcmp(codec_env, Name(c)) != 0)
+        ++c;
+      if (c == NumCodecs)
+        fprintf(stderr, "[SLIMMER] Unknown SLIMMER_CODEC %s, should be lz4, "
+                        "lz4hc or zstd\n",
+                codec_env);
+      else if (!Supported(c))
+        fprintf(stderr, "[SLIMMER] %s is not compiled in, using lz4\n",
+                codec_env);
+      else
+        codec = c;
+    }
+
+    level = DefaultLevel(codec);
+    const char *level_env = getenv("SLIMMER_CODEC_LEVEL");
+    if (level_env)
+      level = std::min(std::max(atoi(level_env), MinLevel(codec)),
+                       MaxLevel(codec));
+
+    const char *dict_env = getenv("SLIMMER_ZSTD_DICT");
+    if (dict_env && codec == ZstdCodec && !LoadDictionary(dict_env))
+      fprintf(stderr, "[SLIMMER] Cannot load the dictionary %s\n", dict_env);
+  }
+
+  /// Load a dictionary file for the zstd blocks.
+  ///
+  bool LoadDictionary(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+      return false;
+    std::string dict;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      dict.append(buf, n);
+    fclose(f);
+    return SetDictionary(dict.data(), dict.size());
+  }
+
+  bool SetDictionary(const char *data, size_t size) {
+#ifdef SLIMMER_HAVE_ZSTD
+    dict.assign(data, size);
+    if (cctx)
+      ZSTD_CCtx_loadDictionary(cctx, dict.data(), dict.size());
+    if (dctx)
+      ZSTD_DCtx_loadDictionary(dctx, dict.data(), dict.size());
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /// Write the header of a trace.
+  ///
+  void WriteHeader(FILE *stream, uint32_t codec) {
+    TraceHeader header;
+    memcpy(header.Magic, SLIMMER_TRACE_MAGIC, sizeof(header.Magic));
+    header.Codec = codec;
+    header.DictSize = dict.size();
+    fwrite(&header, sizeof(header), 1, stream);
+    fwrite(dict.data(), 1, dict.size(), stream);
+  }
+
+  /// Read the header of a trace and load its dictionary.
+  ///
+  /// \return - the offset of the first block, 0 for an old trace.
+  ///
+  size_t ReadHeader(const char *data, size_t size) {
+    const TraceHeader *header = (const TraceHeader *)data;
+    if (size < sizeof(TraceHeader) ||
+        memcmp(header->Magic, SLIMMER_TRACE_MAGIC, sizeof(header->Magic)) != 0)
+      return 0;
+    size_t offset = sizeof(TraceHeader) + header->DictSize;
+    if (offset > size) {
+      fprintf(stderr, "[SLIMMER] The trace header is truncated.\n");
+      return size;
+    }
+    if (!Supported(header->Codec))
+      fprintf(stderr, "[SLIMMER] The trace is compressed by %s, which is not "
+                      "compiled in.\n",
+              Name(header->Codec));
+    if (header->DictSize)
+      SetDictionary(data + sizeof(TraceHeader), header->DictSize);
+    return offset;
+  }
+
+  /// Compress a block.
+  ///
+  /// \param codec - the codec.
+  /// \param level - the level, see MinLevel and MaxLevel.
+  /// \param src - the starting address of the block.
+  /// \param size - the size of the block.
+  /// \param dst - the destination, of Bound(size) bytes.
+  /// \return - the length word of the compressed block, 0 on failure.
+  ///
+  uint64_t Compress(uint32_t codec, int level, const char *src, size_t size,
+                    char *dst) {
+    uint64_t length = 0;
+    if (codec == LZ4Codec) {
+      length = LZ4_compress_fast(src, dst, size, LZ4_compressBound(size),
+                                 MaxLevel(LZ4Codec) + 1 - level);
+    } else if (codec == LZ4HCCodec) {
+      length = LZ4_compress_HC(src, dst, size, LZ4_compressBound(size), level);
+#ifdef SLIMMER_HAVE_ZSTD
+    } else if (codec == ZstdCodec) {
+      if (cctx == NULL) {
+        cctx = ZSTD_createCCtx();
+        if (dict.size())
+          ZSTD_CCtx_loadDictionary(cctx, dict.data(), dict.size());
+      }
+      ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+      size_t ret = ZSTD_compress2(cctx, dst, Bound(size), src, size);
+      length = ZSTD_isError(ret) ? 0 : ret;
+#endif
+    }
+    return length ? ((uint64_t)codec << SLIMMER_CODEC_SHIFT) | length : 0;
+  }
+
+  /// Compress a block and append it to a stream.
+  ///
+  /// \param dst - a buffer of Bound(size) bytes.
+  ///
+  void WriteBlock(FILE *stream, uint32_t codec, int level, const char *src,
+                  size_t size, char *dst) {
+    uint64_t word = Compress(codec, level, src, size, dst);
+    uint64_t length = Length(word);
+    fwrite(&word, sizeof(word), 1, stream);
+    size_t cur = 0;
+    while (cur < length) {
+      size_t tmp = fwrite(dst + cur, 1, length - cur, stream);
+      if (tmp > 0)
+        cur += tmp;
+    }
+    fwrite(&word, sizeof(word), 1, stream);
+  }
+
+  /// Decompress a block.
+  ///
+  /// \param word - the length word of the block.
+  /// \param src - the starting address of the block.
+  /// \param dst - the destination.
+  /// \param capacity - the size of the destination.
+  /// \return - the decompressed size, -1 on failure.
+  ///
+  int64_t Decompress(uint64_t word, const char *src, char *dst,
+                     size_t capacity) {
+    uint32_t codec = Codec(word);
+    if (codec == LZ4Codec || codec == LZ4HCCodec) {
+      int ret = LZ4_decompress_safe(src, dst, Length(word), capacity);
+      return ret < 0 ? -1 : ret;
+    }
+#ifdef SLIMMER_HAVE_ZSTD
+    if (codec == ZstdCodec) {
+      if (dctx == NULL) {
+        dctx = ZSTD_createDCtx();
+        if (dict.size())
+          ZSTD_DCtx_loadDictionary(dctx, dict.data(), dict.size());
+      }
+      size_t ret = ZSTD_decompressDCtx(dctx, dst, capacity, src, Length(word));
+      return ZSTD_isError(ret) ? -1 : (int64_t)ret;
+    }
+#endif
+    return -1;
+  }
+
+  /// Train a zstd dictionary from slices of some raw blocks.
+  ///
+  /// \param blocks - the raw blocks.
+  /// \param size - the size of each block.
+  /// \param path - the dictionary file to write.
+  /// \return - false if zstd is not compiled in or the training failed.
+  ///
+  static bool TrainDictionary(const std::vector<const char *> &blocks,
+                              size_t size, const char *path) {
+#ifdef SLIMMER_HAVE_ZSTD
+    // About 100 times of the dictionary size is sampled, in 8KB slices.
+    const size_t slice = 8192;
+    size_t per_block = std::max((size_t)1, 100 * SLIMMER_DICT_SIZE / slice /
+                                               std::max((size_t)1,
+                                                        blocks.size()));
+    per_block = std::min(per_block, size / slice);
+    std::string samples;
+    std::vector<size_t> sizes;
+    for (auto block : blocks)
+      for (size_t i = 0; i < per_block; ++i) {
+        samples.append(block + i * (size / per_block), slice);
+        sizes.push_back(slice);
+      }
+
+    std::string dict(SLIMMER_DICT_SIZE, 0);
+    size_t ret = ZDICT_trainFromBuffer(&dict[0], dict.size(), samples.data(),
+                                       sizes.data(), sizes.size());
+    if (ZDICT_isError(ret))
+      return false;
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+      return false;
+    fwrite(dict.data(), 1, ret, f);
+    fclose(f);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+private:
+  std::string dict; // The zstd dictionary, empty for none
+#ifdef SLIMMER_HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+#endif
+};
+
+#endif
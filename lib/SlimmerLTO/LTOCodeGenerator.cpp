@@ -52,10 +52,132 @@
 
 // Added For SLIMMER Start
 #include "SlimmerTrace.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Threading.h"
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
 // Added For SLIMMER End
 
 using namespace llvm;
 
+// Added For SLIMMER Start
+static cl::opt<unsigned> CodegenThreads(
+    "slimmer-codegen-threads",
+    cl::desc("Split the instrumented module into this many partitions and "
+             "generate their code in parallel"),
+    cl::init(1));
+
+// The object files of the partitions but the first one, which is written to
+// the output of generateObjectFile.
+static std::vector<std::string> PartitionObjects;
+
+std::vector<std::string> &llvm::SlimmerPartitionObjects() {
+  return PartitionObjects;
+}
+
+static cl::opt<std::string> SlimmerCacheDir(
+    "slimmer-cache-dir",
+    cl::desc("Reuse the object files of a module that has been instrumented "
+             "with the same options, which are kept in this directory"),
+    cl::init(""));
+
+//===----------------------------------------------------------------------===//
+//                        Object Cache
+//===----------------------------------------------------------------------===//
+// The objects of an instrumented module are cached by the hash of the merged
+// module (before instrumenting) and all the options, as
+//
+//   KEY.o, KEY.1.o, ..., KEY.(N-1).o   the objects of the N partitions
+//   KEY.parts                          N, written at last
+//
+// A cached module is linked without running the passes and the code
+// generator, if its information directory still exists.
+
+/// Append a file to a stream.
+///
+static bool appendFile(const std::string &path, raw_ostream &out) {
+  OwningPtr<MemoryBuffer> buffer;
+  if (MemoryBuffer::getFile(path, buffer))
+    return false;
+  out << buffer->getBuffer();
+  return true;
+}
+
+/// Copy a file to another path, through a temporary file, thus a reader
+/// never sees a partial file.
+///
+static bool copyFile(const std::string &from, const std::string &to) {
+  std::string errInfo, tmp = to + ".tmp";
+  {
+    raw_fd_ostream out(tmp.c_str(), errInfo, sys::fs::F_Binary);
+    if (!errInfo.empty() || !appendFile(from, out))
+      return false;
+  }
+  return !sys::fs::rename(tmp, to);
+}
+
+/// Load the cached objects of a module.
+///
+/// \param key - the hash of the module.
+/// \param out - the first object is written to it.
+/// \return - false if the module is not cached.
+///
+static bool loadCachedObjects(const std::string &key, raw_ostream &out) {
+  std::string prefix = SlimmerCacheDir + "/" + key;
+  OwningPtr<MemoryBuffer> parts_file;
+  unsigned parts;
+  if (MemoryBuffer::getFile(prefix + ".parts", parts_file) ||
+      parts_file->getBuffer().trim().getAsInteger(10, parts) || parts == 0)
+    return false;
+  bool exists = false;
+  if (sys::fs::exists(SlimmerInfoDir(key) + "/Inst", exists) || !exists)
+    return false;
+
+  PartitionObjects.clear();
+  bool ok = true;
+  for (unsigned p = 1; ok && p < parts; ++p) {
+    SmallString<128> filename;
+    int fd;
+    if (sys::fs::createTemporaryFile("lto-llvm-part", "o", fd, filename)) {
+      ok = false;
+      break;
+    }
+    raw_fd_ostream part(fd, true);
+    PartitionObjects.push_back(filename.c_str());
+    ok = appendFile(prefix + "." + utostr(p) + ".o", part);
+  }
+  if (ok && appendFile(prefix + ".o", out))
+    return true;
+
+  for (unsigned p = 0; p < PartitionObjects.size(); ++p)
+    sys::fs::remove(PartitionObjects[p]);
+  PartitionObjects.clear();
+  return false;
+}
+
+/// Save the objects of a module to the cache.
+///
+/// \param key - the hash of the module.
+/// \param object - the first object.
+///
+static void saveCachedObjects(const std::string &key,
+                              const std::string &object) {
+  std::string prefix = SlimmerCacheDir + "/" + key;
+  system(("mkdir -p " + SlimmerCacheDir).c_str());
+  bool ok = copyFile(object, prefix + ".o");
+  for (unsigned p = 0; ok && p < PartitionObjects.size(); ++p)
+    ok = copyFile(PartitionObjects[p], prefix + "." + utostr(p + 1) + ".o");
+  if (!ok)
+    return;
+  std::string errInfo;
+  raw_fd_ostream parts((prefix + ".parts").c_str(), errInfo);
+  if (errInfo.empty())
+    parts << PartitionObjects.size() + 1 << "\n";
+}
+// Added For SLIMMER End
+
 const char* LTOCodeGenerator::getVersionString() {
 #ifdef LLVM_VERSION_INFO
   return PACKAGE_NAME " version " PACKAGE_VERSION ", " LLVM_VERSION_INFO;
@@ -223,6 +345,44 @@ bool LTOCodeGenerator::compile_to_file(const char** name,
   // generate object file
   tool_output_file objFile(Filename.c_str(), FD);
 
+  // Added For SLIMMER Start
+  // The key of the cache is the hash of the module and all the options, see
+  // SlimmerModuleHash, which is passed to SlimmerTrace by the metadata.
+  std::string cacheKey;
+  PartitionObjects.clear();
+  if (!SlimmerCacheDir.empty() && determineTarget(errMsg)) {
+    applyScopeRestrictions();
+    Module *mergedModule = Linker.getModule();
+    std::string bitcode;
+    raw_string_ostream os(bitcode);
+    WriteBitcodeToFile(mergedModule, os);
+    os << SlimmerOptions() << " " << SlimmerBuilderOptions() << " "
+       << disableOpt << disableInline << disableGVNLoadPRE << MCpu << CodeModel
+       << CodegenThreads;
+    for (unsigned i = 0; i < CodegenOptions.size(); ++i)
+      os << " " << CodegenOptions[i];
+    os.flush();
+
+    MD5 md5;
+    md5.update(bitcode);
+    MD5::MD5Result result;
+    md5.final(result);
+    SmallString<32> hex;
+    MD5::stringifyResult(result, hex);
+    cacheKey = hex.str();
+
+    if (loadCachedObjects(cacheKey, objFile.os())) {
+      objFile.os().close();
+      objFile.keep();
+      NativeObjectPath = Filename.c_str();
+      *name = NativeObjectPath.c_str();
+      return true;
+    }
+    NamedMDNode *md = mergedModule->getOrInsertNamedMetadata("slimmer.hash");
+    md->addOperand(MDNode::get(Context, MDString::get(Context, cacheKey)));
+  }
+  // Added For SLIMMER End
+
   bool genResult = generateObjectFile(objFile.os(), disableOpt, disableInline,
                                       disableGVNLoadPRE, errMsg);
   objFile.os().close();
@@ -238,6 +398,11 @@ bool LTOCodeGenerator::compile_to_file(const char** name,
     return false;
   }
 
+  // Added For SLIMMER Start
+  if (!cacheKey.empty())
+    saveCachedObjects(cacheKey, Filename.c_str());
+  // Added For SLIMMER End
+
   NativeObjectPath = Filename.c_str();
   *name = NativeObjectPath.c_str();
   return true;
@@ -447,6 +612,276 @@ void LTOCodeGenerator::applyScopeRestrictions() {
   ScopeRestrictionsDone = true;
 }
 
+// Added For SLIMMER Start
+//===----------------------------------------------------------------------===//
+//                        Parallel Code Generation
+//===----------------------------------------------------------------------===//
+// The instrumented module is split into partitions after all the passes,
+// i.e., after SlimmerTrace has numbered the basic blocks and instructions.
+// Each function is defined in one partition, and all the global variables,
+// aliases and module-level asm are kept in the first one. A local symbol that
+// is used by another partition gets hidden external linkage, while keeping
+// its name, since the PIN tool matches the functions by their names.
+//
+// The module is passed to the threads as bitcode, since a LLVMContext cannot
+// be shared by the threads. Each thread loads it lazily in its own context,
+// and only reads the bodies of the functions of its partition.
+
+/// Collect the partitions that use a value, through the constants.
+///
+static void collectUsers(const Value *v,
+                         const std::map<const Function *, unsigned> &home,
+                         std::set<unsigned> &parts,
+                         std::set<const Value *> &visited) {
+  for (Value::const_use_iterator it = v->use_begin(), end = v->use_end();
+       it != end; ++it) {
+    const User *user = *it;
+    if (const Instruction *ins = dyn_cast<Instruction>(user)) {
+      parts.insert(home.find(ins->getParent()->getParent())->second);
+    } else if (isa<GlobalVariable>(user)) {
+      parts.insert(0);
+    } else if (isa<GlobalAlias>(user)) {
+      // The other partitions use the aliased symbol directly
+      parts.insert(0);
+      if (visited.insert(user).second)
+        collectUsers(user, home, parts, visited);
+    } else if (isa<Constant>(user) && visited.insert(user).second) {
+      collectUsers(user, home, parts, visited);
+    }
+  }
+}
+
+/// Assign each function to a partition, balanced by the number of
+/// instructions, and externalize the local symbols used across partitions.
+///
+/// \param module - the instrumented module.
+/// \param n - the number of partitions.
+/// \param home - the partition of each function.
+///
+static void assignPartitions(Module *module, unsigned n,
+                             std::map<const Function *, unsigned> &home) {
+  std::vector<std::pair<size_t, Function *> > funs;
+  std::set<const GlobalValue *> pinned; // Functions aliased by the aliases
+  for (Module::alias_iterator it = module->alias_begin(),
+                              end = module->alias_end();
+       it != end; ++it)
+    pinned.insert(it->getAliasedGlobal());
+  for (Module::iterator fun = module->begin(), end = module->end();
+       fun != end; ++fun) {
+    if (fun->isDeclaration())
+      continue;
+    size_t size = 0;
+    for (Function::iterator bb = fun->begin(); bb != fun->end(); ++bb)
+      size += bb->size();
+    if (pinned.count(fun))
+      home[fun] = 0;
+    else
+      funs.push_back(std::make_pair(size, (Function *)fun));
+  }
+
+  // The largest functions first, each to the least loaded partition
+  std::stable_sort(funs.begin(), funs.end(),
+                   [](const std::pair<size_t, Function *> &a,
+                      const std::pair<size_t, Function *> &b) {
+    return a.first > b.first;
+  });
+  std::vector<size_t> load(n, 0);
+  for (auto &i : funs) {
+    unsigned p = std::min_element(load.begin(), load.end()) - load.begin();
+    home[i.second] = p;
+    load[p] += i.first;
+  }
+
+  unsigned renamed = 0;
+  auto externalize = [&](GlobalValue *gv, unsigned p) {
+    if (!gv->hasLocalLinkage())
+      return;
+    std::set<unsigned> parts;
+    std::set<const Value *> visited;
+    collectUsers(gv, home, parts, visited);
+    parts.erase(p);
+    if (parts.empty())
+      return;
+    if (!gv->hasName())
+      gv->setName("slimmer.part." + Twine(renamed++));
+    gv->setLinkage(GlobalValue::ExternalLinkage);
+    gv->setVisibility(GlobalValue::HiddenVisibility);
+  };
+  for (Module::iterator fun = module->begin(), end = module->end();
+       fun != end; ++fun)
+    if (!fun->isDeclaration())
+      externalize(fun, home[fun]);
+  for (Module::global_iterator gv = module->global_begin(),
+                               end = module->global_end();
+       gv != end; ++gv)
+    if (!gv->isDeclaration())
+      externalize(gv, 0);
+}
+
+/// Load a partition from the bitcode of the module, in which the functions
+/// of the other partitions are left unread and turned into declarations.
+///
+/// \param bitcode - the bitcode of the instrumented module.
+/// \param p - the partition.
+/// \param home - the partition of each function, in the order of the module.
+/// \param context - the context of the thread.
+/// \param errMsg - the error message.
+/// \return - the partition, or NULL on error.
+///
+static Module *loadPartition(const std::string &bitcode, unsigned p,
+                             const std::vector<unsigned> &home,
+                             LLVMContext &context, std::string &errMsg) {
+  MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(bitcode, "", false);
+  Module *part = getLazyBitcodeModule(buffer, context, &errMsg);
+  if (part == NULL) {
+    delete buffer;
+    return NULL;
+  }
+  unsigned index = 0;
+  for (Module::iterator fun = part->begin(), end = part->end(); fun != end;
+       ++fun, ++index) {
+    if (home[index] == p) {
+      if (fun->isMaterializable() && fun->Materialize(&errMsg)) {
+        delete part;
+        return NULL;
+      }
+    } else if (!fun->isDeclaration() || fun->isMaterializable()) {
+      fun->deleteBody();
+    }
+  }
+
+  if (p != 0) {
+    for (Module::global_iterator gv = part->global_begin(),
+                                 end = part->global_end();
+         gv != end;) {
+      GlobalVariable *var = gv++;
+      if (var->isDeclaration())
+        continue;
+      if (var->hasAppendingLinkage()) { // llvm.global_ctors, llvm.used, ...
+        var->eraseFromParent();
+        continue;
+      }
+      var->setInitializer(NULL);
+      var->setLinkage(GlobalValue::ExternalLinkage);
+    }
+    // The uses of an alias refer to the aliased symbol instead
+    while (!part->alias_empty()) {
+      GlobalAlias *alias = part->alias_begin();
+      alias->replaceAllUsesWith(alias->getAliasee());
+      alias->eraseFromParent();
+    }
+    part->setModuleInlineAsm("");
+  }
+  return part;
+}
+
+/// Generate the code of a partition in its own context.
+///
+static bool generatePartition(const std::string &bitcode, unsigned p,
+                              const std::vector<unsigned> &home,
+                              const TargetMachine *tm, raw_ostream &out,
+                              std::string &errMsg) {
+  LLVMContext context;
+  Module *module = loadPartition(bitcode, p, home, context, errMsg);
+  if (module == NULL)
+    return false;
+
+  const Target &target = tm->getTarget();
+  OwningPtr<TargetMachine> machine(target.createTargetMachine(
+      tm->getTargetTriple(), tm->getTargetCPU(), tm->getTargetFeatureString(),
+      tm->Options, tm->getRelocationModel(), tm->getCodeModel(),
+      tm->getOptLevel()));
+
+  PassManager codeGenPasses;
+  codeGenPasses.add(new DataLayout(*machine->getDataLayout()));
+  machine->addAnalysisPasses(codeGenPasses);
+  codeGenPasses.add(createObjCARCContractPass());
+  formatted_raw_ostream Out(out);
+  if (machine->addPassesToEmitFile(codeGenPasses, Out,
+                                   TargetMachine::CGFT_ObjectFile)) {
+    errMsg = "target file type not supported";
+    delete module;
+    return false;
+  }
+  codeGenPasses.run(*module);
+  delete module;
+  return true;
+}
+
+/// Split the module into CodegenThreads partitions, and generate their code
+/// in parallel. The first partition is written to out, and the others to
+/// temporary object files (see SlimmerPartitionObjects).
+///
+static bool generatePartitions(Module *module, const TargetMachine *tm,
+                               raw_ostream &out, std::string &errMsg) {
+  unsigned n = CodegenThreads;
+  std::map<const Function *, unsigned> home;
+  assignPartitions(module, n, home);
+  // The partition of each function by its position, which the bitcode keeps
+  std::vector<unsigned> fun_home;
+  for (Module::iterator fun = module->begin(), end = module->end();
+       fun != end; ++fun)
+    fun_home.push_back(fun->isDeclaration() ? 0 : home[fun]);
+
+  std::string bitcode;
+  raw_string_ostream os(bitcode);
+  WriteBitcodeToFile(module, os);
+  os.flush();
+
+  // A file that is not kept is removed when it is deleted
+  std::vector<tool_output_file *> files(n, (tool_output_file *)NULL);
+  auto remove_files = [&]() {
+    for (auto file : files)
+      delete file;
+    PartitionObjects.clear();
+  };
+  PartitionObjects.clear();
+  for (unsigned p = 1; p < n; ++p) {
+    SmallString<128> filename;
+    int fd;
+    error_code ec =
+        sys::fs::createTemporaryFile("lto-llvm-part", "o", fd, filename);
+    if (ec) {
+      errMsg = ec.message();
+      remove_files();
+      return false;
+    }
+    files[p] = new tool_output_file(filename.c_str(), fd);
+    PartitionObjects.push_back(filename.c_str());
+  }
+
+  llvm_start_multithreaded();
+  std::atomic<unsigned> next(0);
+  std::vector<std::string> errors(n);
+  std::vector<char> ok(n, 0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n; ++t)
+    workers.push_back(std::thread([&]() {
+      for (unsigned p = next++; p < n; p = next++)
+        ok[p] = generatePartition(bitcode, p, fun_home, tm,
+                                  p == 0 ? out : files[p]->os(), errors[p]);
+    }));
+  for (auto &worker : workers)
+    worker.join();
+
+  for (unsigned p = 0; p < n; ++p) {
+    if (!ok[p]) {
+      errMsg = errors[p];
+      remove_files();
+      return false;
+    }
+  }
+  for (auto file : files) {
+    if (file) {
+      file->os().close();
+      file->keep();
+      delete file;
+    }
+  }
+  return true;
+}
+// Added For SLIMMER End
+
 /// Optimize merged modules using various IPO passes
 bool LTOCodeGenerator::generateObjectFile(raw_ostream &out,
                                           bool DisableOpt,
@@ -483,6 +918,13 @@ bool LTOCodeGenerator::generateObjectFile(raw_ostream &out,
   // Make sure everything is still good.
   passes.add(createVerifierPass());
 
+  // Added For SLIMMER Start
+  if (CodegenThreads > 1) {
+    passes.run(*mergedModule);
+    return generatePartitions(mergedModule, TargetMach, out, errMsg);
+  }
+  // Added For SLIMMER End
+
   PassManager codeGenPasses;
 
   codeGenPasses.add(new DataLayout(*TargetMach->getDataLayout()));
@@ -28,6 +28,7 @@
 
 // Added For SLIMMER Start
 #include "SlimmerTrace.h"
+#include "llvm/Support/raw_ostream.h"
 // Added For SLIMMER End
 
 using namespace llvm;
@@ -62,6 +63,23 @@ static cl::opt<bool>
 RunLoopRerolling("reroll-loops", cl::Hidden,
                  cl::desc("Run the loop rerolling pass"));
 
+// Added For SLIMMER Start
+static cl::opt<unsigned>
+SlimmerPostOpt("slimmer-post-opt", cl::init(0),
+               cl::desc("The optimizations after instrumenting, 0 for none, "
+                        "1 for the scalar ones, 2 for also inlining and the "
+                        "loop ones"));
+
+std::string llvm::SlimmerBuilderOptions() {
+  std::string s;
+  raw_string_ostream os(s);
+  os << RunLoopVectorization << LateVectorization << RunSLPVectorization
+     << RunBBVectorization << UseGVNAfterVectorization << UseNewSROA
+     << RunLoopRerolling << " " << SlimmerPostOpt;
+  return os.str();
+}
+// Added For SLIMMER End
+
 PassManagerBuilder::PassManagerBuilder() {
     OptLevel = 2;
     SizeLevel = 0;
@@ -287,6 +305,33 @@ void PassManagerBuilder::populateLTOPassManager(PassManagerBase &PM,
   // Added For SLIMMER Start
   PM.add(createSlimmerTracePass());
   // PM.add(createFunctionInliningPass());
+
+  // The record functions are declared without any memory attribute, thus
+  // they are opaque calls that may read and write any memory, and no
+  // optimization moves a traced access across its record call or removes
+  // a store whose record call follows it.
+  if (SlimmerPostOpt > 0) {
+    if (SlimmerPostOpt > 1 && RunInliner) {
+      // The inlined code keeps its record calls, thus the trace of a callee
+      // is the same no matter where it is inlined.
+      PM.add(createFunctionInliningPass());
+      PM.add(createPruneEHPass());
+      PM.add(createGlobalDCEPass());
+    }
+    PM.add(createInstructionCombiningPass());
+    PM.add(createJumpThreadingPass());
+    PM.add(createCFGSimplificationPass());
+    PM.add(createEarlyCSEPass());
+    if (SlimmerPostOpt > 1) {
+      PM.add(createLICMPass());
+      PM.add(createLoopUnswitchPass());
+    }
+    PM.add(createGVNPass(DisableGVNLoadPRE));
+    PM.add(createMemCpyOptPass());
+    PM.add(createDeadStoreEliminationPass());
+    PM.add(createInstructionCombiningPass());
+    PM.add(createCFGSimplificationPass());
+  }
   // Added For SLIMMER End
 
   // Deleted For SLIMMER Start
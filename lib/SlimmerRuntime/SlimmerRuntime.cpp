@@ -1,12 +1,37 @@
 #include "SlimmerRuntime.h"
 #include "SlimmerUtil.h"
+#include "ShadowMemory.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <semaphore.h>
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <sched.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+/// Return the value of a monotonic clock in nanoseconds.
+static inline uint64_t Nanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000lu + ts.tv_nsec;
+}
+
+/// Return the time stamp counter of the CPU,
+/// or the monotonic clock if there is none.
+static inline uint64_t ReadTSC() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+#else
+  return Nanos();
+#endif
+}
 
 //===----------------------------------------------------------------------===//
 //                        Semaphore
@@ -22,6 +47,15 @@ public:
     sem_init(&m_sema, 0, initialCount);
   }
 
+  /// Return false instead of blocking if the count is zero.
+  inline bool try_wait() {
+    int rc;
+    do {
+      rc = sem_trywait(&m_sema);
+    } while (rc == -1 && errno == EINTR);
+    return rc == 0;
+  }
+
   inline void wait() {
     int rc;
     do {
@@ -44,20 +78,101 @@ private:
   Semaphore &operator=(const Semaphore &other) = delete;
 };
 
+//===----------------------------------------------------------------------===//
+//                        Buffer Placement
+//===----------------------------------------------------------------------===//
+
+// The memory policy of mbind(2), so that numaif.h is not needed.
+#define SLIMMER_MPOL_PREFERRED 1
+#define SLIMMER_HUGE_PAGE_SIZE (2lu << 20)
+
+// How the blocks are mapped
+const static int NormalPages = 0;
+const static int TransparentHugePages = 1; // madvise(MADV_HUGEPAGE)
+const static int HugeTLBPages = 2;         // mmap(MAP_HUGETLB)
+
+/// Parse a CPU list, e.g., "0-3,8", into a CPU set.
+///
+/// \return - false if the list is malformed or empty.
+///
+static bool ParseCPUList(const char *list, cpu_set_t &cpus) {
+  CPU_ZERO(&cpus);
+  bool any = false;
+  const char *p = list;
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10), last = first;
+    if (end == p || first < 0)
+      return false;
+    p = end;
+    if (*p == '-') {
+      last = strtol(++p, &end, 10);
+      if (end == p || last < first)
+        return false;
+      p = end;
+    }
+    for (long c = first; c <= last && c < CPU_SETSIZE; ++c) {
+      CPU_SET(c, &cpus);
+      any = true;
+    }
+    while (*p == ',' || *p == ' ' || *p == '\n')
+      ++p;
+  }
+  return any;
+}
+
+/// Read the CPUs of a NUMA node from the sysfs.
+///
+static bool NodeCPUs(int node, cpu_set_t &cpus) {
+  char path[128], list[4096];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+  bool ret = fgets(list, sizeof(list), f) && ParseCPUList(list, cpus);
+  fclose(f);
+  return ret;
+}
+
 //===----------------------------------------------------------------------===//
 //                        Trace Event Buffer
 //===----------------------------------------------------------------------===//
 
+// The statistics slot of this thread, claimed at its first event
+static __thread ThreadStat *local_stat = NULL;
+// The thread id
+static uint64_t __thread local_tid = 0;
+
 class CircularBuffer {
 public:
   void Init(const char *name);
+  void Start();
+  char *AllocBlock(size_t bytes);
+  void FreeBlock(char *block, size_t bytes);
   ~CircularBuffer() { CloseBufferFile(); }
 
   char *StartAppend(size_t length);
+  void Lock();
+  char *Reserve(size_t length);
+  size_t MaxEventLength() const;
   void EndAppend();
+  void DropBlock();
+
+  void RecordWrite(uint64_t addr, uint64_t length);
+  void AppendLoad(uint64_t tid, uint32_t id, uint64_t addr, uint64_t length);
 
-  void Dump(const char *start, uint64_t length);
+  void Dump(const char *start, uint64_t word);
   void CloseBufferFile();
+  void CrashFlush();
+
+  void OpenStat();
+  ThreadStat *ClaimThreadStat();
+  void PrintStat();
+
+  void BeforeFork(uint64_t tid);
+  void AfterForkInParent();
+  void AfterForkInChild(uint64_t tid);
 
   size_t size; // Size of the each buffer in bytes
   char *buffer[COMPRESS_BLOCK_CNT], *compressed[COMPRESS_BLOCK_CNT];
@@ -65,16 +180,65 @@ public:
       empty_compressed[COMPRESS_BLOCK_CNT];
   Semaphore filled_buffer[COMPRESS_BLOCK_CNT],
       filled_compressed[COMPRESS_BLOCK_CNT];
-  int after_compressed[COMPRESS_BLOCK_CNT];
+  uint64_t after_compressed[COMPRESS_BLOCK_CNT]; // Length words, see Dump
+  TraceCodec *codec;
+  uint32_t codec_id;
+  // In the adaptive mode, the level is lowered when the backlog of the ring
+  // grows, and raised again up to max_level when the compressor is idle.
+  bool adaptive;
+  int codec_level, max_level;
   volatile bool dump_done, compress_done;
+  RuntimeStat *stat; // Always valid after Init
+
+  // Set by the crashing thread, which writes the remaining blocks by itself
+  std::atomic_bool crashing;
+  std::atomic_bool dumping; // Is the dumping thread writing a block
+  char *crash_compressed; // Spare buffer for compressing in CrashFlush
+
+  // In the online dependency mode, the last writer of each byte is tracked
+  // in-process, and a load is recorded by the sequence numbers of its writers
+  // instead of its address.
+  bool online_dep;
 
 private:
   std::atomic_bool inited;
-  char *trace_path_ptr;
+  char *trace_name_ptr; // The trace path given by the user
+  char *trace_path_ptr; // The trace path of this process
+  uint32_t fork_cnt; // Number of fork() called by this process
 
   int cur_block; // The block ID that is currently writed
   size_t offset;
 
+  // In the lossy mode, a full block is dropped if the next one is not
+  // available yet, instead of blocking the application.
+  bool lossy;
+  uint64_t block_events; // Number of events in the current block
+  // Events and bytes dropped since the last block handed to the compressor
+  uint64_t gap_events, gap_bytes;
+
+  // The writes are numbered from 1 by their order in the trace.
+  uint64_t write_seq;
+  ShadowMemory<uint64_t> *last_writer;
+  std::vector<uint64_t> *dep_writers; // Writers of the current load
+
+  // If stamped, a thread writes a StampEvent before its events whenever
+  // it takes over the ring from another thread, every SLIMMER_STAMP_PERIOD
+  // events, and at the beginning of each block.
+  bool stamped;
+  uint32_t stamp_kind;
+  uint64_t epoch;
+  uint64_t stamp_tid; // The thread of the last StampEvent
+  uint32_t since_stamp; // Events since the last StampEvent
+
+  // The blocks are mmap'ed, instead of malloc'ed, if huge pages or a NUMA
+  // node are asked for. The compressing and dumping threads are pinned to
+  // worker_cpus if pin_workers.
+  bool mapped_blocks;
+  int huge_pages;
+  int numa_node; // -1 for no binding
+  bool pin_workers;
+  cpu_set_t worker_cpus;
+
   std::thread *dump_thread, *compress_thread;
 
   std::atomic_flag append_lock = ATOMIC_FLAG_INIT;
@@ -88,9 +252,39 @@ void CompressTrace(CircularBuffer *cb) {
       cb->filled_buffer[i].wait();
       cb->empty_compressed[i].wait();
 
-      cb->after_compressed[i] = LZ4_compress_limitedOutput(
-          (const char *)cb->buffer[i], (char *)cb->compressed[i], cb->size,
-          LZ4_compressBound(cb->size));
+      PipelineStat &ps = cb->stat->Pipeline;
+      uint32_t codec = cb->codec_id;
+      int level = cb->codec_level;
+      if (cb->adaptive) {
+        // The blocks filled but not compressed, including this one
+        uint64_t backlog =
+            __atomic_load_n(&ps.BlocksFilled, __ATOMIC_ACQUIRE) -
+            ps.BlocksCompressed;
+        if (backlog > COMPRESS_BLOCK_CNT / 8 &&
+            level > TraceCodec::MinLevel(codec))
+          level--;
+        else if (backlog <= 1 && level < cb->max_level)
+          level++;
+        cb->codec_level = level;
+        // Falling far behind even at the lowest level, the block is
+        // compressed by LZ4 at its highest acceleration
+        if (backlog > COMPRESS_BLOCK_CNT / 2 && codec != LZ4Codec &&
+            level <= TraceCodec::MinLevel(codec)) {
+          codec = LZ4Codec;
+          level = TraceCodec::MinLevel(LZ4Codec);
+        }
+      }
+
+      uint64_t start = Nanos();
+      cb->after_compressed[i] = cb->codec->Compress(
+          codec, level, cb->buffer[i], cb->size, cb->compressed[i]);
+      assert(cb->after_compressed[i] && "Failed to compress the block!\n");
+
+      ps.CompressNanos += Nanos() - start;
+      ps.RawBytes += cb->size;
+      ps.CompressedBytes += TraceCodec::Length(cb->after_compressed[i]);
+      ps.CompressLevel = level;
+      ps.BlocksCompressed++;
 
       cb->filled_compressed[i].signal();
       cb->empty_buffer[i].signal();
@@ -105,8 +299,22 @@ void DumpCompressed(CircularBuffer *cb) {
     for (int i = 0; i < COMPRESS_BLOCK_CNT && !cb->dump_done; ++i) {
       cb->filled_compressed[i].wait();
 
+      cb->dumping = true;
+      if (cb->crashing) {
+        cb->dumping = false;
+        return;
+      }
+
+      uint64_t start = Nanos();
       cb->Dump(cb->compressed[i], cb->after_compressed[i]);
 
+      PipelineStat &ps = cb->stat->Pipeline;
+      ps.DumpNanos += Nanos() - start;
+      ps.DumpedBytes +=
+          TraceCodec::Length(cb->after_compressed[i]) + 2 * sizeof(uint64_t);
+      ps.BlocksDumped++;
+      cb->dumping = false;
+
       cb->empty_compressed[i].signal();
     }
   }
@@ -121,12 +329,108 @@ void CircularBuffer::Init(const char *name) {
 
   size = COMPRESS_BLOCK_SIZE;
 
+  const char *huge_env = getenv("SLIMMER_HUGEPAGE");
+  huge_pages = NormalPages;
+  if (huge_env && strcmp(huge_env, "hugetlb") == 0)
+    huge_pages = HugeTLBPages;
+  else if (huge_env && (strcmp(huge_env, "thp") == 0 || atoi(huge_env)))
+    huge_pages = TransparentHugePages;
+  else if (huge_env && strcmp(huge_env, "0") != 0)
+    ERROR("[SLIMMER] Unknown SLIMMER_HUGEPAGE %s, should be thp or hugetlb\n",
+          huge_env);
+
+  const char *node_env = getenv("SLIMMER_NUMA_NODE");
+  numa_node = node_env ? atoi(node_env) : -1;
+  if (numa_node >= 1024) {
+    ERROR("[SLIMMER] SLIMMER_NUMA_NODE %d is out of range\n", numa_node);
+    numa_node = -1;
+  }
+
+  // The workers run on the given CPUs, or else on the node of the blocks.
+  const char *cpus_env = getenv("SLIMMER_COMPRESS_CPUS");
+  pin_workers = false;
+  if (cpus_env) {
+    pin_workers = ParseCPUList(cpus_env, worker_cpus);
+    if (!pin_workers)
+      ERROR("[SLIMMER] Malformed SLIMMER_COMPRESS_CPUS %s\n", cpus_env);
+  } else if (numa_node >= 0) {
+    pin_workers = NodeCPUs(numa_node, worker_cpus);
+  }
+  if (huge_pages != NormalPages || numa_node >= 0 || pin_workers)
+    printf("[SLIMMER] Blocks are backed by %s pages on %s node, workers on "
+           "%d CPUs\n",
+           huge_pages == HugeTLBPages
+               ? "hugetlb"
+               : (huge_pages == TransparentHugePages ? "transparent huge"
+                                                     : "normal"),
+           numa_node >= 0 ? ("the " + std::to_string(numa_node)).c_str()
+                          : "any",
+           pin_workers ? CPU_COUNT(&worker_cpus) : 0);
+
+  mapped_blocks = huge_pages != NormalPages || numa_node >= 0;
+  // The codec is allocated here, since Init may be called before the
+  // constructors of the global objects.
+  codec = new TraceCodec();
+  codec->Configure(codec_id, codec_level);
+  max_level = codec_level;
+  const char *adaptive_env = getenv("SLIMMER_ADAPTIVE");
+  adaptive = adaptive_env && atoi(adaptive_env);
+  printf("[SLIMMER] Blocks are compressed by %s at level %d%s\n",
+         TraceCodec::Name(codec_id), codec_level,
+         adaptive ? " or lower" : "");
+
   for (int i = 0; i < COMPRESS_BLOCK_CNT; ++i) {
-    buffer[i] = (char *)malloc(size);
-    compressed[i] = (char *)malloc(LZ4_compressBound(size));
-    assert(buffer[i] && compressed[i] &&
-           "Failed to malloc the event bufffer!\n");
+    buffer[i] = AllocBlock(size);
+    compressed[i] = AllocBlock(TraceCodec::Bound(size));
+  }
+  crash_compressed = AllocBlock(TraceCodec::Bound(size));
+
+  trace_name_ptr = new char[strlen(name) + 1];
+  strcpy(trace_name_ptr, name);
+  fork_cnt = 0;
+
+  const char *lossy_env = getenv("SLIMMER_LOSSY");
+  lossy = lossy_env && atoi(lossy_env);
+  const char *online_env = getenv("SLIMMER_ONLINE_DEP");
+  online_dep = online_env && atoi(online_env);
+  if (online_dep) {
+    // The writes must be numbered in the same way as the analyzer
+    if (lossy)
+      ERROR("[SLIMMER] The lossy mode is disabled by the online dependency "
+            "mode\n");
+    lossy = false;
+    last_writer = new ShadowMemory<uint64_t>();
+    dep_writers = new std::vector<uint64_t>();
+    printf("[SLIMMER] Online dependency mode, loads are recorded by their "
+           "writers\n");
+  }
+  if (lossy)
+    printf("[SLIMMER] Lossy mode, blocks are dropped if the trace pipeline "
+           "falls behind\n");
+
+  const char *stamp_env = getenv("SLIMMER_STAMP");
+  stamped = stamp_env && (strcmp(stamp_env, "tsc") == 0 ||
+                          strcmp(stamp_env, "epoch") == 0);
+  stamp_kind = stamped && strcmp(stamp_env, "tsc") == 0 ? TSCStamp
+                                                          : EpochStamp;
+  if (stamped)
+    printf("[SLIMMER] Events are stamped by the %s\n",
+           stamp_kind == TSCStamp ? "time stamp counter" : "global epoch");
+  else if (stamp_env)
+    ERROR("[SLIMMER] Unknown SLIMMER_STAMP %s, should be tsc or epoch\n",
+          stamp_env);
+
+  // A forked child keeps the epoch of its parent, so that its events are
+  // stamped after the ones the parent appended before the fork.
+  epoch = 0;
+  Start();
+}
 
+/// Start a fresh pipeline on the allocated blocks,
+/// i.e., a new trace file, empty blocks and the compressing/dumping threads.
+///
+void CircularBuffer::Start() {
+  for (int i = 0; i < COMPRESS_BLOCK_CNT; ++i) {
     empty_buffer[i].init(i != 0);
     empty_compressed[i].init(1);
 
@@ -134,26 +438,114 @@ void CircularBuffer::Init(const char *name) {
     filled_compressed[i].init();
   }
 
-  dump_thread = new std::thread(DumpCompressed, this);
-  compress_thread = new std::thread(CompressTrace, this);
-
   typedef std::chrono::high_resolution_clock Clock;
   srand(Clock::now().time_since_epoch().count());
   
-  std::string trace_path = name + ("_" + std::to_string(rand())) + ("_" + std::to_string(getpid()));
+  std::string trace_path = trace_name_ptr + ("_" + std::to_string(rand())) + ("_" + std::to_string(getpid()));
   trace_path_ptr = new char[trace_path.length() + 1];
   strcpy(trace_path_ptr, trace_path.c_str());
   
   FILE *stream = fopen(trace_path_ptr, "wb");
   assert(stream && "Failed to open tracing file!\n");
+  codec->WriteHeader(stream, codec_id);
   fclose(stream);
   printf("[SLIMMER] Opened trace file: %s\n", trace_path_ptr);
 
+  OpenStat();
+
   // Initialize all of the other fields.
   cur_block = offset = 0;
+  block_events = gap_events = gap_bytes = 0;
+  stamp_tid = since_stamp = 0;
   append_lock.clear(std::memory_order_release);
   dump_done = compress_done = false;
+  crashing = dumping = false;
   inited = true;
+
+  if (online_dep) {
+    // A DepLoadEvent of thread 0 and instruction -1 marks the mode.
+    write_seq = 0;
+    last_writer->Clear();
+    char *buffer = StartAppend(SizeOfDepLoadEvent);
+    *buffer = DepLoadEventLabel;
+    (*(uint64_t *)(buffer + 1)) = 0;
+    (*(uint32_t *)(buffer + 9)) = (uint32_t) - 1;
+    (*(uint64_t *)(buffer + 13)) = 0;
+    (*(uint64_t *)(buffer + 21)) = 0;
+    (*(uint64_t *)(buffer + 29)) = 0;
+    *(buffer + 37) = DepLoadEventLabel;
+    EndAppend();
+  }
+
+  dump_thread = new std::thread(DumpCompressed, this);
+  compress_thread = new std::thread(CompressTrace, this);
+  if (pin_workers &&
+      (pthread_setaffinity_np(dump_thread->native_handle(),
+                              sizeof(cpu_set_t), &worker_cpus) ||
+       pthread_setaffinity_np(compress_thread->native_handle(),
+                              sizeof(cpu_set_t), &worker_cpus)))
+    ERROR("[SLIMMER] Failed to pin the compressing/dumping threads\n");
+}
+
+/// Allocate a block of the ring.
+///
+/// A block is malloc'ed by default. If huge pages or a NUMA node are asked
+/// for, it is mmap'ed instead and rounded up to the huge page size, so that
+/// the policy covers the whole mapping. Since the kernel may run out of
+/// hugetlb pages, a failed MAP_HUGETLB falls back to transparent huge pages.
+///
+/// \param bytes - size of the block.
+///
+char *CircularBuffer::AllocBlock(size_t bytes) {
+  if (!mapped_blocks) {
+    char *ret = (char *)malloc(bytes);
+    assert(ret && "Failed to malloc the event bufffer!\n");
+    return ret;
+  }
+
+  size_t len = (bytes + SLIMMER_HUGE_PAGE_SIZE - 1) &
+               ~(SLIMMER_HUGE_PAGE_SIZE - 1);
+  void *ret = MAP_FAILED;
+  if (huge_pages == HugeTLBPages) {
+    ret = mmap(NULL, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ret == MAP_FAILED) {
+      ERROR("[SLIMMER] Not enough hugetlb pages, falling back to transparent "
+            "huge pages\n");
+      huge_pages = TransparentHugePages;
+    }
+  }
+  if (ret == MAP_FAILED) {
+    ret = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    assert(ret != MAP_FAILED && "Failed to mmap the event bufffer!\n");
+    if (huge_pages == TransparentHugePages)
+      madvise(ret, len, MADV_HUGEPAGE);
+  }
+
+  // The pages are not touched yet, hence they are placed by the policy.
+  if (numa_node >= 0) {
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {0};
+    mask[numa_node / (8 * sizeof(unsigned long))] |=
+        1lu << (numa_node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_mbind, ret, len, SLIMMER_MPOL_PREFERRED, mask,
+                8 * sizeof(mask), 0) != 0) {
+      ERROR("[SLIMMER] Failed to bind the blocks to node %d\n", numa_node);
+      numa_node = -1;
+    }
+  }
+  return (char *)ret;
+}
+
+/// Free a block allocated by AllocBlock.
+///
+void CircularBuffer::FreeBlock(char *block, size_t bytes) {
+  if (!mapped_blocks) {
+    free(block);
+    return;
+  }
+  munmap(block, (bytes + SLIMMER_HUGE_PAGE_SIZE - 1) &
+                    ~(SLIMMER_HUGE_PAGE_SIZE - 1));
 }
 
 /// Flush all the buffered log into the file,
@@ -176,13 +568,111 @@ void CircularBuffer::CloseBufferFile() {
   compress_thread->join();
   dump_thread->join();
 
+  PrintStat();
+  const char *train_env = getenv("SLIMMER_ZSTD_TRAIN");
+  if (train_env) {
+    // The blocks still hold the last events of the program.
+    std::vector<const char *> blocks;
+    uint64_t filled = stat->Pipeline.BlocksFilled + 1; // The current one
+    for (uint64_t i = 0; i < std::min(filled, (uint64_t)COMPRESS_BLOCK_CNT);
+         ++i)
+      blocks.push_back(buffer[i]);
+    if (TraceCodec::TrainDictionary(blocks, size, train_env))
+      printf("[SLIMMER] Trained a zstd dictionary: %s\n", train_env);
+    else
+      ERROR("[SLIMMER] Failed to train a zstd dictionary\n");
+  }
   printf("[SLIMMER] Closed\n");
   inited = false;
   append_lock.clear(std::memory_order_release);
   for (int i = 0; i < COMPRESS_BLOCK_CNT; ++i) {
-    free(buffer[i]);
-    free(compressed[i]);
+    FreeBlock(buffer[i], size);
+    FreeBlock(compressed[i], TraceCodec::Bound(size));
+  }
+  FreeBlock(crash_compressed, TraceCodec::Bound(size));
+  crash_compressed = NULL;
+}
+
+/// Write [start, start+length) to a file descriptor.
+/// Only write(2) is used, which is async-signal-safe.
+///
+/// \param fd - the file descriptor.
+/// \param start - the starting address of the data.
+/// \param length - the length of the data.
+///
+static void WriteAll(int fd, const char *start, uint64_t length) {
+  while (length > 0) {
+    ssize_t tmp = write(fd, start, length);
+    if (tmp < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    start += tmp;
+    length -= tmp;
+  }
+}
+
+/// Write a compressed block, in the same format as CircularBuffer::Dump.
+///
+static void WriteBlock(int fd, const char *start, uint64_t word) {
+  WriteAll(fd, (const char *)&word, sizeof(word));
+  WriteAll(fd, start, TraceCodec::Length(word));
+  WriteAll(fd, (const char *)&word, sizeof(word));
+}
+
+/// Write all the blocks that are not dumped yet, including the partial
+/// current one, when the program crashes.
+///
+/// It is called in a signal handler, hence only async-signal-safe calls are
+/// used, and the semaphores, the threads and the stdio of the normal closing
+/// path are never touched. The waits for the dumping thread and the append
+/// lock are bounded, since their owner may be the crashing thread itself.
+///
+void CircularBuffer::CrashFlush() {
+  if (!inited || crash_compressed == NULL)
+    return;
+  // Another thread is flushing, wait for it to terminate the process.
+  if (crashing.exchange(true))
+    for (;;)
+      pause();
+
+  struct timespec ms = {0, 1000000};
+  for (int i = 0; i < 1000 && dumping; ++i)
+    nanosleep(&ms, NULL);
+  for (int i = 0;
+       i < 1000 && append_lock.test_and_set(std::memory_order_acquire); ++i)
+    nanosleep(&ms, NULL);
+
+  int fd = open(trace_path_ptr, O_WRONLY | O_APPEND);
+  if (fd < 0)
+    return;
+
+  // Block n (counted from the beginning) is kept in buffer[n % CNT].
+  PipelineStat &ps = stat->Pipeline;
+  uint64_t n_dumped = __atomic_load_n(&ps.BlocksDumped, __ATOMIC_ACQUIRE);
+  uint64_t n_compressed =
+      __atomic_load_n(&ps.BlocksCompressed, __ATOMIC_ACQUIRE);
+  uint64_t n_filled = __atomic_load_n(&ps.BlocksFilled, __ATOMIC_ACQUIRE);
+  for (uint64_t n = n_dumped; n < n_filled; ++n) {
+    int i = n % COMPRESS_BLOCK_CNT;
+    if (n < n_compressed) {
+      WriteBlock(fd, compressed[i], after_compressed[i]);
+    } else {
+      uint64_t word = codec->Compress(LZ4Codec, TraceCodec::MaxLevel(LZ4Codec),
+                                      buffer[i], size, crash_compressed);
+      WriteBlock(fd, crash_compressed, word);
+    }
   }
+
+  // The current block is ended by an EndEvent.
+  if (offset < size)
+    buffer[cur_block][offset++] = EndEventLabel;
+  memset(buffer[cur_block] + offset, PlaceHolderLabel, size - offset);
+  uint64_t word = codec->Compress(LZ4Codec, TraceCodec::MaxLevel(LZ4Codec),
+                                  buffer[cur_block], size, crash_compressed);
+  WriteBlock(fd, crash_compressed, word);
+  close(fd);
 }
 
 /// Declare an appending of event.
@@ -191,25 +681,245 @@ void CircularBuffer::CloseBufferFile() {
 /// \return - the starting address of the event.
 ///
 inline char *CircularBuffer::StartAppend(size_t length) {
+  Lock();
+  return Reserve(length);
+}
+
+/// Acquire the append lock.
+///
+inline void CircularBuffer::Lock() {
   while (append_lock.test_and_set(std::memory_order_acquire))
     ;
+}
 
-  // If the current block is full
-  if (offset + length > size) {
-    memset(buffer[cur_block] + offset, PlaceHolderLabel, size - offset);
-    filled_buffer[cur_block++].signal();
+/// The longest event that fits in a block, after the GapEvent of a dropped
+/// block and a StampEvent.
+///
+inline size_t CircularBuffer::MaxEventLength() const {
+  return size - SizeOfGapEvent - SizeOfStampEvent;
+}
 
-    if (cur_block == COMPRESS_BLOCK_CNT)
-      cur_block = 0;
-    empty_buffer[cur_block].wait();
-    offset = 0;
+/// Reserve the space of an event, with the append lock held.
+///
+/// \param length - the length of the event, at most MaxEventLength().
+/// \return - the starting address of the event.
+///
+inline char *CircularBuffer::Reserve(size_t length) {
+  assert(length <= MaxEventLength() && "The event is larger than a block!\n");
+  ThreadStat *ts = local_stat ? local_stat : ClaimThreadStat();
+
+  bool stamp = stamped && (stamp_tid != local_tid ||
+                           ++since_stamp >= SLIMMER_STAMP_PERIOD);
+  size_t total = length + (stamp ? SizeOfStampEvent : 0);
+
+  // If the current block is full
+  if (offset + total > size) {
+    int next_block = (cur_block + 1) % COMPRESS_BLOCK_CNT;
+    bool next_ready = empty_buffer[next_block].try_wait();
+
+    if (!next_ready && lossy) {
+      DropBlock();
+    } else {
+      memset(buffer[cur_block] + offset, PlaceHolderLabel, size - offset);
+      filled_buffer[cur_block].signal();
+      stat->Pipeline.BlocksFilled++;
+
+      if (!next_ready) {
+        // The compressing thread falls behind, the application is stalled.
+        uint64_t start = Nanos();
+        empty_buffer[next_block].wait();
+        ts->Stalls++;
+        ts->StallNanos += Nanos() - start;
+      }
+      cur_block = next_block;
+      offset = 0;
+      block_events = gap_events = gap_bytes = 0;
+    }
+    if (stamped && !stamp) {
+      stamp = true;
+      total += SizeOfStampEvent;
+    }
   }
+  ts->Events++;
+  ts->Bytes += total;
+  block_events += stamp ? 2 : 1;
 
   char *ret = buffer[cur_block] + offset;
-  offset += length;
+  offset += total;
+  if (stamp) {
+    *ret = StampEventLabel;
+    (*(uint64_t *)(ret + 1)) = local_tid;
+    (*(uint32_t *)(ret + 9)) = stamp_kind;
+    (*(uint64_t *)(ret + 13)) = stamp_kind == TSCStamp ? ReadTSC() : ++epoch;
+    *(ret + 21) = StampEventLabel;
+    ret += SizeOfStampEvent;
+    stamp_tid = local_tid;
+    since_stamp = 0;
+  }
   return ret;
 }
 
+/// Record a write of [addr, addr+length) in the online dependency mode,
+/// with the append lock held.
+///
+inline void CircularBuffer::RecordWrite(uint64_t addr, uint64_t length) {
+  if (online_dep && length > 0)
+    last_writer->Set(addr, addr + length, ++write_seq);
+}
+
+/// Append a load in the online dependency mode, i.e.,
+/// a DepEdgeEvent for each of its writers but the last one,
+/// followed by a DepLoadEvent with its address and the last writer (0 for
+/// none). A load whose writers do not fit in a block is appended as a
+/// MemoryEvent instead, whose writers are searched by the analyzer.
+///
+/// \param tid - the thread ID.
+/// \param id - the instruction ID.
+/// \param addr - the starting address of the accessed memory.
+/// \param length - the length of the accessed memory.
+///
+void CircularBuffer::AppendLoad(uint64_t tid, uint32_t id, uint64_t addr,
+                                uint64_t length) {
+  Lock();
+
+  std::vector<uint64_t> &writers = *dep_writers;
+  writers.clear();
+  last_writer->Collect(addr, addr + length, writers);
+  if (writers.size() > 1) {
+    std::sort(writers.begin(), writers.end());
+    writers.erase(std::unique(writers.begin(), writers.end()), writers.end());
+  }
+  size_t edges = writers.empty() ? 0 : writers.size() - 1;
+  if (edges * SizeOfDepEdgeEvent + SizeOfDepLoadEvent > MaxEventLength()) {
+    char *buffer = Reserve(SizeOfMemoryEvent);
+    *buffer = MemoryEventLabel;
+    (*(uint64_t *)(buffer + 1)) = tid;
+    (*(uint32_t *)(buffer + 9)) = id;
+    (*(uint64_t *)(buffer + 13)) = addr;
+    (*(uint64_t *)(buffer + 21)) = length;
+    *(buffer + 29) = MemoryEventLabel;
+    EndAppend();
+    return;
+  }
+
+  char *buffer = Reserve(edges * SizeOfDepEdgeEvent + SizeOfDepLoadEvent);
+  for (size_t i = 0; i < edges; ++i) {
+    *buffer = DepEdgeEventLabel;
+    (*(uint64_t *)(buffer + 1)) = writers[i];
+    *(buffer + 9) = DepEdgeEventLabel;
+    buffer += SizeOfDepEdgeEvent;
+  }
+  *buffer = DepLoadEventLabel;
+  (*(uint64_t *)(buffer + 1)) = tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = addr;
+  (*(uint64_t *)(buffer + 21)) = length;
+  (*(uint64_t *)(buffer + 29)) = writers.empty() ? 0 : writers.back();
+  *(buffer + 37) = DepLoadEventLabel;
+
+  EndAppend();
+}
+
+/// Write a ForkEvent.
+///
+/// \param buffer - the starting address of the event.
+/// \param tid - the thread that calls fork().
+/// \param fork_id - the fork is the fork_id-th fork() of the parent.
+/// \param parent - the PID of the parent process.
+/// \param child - the PID of the child process, 0 if unknown.
+///
+static void WriteForkEvent(char *buffer, uint64_t tid, uint32_t fork_id,
+                           uint64_t parent, uint64_t child) {
+  *buffer = ForkEventLabel;
+  (*(uint64_t *)(buffer + 1)) = tid;
+  (*(uint32_t *)(buffer + 9)) = fork_id;
+  (*(uint64_t *)(buffer + 13)) = parent;
+  (*(uint64_t *)(buffer + 21)) = child;
+  *(buffer + 29) = ForkEventLabel;
+}
+
+/// Called in the parent before fork().
+/// It records the fork and quiesces the pipeline, i.e., holds the append lock
+/// and waits until all the filled blocks are written to the trace file,
+/// so that the child inherits no half-processed block.
+///
+/// \param tid - the thread that calls fork().
+///
+void CircularBuffer::BeforeFork(uint64_t tid) {
+  if (!inited)
+    return;
+
+  // The append lock is held until fork() returns.
+  char *buffer = StartAppend(SizeOfForkEvent);
+  WriteForkEvent(buffer, tid, ++fork_cnt, getpid(), 0);
+
+  PipelineStat &ps = stat->Pipeline;
+  while (__atomic_load_n(&ps.BlocksDumped, __ATOMIC_ACQUIRE) <
+         __atomic_load_n(&ps.BlocksFilled, __ATOMIC_ACQUIRE))
+    std::this_thread::yield();
+}
+
+/// Called in the parent after fork().
+///
+void CircularBuffer::AfterForkInParent() {
+  if (!inited)
+    return;
+  EndAppend();
+}
+
+/// Called in the child after fork().
+/// The child has none of the parent's threads, hence it drops the inherited
+/// events and starts a fresh pipeline with its own trace file,
+/// whose first event records the parent.
+///
+/// \param tid - the only thread of the child.
+///
+void CircularBuffer::AfterForkInChild(uint64_t tid) {
+  if (!inited)
+    return;
+
+  // The statistics segment and the threads belong to the parent.
+  // The std::thread objects are leaked on purpose since they cannot be
+  // joined in the child.
+  munmap(stat, sizeof(RuntimeStat));
+  local_stat = NULL;
+  uint32_t fork_id = fork_cnt;
+  fork_cnt = 0;
+
+  Start();
+  printf("[SLIMMER] Process %d is forked from process %d\n", getpid(),
+         getppid());
+
+  char *buffer = StartAppend(SizeOfForkEvent);
+  WriteForkEvent(buffer, tid, fork_id, getppid(), getpid());
+  EndAppend();
+}
+
+/// Drop all the events of the current block and reuse it.
+/// A GapEvent is left at the beginning of the block for recording
+/// how many events and bytes are dropped since the last kept block.
+///
+/// It should be called with the append lock held.
+///
+void CircularBuffer::DropBlock() {
+  // The block starts with a GapEvent if it is already dropped before
+  bool has_gap = gap_bytes > 0;
+  uint64_t events = block_events - (has_gap ? 1 : 0);
+  gap_events += events;
+  gap_bytes += offset - (has_gap ? SizeOfGapEvent : 0);
+  stat->Pipeline.BlocksDropped++;
+  stat->Pipeline.EventsDropped += events;
+
+  char *gap = buffer[cur_block];
+  *gap = GapEventLabel;
+  (*(uint64_t *)(gap + 1)) = gap_events;
+  (*(uint64_t *)(gap + 9)) = gap_bytes;
+  *(gap + 17) = GapEventLabel;
+
+  offset = SizeOfGapEvent;
+  block_events = 1;
+}
+
 /// Declare an appending of event is ended.
 ///
 inline void CircularBuffer::EndAppend() {
@@ -219,26 +929,131 @@ inline void CircularBuffer::EndAppend() {
 /// Dump log to the file.
 ///
 /// \param start - the starting address of the log.
-/// \param length - the length of the log.
+/// \param word - the length word of the log, i.e., its codec and length.
 ///
-inline void CircularBuffer::Dump(const char *start, uint64_t length) {
+inline void CircularBuffer::Dump(const char *start, uint64_t word) {
+  uint64_t length = TraceCodec::Length(word);
   DEBUG("[SLIMMER::Dump] len = %lu pid=%d\n", length, getpid());
 
   FILE *stream = fopen(trace_path_ptr, "ab");
   assert(stream && "Failed to open tracing file!\n");
 
-  fwrite(&length, sizeof(length), 1, stream);
+  fwrite(&word, sizeof(word), 1, stream);
   uint64_t cur = 0;
   while (cur < length) {
     size_t tmp = fwrite(start + cur, 1, length - cur, stream);
     if (tmp > 0)
       cur += tmp;
   }
-  fwrite(&length, sizeof(length), 1, stream);
+  fwrite(&word, sizeof(word), 1, stream);
 
   fclose(stream);
 }
 
+/// Create the shared memory segment for the statistics.
+/// If it cannot be created, the statistics are kept in private memory.
+///
+void CircularBuffer::OpenStat() {
+  char path[64];
+  snprintf(path, sizeof(path), "%s%d", SLIMMER_STAT_PATH, getpid());
+
+  stat = NULL;
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    if (ftruncate(fd, sizeof(RuntimeStat)) == 0) {
+      void *seg = mmap(NULL, sizeof(RuntimeStat), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+      if (seg != MAP_FAILED)
+        stat = (RuntimeStat *)seg;
+    }
+    close(fd);
+  }
+  if (stat == NULL) {
+    ERROR("[SLIMMER] Cannot create the statistics segment %s\n", path);
+    stat = (RuntimeStat *)mmap(NULL, sizeof(RuntimeStat),
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(stat != MAP_FAILED && "Failed to allocate the statistics!\n");
+  }
+
+  memset(stat, 0, sizeof(RuntimeStat));
+  stat->PID = getpid();
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  stat->StartNanos = ts.tv_sec * 1000000000lu + ts.tv_nsec;
+  stat->BlockSize = size;
+  stat->BlockCnt = COMPRESS_BLOCK_CNT;
+  strncpy(stat->TracePath, trace_path_ptr, sizeof(stat->TracePath) - 1);
+  // Publish the magic at last, so that a reader never sees a half-filled
+  // header.
+  __sync_synchronize();
+  memcpy(stat->Magic, SLIMMER_STAT_MAGIC, sizeof(stat->Magic));
+}
+
+/// Claim a statistics slot for the calling thread.
+///
+/// \return - the claimed slot.
+///
+ThreadStat *CircularBuffer::ClaimThreadStat() {
+  uint64_t slot = __sync_fetch_and_add(&stat->NumThreads, 1);
+  if (slot >= SLIMMER_STAT_MAX_THREAD)
+    slot = SLIMMER_STAT_MAX_THREAD - 1;
+  local_stat = &stat->Threads[slot];
+  local_stat->TID = syscall(SYS_gettid);
+  return local_stat;
+}
+
+/// Print a summary of the statistics and remove the shared memory segment.
+///
+void CircularBuffer::PrintStat() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  double elapsed =
+      (ts.tv_sec * 1000000000lu + ts.tv_nsec - stat->StartNanos) * 1e-9;
+
+  uint64_t events = 0, bytes = 0, stalls = 0, stall_nanos = 0;
+  uint64_t threads = std::min(stat->NumThreads,
+                              (uint64_t)SLIMMER_STAT_MAX_THREAD);
+  for (uint64_t i = 0; i < threads; ++i) {
+    ThreadStat &t = stat->Threads[i];
+    events += t.Events;
+    bytes += t.Bytes;
+    stalls += t.Stalls;
+    stall_nanos += t.StallNanos;
+  }
+
+  PipelineStat &ps = stat->Pipeline;
+  printf("[SLIMMER] Statistics of %lu threads in %.2fs:\n", stat->NumThreads,
+         elapsed);
+  printf("[SLIMMER]   events     %lu (%.0f/s), %.1f MB\n", events,
+         events / elapsed, bytes / 1048576.0);
+  printf("[SLIMMER]   stalls     %lu, %.3fs\n", stalls, stall_nanos * 1e-9);
+  printf("[SLIMMER]   compressed %lu blocks, ratio %.2f, %.3fs, %s level "
+         "%lu\n",
+         ps.BlocksCompressed,
+         ps.CompressedBytes ? (double)ps.RawBytes / ps.CompressedBytes : 0.0,
+         ps.CompressNanos * 1e-9, TraceCodec::Name(codec_id),
+         ps.CompressLevel);
+  printf("[SLIMMER]   dumped     %lu blocks, %.1f MB, %.3fs\n",
+         ps.BlocksDumped, ps.DumpedBytes / 1048576.0, ps.DumpNanos * 1e-9);
+  if (lossy)
+    printf("[SLIMMER]   dropped    %lu blocks, %lu events\n",
+           ps.BlocksDropped, ps.EventsDropped);
+  if (online_dep)
+    printf("[SLIMMER]   shadow     %lu writes, %lu pages\n", write_seq,
+           last_writer->NumPages());
+  for (uint64_t i = 0; i < threads; ++i) {
+    ThreadStat &t = stat->Threads[i];
+    if (t.Stalls)
+      printf("[SLIMMER]   thread %lu stalled %lu times, %.3fs\n", t.TID,
+             t.Stalls, t.StallNanos * 1e-9);
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), "%s%d", SLIMMER_STAT_PATH, getpid());
+  unlink(path);
+}
+
 //===----------------------------------------------------------------------===//
 //                       Record and Helper Functions
 //===----------------------------------------------------------------------===//
@@ -246,8 +1061,266 @@ inline void CircularBuffer::Dump(const char *start, uint64_t length) {
 // This is the very event buffer used by all record functions
 // Call CircularBuffer::Init(...) before usage
 static CircularBuffer event_buffer;
-// The thread id
-static uint64_t __thread local_tid = 0;
+
+//===----------------------------------------------------------------------===//
+//                         Counting Mode
+//===----------------------------------------------------------------------===//
+// In the counting mode, the record functions only update the counters of the
+// instructions, which are kept in a table of each thread indexed by the
+// instruction IDs. Its pages are only committed when they are touched.
+// As the basic block counters below, the table of an exited thread is added
+// to ins_counters and then reused.
+
+struct InsThreadCounters {
+  InsThreadCounters *Next;
+  std::atomic_flag Claimed;
+  uint32_t Counted; // One more than the largest counted ID
+  InsCounter *Counters;
+};
+static bool count_mode = false;
+static InsCounter *ins_counters = NULL; // Of the exited threads
+static uint32_t counted_ins = 0;        // One more than the largest counted ID
+static InsThreadCounters *ins_thread_counters = NULL;
+static __thread InsThreadCounters *local_ins_counters = NULL;
+static pthread_key_t ins_counters_key;
+static char profile_path[4096];
+// The execution counters of the basic blocks (see -slimmer-bb-counters).
+// Each thread claims its own array, which the instrumented code increases
+// directly. The arrays are kept in a list, which only grows, since the array
+// of an exited thread is added to bb_counters and then reused.
+struct BBThreadCounters {
+  BBThreadCounters *Next;
+  std::atomic_flag Claimed;
+  uint64_t Counters[0];
+};
+static uint64_t *bb_counters = NULL; // Of the exited threads
+static uint32_t num_bb_counters = 0;
+static BBThreadCounters *bb_thread_counters = NULL;
+static __thread BBThreadCounters *local_bb_counters = NULL;
+static pthread_key_t bb_counters_key;
+
+/// The executions of a basic block by all the threads.
+///
+/// \param id - the basic block ID.
+///
+static uint64_t BBExecs(uint32_t id) {
+  uint64_t execs = __atomic_load_n(&bb_counters[id], __ATOMIC_RELAXED);
+  for (BBThreadCounters *c = __atomic_load_n(&bb_thread_counters,
+                                             __ATOMIC_ACQUIRE);
+       c; c = c->Next)
+    execs += __atomic_load_n(&c->Counters[id], __ATOMIC_RELAXED);
+  return execs;
+}
+
+static InsThreadCounters *ClaimInsCounters();
+
+/// Count the executions of an instruction.
+///
+/// \param id - the instruction ID.
+/// \param execs - the number of executions.
+/// \param silent - the number of executions that write the same values.
+/// \param bytes - the bytes written.
+/// \param redundant - the bytes written by the silent executions.
+///
+static inline void Count(uint32_t id, uint64_t execs, uint64_t silent,
+                         uint64_t bytes, uint64_t redundant) {
+  if (id >= SLIMMER_MAX_COUNTED_INS)
+    return; // Including the globals, whose ID is -1
+  InsThreadCounters *t =
+      local_ins_counters ? local_ins_counters : ClaimInsCounters();
+  // Plain adds, as no other thread writes the counters
+  InsCounter &c = t->Counters[id];
+  c.Execs += execs;
+  c.Silent += silent;
+  c.Bytes += bytes;
+  c.RedundantBytes += redundant;
+  if (id >= t->Counted)
+    __atomic_store_n(&t->Counted, id + 1, __ATOMIC_RELEASE);
+}
+
+/// Map a table of instruction counters, whose pages are committed when they
+/// are touched.
+///
+static InsCounter *MapInsCounters() {
+  InsCounter *counters = (InsCounter *)mmap(
+      NULL, SLIMMER_MAX_COUNTED_INS * sizeof(InsCounter),
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+      0);
+  assert(counters != MAP_FAILED && "Failed to map the counters!\n");
+  return counters;
+}
+
+/// Claim the instruction counters of the current thread, reusing the ones
+/// released by an exited thread.
+///
+static InsThreadCounters *ClaimInsCounters() {
+  InsThreadCounters *t =
+      __atomic_load_n(&ins_thread_counters, __ATOMIC_ACQUIRE);
+  while (t && t->Claimed.test_and_set(std::memory_order_acquire))
+    t = t->Next;
+  if (t == NULL) {
+    t = new InsThreadCounters();
+    t->Claimed.test_and_set(std::memory_order_relaxed);
+    t->Counted = 0;
+    t->Counters = MapInsCounters();
+    t->Next = __atomic_load_n(&ins_thread_counters, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&ins_thread_counters, &t->Next, t,
+                                        true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+      ;
+  }
+  local_ins_counters = t;
+  pthread_setspecific(ins_counters_key, t);
+  return t;
+}
+
+/// Add the instruction counters of an exiting thread to the ones of the
+/// exited threads, and release them for the next thread.
+///
+/// \param counters - the InsThreadCounters of the thread.
+///
+static void ReleaseInsCounters(void *counters) {
+  InsThreadCounters *t = (InsThreadCounters *)counters;
+  for (uint32_t i = 0; i < t->Counted; ++i) {
+    InsCounter &c = t->Counters[i];
+    if (c.Execs == 0 && c.Silent == 0)
+      continue;
+    __atomic_fetch_add(&ins_counters[i].Execs, c.Execs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ins_counters[i].Silent, c.Silent, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ins_counters[i].Bytes, c.Bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ins_counters[i].RedundantBytes, c.RedundantBytes,
+                       __ATOMIC_RELAXED);
+    memset(&c, 0, sizeof(c));
+  }
+  uint32_t cur = __atomic_load_n(&counted_ins, __ATOMIC_RELAXED);
+  while (t->Counted > cur &&
+         !__atomic_compare_exchange_n(&counted_ins, &cur, t->Counted, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  t->Counted = 0;
+  local_ins_counters = NULL;
+  t->Claimed.clear(std::memory_order_release);
+}
+
+/// The counters of an instruction of all the threads.
+///
+/// \param id - the instruction ID.
+///
+static InsCounter InsCounts(uint32_t id) {
+  InsCounter c = ins_counters[id];
+  for (InsThreadCounters *t = __atomic_load_n(&ins_thread_counters,
+                                              __ATOMIC_ACQUIRE);
+       t; t = t->Next) {
+    if (id >= __atomic_load_n(&t->Counted, __ATOMIC_ACQUIRE))
+      continue;
+    const InsCounter &l = t->Counters[id];
+    c.Execs += __atomic_load_n(&l.Execs, __ATOMIC_RELAXED);
+    c.Silent += __atomic_load_n(&l.Silent, __ATOMIC_RELAXED);
+    c.Bytes += __atomic_load_n(&l.Bytes, __ATOMIC_RELAXED);
+    c.RedundantBytes += __atomic_load_n(&l.RedundantBytes, __ATOMIC_RELAXED);
+  }
+  return c;
+}
+
+/// Write the counters of the executed instructions to the profile.
+/// It is also called by the signal handler, hence it only uses write().
+///
+static void DumpProfile() {
+  int fd = open(profile_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return;
+  uint32_t n = __atomic_load_n(&counted_ins, __ATOMIC_ACQUIRE);
+  for (InsThreadCounters *t = __atomic_load_n(&ins_thread_counters,
+                                              __ATOMIC_ACQUIRE);
+       t; t = t->Next)
+    n = std::max(n, __atomic_load_n(&t->Counted, __ATOMIC_ACQUIRE));
+  ProfileHeader header;
+  memcpy(header.Magic, SLIMMER_PROFILE_MAGIC, sizeof(header.Magic));
+  header.NumRecords = header.NumBBRecords = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    InsCounter c = InsCounts(i);
+    if (c.Execs || c.Silent)
+      header.NumRecords++;
+  }
+  for (uint32_t i = 0; i < num_bb_counters; ++i)
+    if (BBExecs(i))
+      header.NumBBRecords++;
+  WriteAll(fd, (const char *)&header, sizeof(header));
+
+  ProfileRecord records[256];
+  size_t cnt = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    InsCounter c = InsCounts(i);
+    if (c.Execs == 0 && c.Silent == 0)
+      continue;
+    records[cnt].ID = i;
+    records[cnt].Counter = c;
+    if (++cnt == 256) {
+      WriteAll(fd, (const char *)records, sizeof(records));
+      cnt = 0;
+    }
+  }
+  WriteAll(fd, (const char *)records, cnt * sizeof(ProfileRecord));
+
+  BBProfileRecord bb_records[256];
+  cnt = 0;
+  for (uint32_t i = 0; i < num_bb_counters; ++i) {
+    uint64_t execs = BBExecs(i);
+    if (execs == 0)
+      continue;
+    bb_records[cnt].BB = i;
+    bb_records[cnt].Execs = execs;
+    if (++cnt == 256) {
+      WriteAll(fd, (const char *)bb_records, sizeof(bb_records));
+      cnt = 0;
+    }
+  }
+  WriteAll(fd, (const char *)bb_records, cnt * sizeof(BBProfileRecord));
+  close(fd);
+}
+
+/// Start the counting mode instead of tracing.
+///
+/// \param name - the path to the trace file, the profile is name.prof.
+///
+static void InitCounting(const char *name) {
+  ins_counters = MapInsCounters();
+  pthread_key_create(&ins_counters_key, ReleaseInsCounters);
+  snprintf(profile_path, sizeof(profile_path), "%s.prof", name);
+  count_mode = true;
+  printf("[SLIMMER] Counting mode, the profile is written to %s\n",
+         profile_path);
+}
+
+/// A forked child counts from zero, and writes its own profile, i.e.,
+/// name.prof.PID.
+///
+static void CountingAfterForkInChild() {
+  local_tid = syscall(SYS_gettid);
+  memset(ins_counters, 0, counted_ins * sizeof(InsCounter));
+  counted_ins = 0;
+  // Only the forking thread is left, the others' counters are released
+  for (InsThreadCounters *t = ins_thread_counters; t; t = t->Next) {
+    memset(t->Counters, 0, t->Counted * sizeof(InsCounter));
+    t->Counted = 0;
+    if (t != local_ins_counters)
+      t->Claimed.clear(std::memory_order_relaxed);
+  }
+  if (bb_counters) {
+    memset(bb_counters, 0, num_bb_counters * sizeof(uint64_t));
+    // Only the forking thread is left, the others' counters are released
+    for (BBThreadCounters *c = bb_thread_counters; c; c = c->Next) {
+      memset(c->Counters, 0, num_bb_counters * sizeof(uint64_t));
+      if (c != local_bb_counters)
+        c->Claimed.clear(std::memory_order_relaxed);
+    }
+  }
+  size_t len = strlen(profile_path);
+  char *dot = strstr(profile_path, ".prof");
+  if (dot)
+    len = dot - profile_path + 5;
+  snprintf(profile_path + len, sizeof(profile_path) - len, ".%d", getpid());
+}
 
 /// A helper function which is registered at atexit()
 ///
@@ -257,34 +1330,206 @@ static void finish() {
   event_buffer.CloseBufferFile();
 }
 
-/// Signal handler to write only tracing data to file
+/// The fork handlers registered by pthread_atfork().
+///
+static void prepare_fork() { event_buffer.BeforeFork(local_tid); }
+static void after_fork_in_parent() { event_buffer.AfterForkInParent(); }
+static void after_fork_in_child() {
+  local_tid = syscall(SYS_gettid);
+  event_buffer.AfterForkInChild(local_tid);
+}
+
+/// Signal handler to write only tracing data to file.
+/// The signal is raised again after flushing, which then takes its default
+/// action since the handler is registered with SA_RESETHAND.
 ///
 /// \param signum - the signal number.
 ///
 static void cleanup_only_tracing(int signum) {
-  printf("[SLIMMER] Abnormal termination, signal number %d\n", signum);
-  exit(signum);
+  char msg[] = "[SLIMMER] Abnormal termination, signal number   \n";
+  msg[sizeof(msg) - 4] = '0' + signum / 10;
+  msg[sizeof(msg) - 3] = '0' + signum % 10;
+  WriteAll(STDERR_FILENO, msg, sizeof(msg) - 1);
+
+  if (count_mode)
+    DumpProfile();
+  else
+    event_buffer.CrashFlush();
+  raise(signum);
+}
+
+/// The dual-version functions (SlimmerTrace -slimmer-dual-version) check it at
+/// their entry, and run their uninstrumented versions if it is 0.
+/// It is 1 unless SLIMMER_TRACING=0.
+volatile int32_t slimmer_tracing = 1;
+
+/// Switch the tracing of the dual-version functions on or off, e.g., for a
+/// single request of a server. A GapEvent is appended at each switch, since
+/// the call stacks are not continuous across it.
+///
+/// \param on - 1 for running the instrumented versions.
+///
+void slimmerSetTracing(int32_t on) {
+  on = on != 0;
+  if (__atomic_exchange_n(&slimmer_tracing, on, __ATOMIC_SEQ_CST) == on ||
+      count_mode)
+    return;
+
+  char *buffer = event_buffer.StartAppend(SizeOfGapEvent);
+  *buffer = GapEventLabel;
+  (*(uint64_t *)(buffer + 1)) = 0;
+  (*(uint64_t *)(buffer + 9)) = 0;
+  *(buffer + 17) = GapEventLabel;
+  event_buffer.EndAppend();
+}
+
+/// Check whether the events are dropped, i.e., the tracing is switched off.
+/// The functions that have no fast version (e.g., main) still run their
+/// instrumented code, whose events are dropped until the tracing is switched
+/// on again, as the callees that run the fast versions record nothing.
+///
+static inline bool Untraced() {
+  return __builtin_expect(slimmer_tracing == 0, 0);
+}
+
+/// Add the counters of an exiting thread to the ones of the exited threads,
+/// and release them for the next thread.
+///
+/// \param counters - the BBThreadCounters of the thread.
+///
+static void ReleaseBBCounters(void *counters) {
+  BBThreadCounters *c = (BBThreadCounters *)counters;
+  for (uint32_t i = 0; i < num_bb_counters; ++i) {
+    if (c->Counters[i] == 0)
+      continue;
+    __atomic_fetch_add(&bb_counters[i], c->Counters[i], __ATOMIC_RELAXED);
+    c->Counters[i] = 0;
+  }
+  local_bb_counters = NULL;
+  c->Claimed.clear(std::memory_order_release);
+}
+
+/// Register the number of the basic block counters, which is called before
+/// recordInit by a program built with -slimmer-bb-counters.
+///
+/// \param n - the number of the basic blocks.
+///
+void recordBBCounters(uint32_t n) {
+  bb_counters = (uint64_t *)calloc(n, sizeof(uint64_t));
+  assert(bb_counters && "Failed to allocate the counters!\n");
+  num_bb_counters = n;
+  pthread_key_create(&bb_counters_key, ReleaseBBCounters);
+}
+
+/// Claim the basic block counters of the current thread, which is called at
+/// the entry of each function by a program built with -slimmer-bb-counters.
+///
+/// \return - the counter of each basic block, indexed by its ID.
+///
+uint64_t *recordThreadBBCounters() {
+  if (local_bb_counters)
+    return local_bb_counters->Counters;
+
+  // Reuse the counters released by an exited thread, or add new ones
+  BBThreadCounters *c = __atomic_load_n(&bb_thread_counters, __ATOMIC_ACQUIRE);
+  while (c && c->Claimed.test_and_set(std::memory_order_acquire))
+    c = c->Next;
+  if (c == NULL) {
+    c = (BBThreadCounters *)calloc(
+        1, sizeof(BBThreadCounters) + num_bb_counters * sizeof(uint64_t));
+    assert(c && "Failed to allocate the counters!\n");
+    c->Claimed.test_and_set(std::memory_order_relaxed);
+    c->Next = __atomic_load_n(&bb_thread_counters, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&bb_thread_counters, &c->Next, c, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  local_bb_counters = c;
+  pthread_setspecific(bb_counters_key, c);
+  return c->Counters;
+}
+
+//===----------------------------------------------------------------------===//
+//                         Translation Units
+//===----------------------------------------------------------------------===//
+// A program built with -slimmer-per-tu is made of units that are numbered
+// separately from 0. Each unit registers itself by recordUnit, which gives it
+// the bases of its IDs in the global ID space, and the bases are written to
+// name.units for slimmer-merge-info.
+
+static char units_path[4096];
+static uint32_t next_bb_base = 0, next_ins_base = 0;
+
+/// Register a unit and assign the bases of its IDs.
+/// It is called by the constructor of the unit, after recordInit.
+///
+/// \param hash - the hash of the unit, which names its information directory.
+/// \param bb_base - the base of the basic block IDs of the unit.
+/// \param ins_base - the base of the instruction IDs of the unit.
+/// \param num_bb - the number of the basic blocks of the unit.
+/// \param num_ins - the number of the instructions of the unit.
+///
+void recordUnit(const char *hash, uint32_t *bb_base, uint32_t *ins_base,
+                uint32_t num_bb, uint32_t num_ins) {
+  *bb_base = __atomic_fetch_add(&next_bb_base, num_bb, __ATOMIC_SEQ_CST);
+  *ins_base = __atomic_fetch_add(&next_ins_base, num_ins, __ATOMIC_SEQ_CST);
+
+  char line[256];
+  int len = snprintf(line, sizeof(line), "%s %u %u %u %u\n", hash, *bb_base,
+                     *ins_base, num_bb, num_ins);
+  int fd = open(units_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "[SLIMMER] Cannot open %s\n", units_path);
+    return;
+  }
+  WriteAll(fd, line, std::min(len, (int)sizeof(line) - 1));
+  close(fd);
 }
 
 /// The init function of the whole trcing process.
-/// It should be called only once at the begining of the program.
+/// It is called at the begining of the program, by the constructor of each
+/// unit with -slimmer-per-tu, where only the first call takes effect.
 ///
 /// \param name - the path to the trace file.
 ///
 void recordInit(const char *name) {
-  // Initialize the event buffer by giving the path to the trace file.
-  event_buffer.Init(name);
-
-  // Register the signal handlers for flushing the tracing data to file
-  atexit(finish);
-  signal(SIGINT, cleanup_only_tracing);
-  signal(SIGQUIT, cleanup_only_tracing);
-  signal(SIGSEGV, cleanup_only_tracing);
-  signal(SIGABRT, cleanup_only_tracing);
-  signal(SIGTERM, cleanup_only_tracing);
-  signal(SIGKILL, cleanup_only_tracing);
-  signal(SIGILL, cleanup_only_tracing);
-  signal(SIGFPE, cleanup_only_tracing);
+  static bool initialized = false;
+  if (initialized)
+    return;
+  initialized = true;
+  snprintf(units_path, sizeof(units_path), "%s.units", name);
+  // The units of the last run are overwritten
+  unlink(units_path);
+
+  const char *tracing_env = getenv("SLIMMER_TRACING");
+  if (tracing_env && atoi(tracing_env) == 0)
+    slimmer_tracing = 0;
+
+  // A program built with -slimmer-bb-counters records no BasicBlockEvent,
+  // hence it is always run in the counting mode.
+  const char *mode_env = getenv("SLIMMER_MODE");
+  if ((mode_env && strcmp(mode_env, "count") == 0) || num_bb_counters) {
+    // Only the counters, no trace file
+    InitCounting(name);
+    atexit(DumpProfile);
+    pthread_atfork(NULL, NULL, CountingAfterForkInChild);
+  } else {
+    // Initialize the event buffer by giving the path to the trace file.
+    event_buffer.Init(name);
+
+    // Register the handlers for flushing the tracing data to file
+    atexit(finish);
+    pthread_atfork(prepare_fork, after_fork_in_parent, after_fork_in_child);
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = cleanup_only_tracing;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESETHAND;
+  int signals[] = {SIGINT, SIGQUIT, SIGSEGV, SIGABRT,
+                   SIGTERM, SIGILL,  SIGFPE,  SIGBUS};
+  for (int signum : signals)
+    sigaction(signum, &action, NULL);
 }
 
 /// Append a BasicBlockEvent to the trace buffer.
@@ -292,10 +1537,14 @@ void recordInit(const char *name) {
 /// \param id - the basic block ID.
 ///
 __attribute__((always_inline)) void recordBasicBlockEvent(uint32_t id) {
+  if (count_mode)
+    return;
   if (local_tid == 0) {
     // The first event of a thread will always be a BasicBlockEvent
     local_tid = syscall(SYS_gettid);
   }
+  if (Untraced())
+    return;
   DEBUG("[BasicBlockEvent] id = %u pid=%d\n", id, getpid());
 
   char *buffer = event_buffer.StartAppend(SizeOfBasicBlockEvent);
@@ -308,6 +1557,73 @@ __attribute__((always_inline)) void recordBasicBlockEvent(uint32_t id) {
   event_buffer.EndAppend();
 }
 
+/// Append a PathEvent, which stands for the BasicBlockEvents of an acyclic
+/// path of a path-encoded function.
+///
+/// \param id - the entry basic block ID of the function.
+/// \param path - the Ball-Larus number of the path.
+///
+__attribute__((always_inline)) void recordPathEvent(uint32_t id,
+                                                    uint64_t path) {
+  if (count_mode || Untraced())
+    return;
+  DEBUG("[PathEvent] id = %u, path = %lu pid=%d\n", id, path, getpid());
+
+  char *buffer = event_buffer.StartAppend(SizeOfPathEvent);
+
+  *buffer = PathEventLabel;
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = path;
+  *(buffer + 21) = PathEventLabel;
+
+  event_buffer.EndAppend();
+}
+
+/// Append a FunctionEnterEvent or a FunctionExitEvent.
+///
+/// \param label - the label of the event.
+/// \param id - the entry basic block ID of the function.
+///
+static inline void AppendFunctionEvent(char label, uint32_t id) {
+  char *buffer = event_buffer.StartAppend(SizeOfFunctionEvent);
+
+  *buffer = label;
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  *(buffer + 13) = label;
+
+  event_buffer.EndAppend();
+}
+
+/// Append a FunctionEnterEvent at the entry of a function.
+///
+/// \param id - the entry basic block ID of the function.
+///
+__attribute__((always_inline)) void recordFunctionEnter(uint32_t id) {
+  if (count_mode)
+    return;
+  if (local_tid == 0) {
+    // The first event of a thread
+    local_tid = syscall(SYS_gettid);
+  }
+  if (Untraced())
+    return;
+  DEBUG("[FunctionEnterEvent] id = %u pid=%d\n", id, getpid());
+  AppendFunctionEvent(FunctionEnterEventLabel, id);
+}
+
+/// Append a FunctionExitEvent before a function returns or unwinds.
+///
+/// \param id - the entry basic block ID of the function.
+///
+__attribute__((always_inline)) void recordFunctionExit(uint32_t id) {
+  if (count_mode || Untraced())
+    return;
+  DEBUG("[FunctionExitEvent] id = %u pid=%d\n", id, getpid());
+  AppendFunctionEvent(FunctionExitEventLabel, id);
+}
+
 /// Append a MemoryEvent to the trace buffer.
 ///
 /// \param id - the instruction ID.
@@ -316,6 +1632,13 @@ __attribute__((always_inline)) void recordBasicBlockEvent(uint32_t id) {
 ///
 __attribute__((always_inline)) void recordMemoryEvent(uint32_t id, void *addr,
                                                       uint64_t length) {
+  if (count_mode) {
+    Count(id, 1, 0, 0, 0);
+    return;
+  }
+  // The declarations (e.g., of the globals) are kept
+  if (Untraced() && id != (uint32_t) - 1)
+    return;
   char *buffer = event_buffer.StartAppend(SizeOfMemoryEvent);
 
   *buffer = MemoryEventLabel;
@@ -330,8 +1653,33 @@ __attribute__((always_inline)) void recordMemoryEvent(uint32_t id, void *addr,
 }
 
 
+/// Append a load to the trace buffer.
+/// It is a MemoryEvent unless in the online dependency mode.
+///
+/// \param id - the instruction ID.
+/// \param addr - the starting address of the accessed memory.
+/// \param length - the length of the accessed memory.
+///
+__attribute__((always_inline)) void recordLoadEvent(uint32_t id, void *addr,
+                                                    uint64_t length) {
+  if (!event_buffer.online_dep) {
+    recordMemoryEvent(id, addr, length);
+    return;
+  }
+  if (Untraced())
+    return;
+  event_buffer.AppendLoad(local_tid, id, (uint64_t)addr, length);
+  DEBUG("[DepLoadEvent] id = %u, addr = %p, len = %lu pid=%d\n", id, addr, length, getpid());
+}
+
 __attribute__((always_inline)) void recordCallocEvent(uint32_t id, void *addr,
                                                       uint64_t num, uint64_t length) {
+  if (count_mode) {
+    Count(id, 1, 0, 0, 0);
+    return;
+  }
+  if (Untraced())
+    return;
   char *buffer = event_buffer.StartAppend(SizeOfMemoryEvent);
 
   *buffer = MemoryEventLabel;
@@ -355,6 +1703,13 @@ __attribute__((always_inline)) void recordCallocEvent(uint32_t id, void *addr,
 __attribute__((always_inline)) void recordStoreEvent(uint32_t id, void *addr,
                                                      uint64_t length,
                                                      int64_t value) {
+  if (count_mode) {
+    bool silent = value != 0 && *((int64_t *)addr) == value;
+    Count(id, 1, silent, length, silent ? length : 0);
+    return;
+  }
+  if (Untraced())
+    return;
   char *buffer = event_buffer.StartAppend(SizeOfMemoryEvent);
   // If it writes the same value as the original one,
   // it is an inefficacious write.
@@ -362,6 +1717,7 @@ __attribute__((always_inline)) void recordStoreEvent(uint32_t id, void *addr,
     DEBUG("Inefficacious write!!!\n");
     length = 0;
   }
+  event_buffer.RecordWrite((uint64_t)addr, length);
 
   *buffer = MemoryEventLabel;
   (*(uint64_t *)(buffer + 1)) = local_tid;
@@ -375,12 +1731,322 @@ __attribute__((always_inline)) void recordStoreEvent(uint32_t id, void *addr,
         length, value, getpid());
 }
 
+//===----------------------------------------------------------------------===//
+//                        Sized Memory Events
+//===----------------------------------------------------------------------===//
+// The loads and stores of 1, 2, 4, 8 and 16 bytes are recorded by
+// recordLoadN and recordStoreN, whose events imply their lengths by the
+// labels, i.e., 8 bytes less than a MemoryEvent and one argument less.
+
+/// The label of the MemoryEvent of size bytes.
+static constexpr char SizedLabel(uint64_t size) {
+  return size == 1 ? Memory1EventLabel
+                   : size == 2 ? Memory2EventLabel
+                               : size == 4 ? Memory4EventLabel
+                                           : size == 8 ? Memory8EventLabel
+                                                       : Memory16EventLabel;
+}
+
+/// Append a MemoryEvent of Size bytes.
+///
+/// \param id - the instruction ID.
+/// \param addr - the starting address of the accessed memory.
+///
+template <uint64_t Size, bool Store>
+static inline void AppendSizedMemoryEvent(uint32_t id, void *addr) {
+  char *buffer = event_buffer.StartAppend(SizeOfSizedMemoryEvent);
+  if (Store)
+    event_buffer.RecordWrite((uint64_t)addr, Size);
+
+  *buffer = SizedLabel(Size);
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = (uint64_t)addr;
+  *(buffer + 21) = SizedLabel(Size);
+
+  event_buffer.EndAppend();
+}
+
+/// Record a load of Size bytes, as recordLoadEvent.
+///
+template <uint64_t Size>
+static inline void RecordSizedLoad(uint32_t id, void *addr) {
+  if (count_mode) {
+    Count(id, 1, 0, 0, 0);
+    return;
+  }
+  if (Untraced())
+    return;
+  DEBUG("[MemoryEvent] id = %u, addr = %p, len = %lu pid=%d\n", id, addr, Size,
+        getpid());
+  if (event_buffer.online_dep)
+    event_buffer.AppendLoad(local_tid, id, (uint64_t)addr, Size);
+  else
+    AppendSizedMemoryEvent<Size, false>(id, addr);
+}
+
+/// Record a store of Size bytes, as recordStoreEvent.
+/// A silent store is still recorded by a MemoryEvent of length 0.
+///
+template <uint64_t Size>
+static inline void RecordSizedStore(uint32_t id, void *addr, int64_t value) {
+  if (value != 0 && *((int64_t *)addr) == value) {
+    recordStoreEvent(id, addr, Size, value);
+    return;
+  }
+  DEBUG("[MemoryEvent] id = %u, addr = %p, len = %lu, value = %lu pid=%d\n",
+        id, addr, Size, value, getpid());
+  if (count_mode)
+    Count(id, 1, 0, Size, 0);
+  else if (!Untraced())
+    AppendSizedMemoryEvent<Size, true>(id, addr);
+}
+
+#define SLIMMER_SIZED_RECORD(N)                                                \
+  __attribute__((always_inline)) void recordLoad##N(uint32_t id, void *addr) { \
+    RecordSizedLoad<N>(id, addr);                                              \
+  }                                                                            \
+  __attribute__((always_inline)) void recordStore##N(uint32_t id, void *addr,  \
+                                                     int64_t value) {          \
+    RecordSizedStore<N>(id, addr, value);                                      \
+  }
+SLIMMER_SIZED_RECORD(1)
+SLIMMER_SIZED_RECORD(2)
+SLIMMER_SIZED_RECORD(4)
+SLIMMER_SIZED_RECORD(8)
+SLIMMER_SIZED_RECORD(16)
+#undef SLIMMER_SIZED_RECORD
+
+//===----------------------------------------------------------------------===//
+//                        Summarized Loops
+//===----------------------------------------------------------------------===//
+// A loop summarized by the SlimmerTrace pass records its strided accesses and
+// the silent stores of its iterations, and then the loop itself when it exits.
+// In the online dependency mode, they are kept until the loop exits and then
+// replayed as the normal events, since the writers of each load are resolved
+// by the runtime.
+
+struct StridedAccess {
+  uint32_t ID;
+  bool Store;
+  uint64_t Base, Stride, Size;
+};
+static __thread std::vector<StridedAccess> *strided_accesses;
+static __thread std::vector<std::pair<uint32_t, uint64_t> > *silent_stores;
+
+/// Append a MemoryEvent of a store, whose silence is already checked.
+///
+static inline void AppendStore(uint32_t id, uint64_t addr, uint64_t length) {
+  char *buffer = event_buffer.StartAppend(SizeOfMemoryEvent);
+  event_buffer.RecordWrite(addr, length);
+
+  *buffer = MemoryEventLabel;
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = addr;
+  (*(uint64_t *)(buffer + 21)) = length;
+  *(buffer + 29) = MemoryEventLabel;
+
+  event_buffer.EndAppend();
+}
+
+/// Append a StridedEvent, i.e., an access of every iteration of a loop.
+///
+/// \param id - the instruction ID.
+/// \param last - the address accessed by the last iteration.
+/// \param stride - the distance between the addresses of two iterations.
+/// \param size - the length of each access.
+/// \param count - the number of iterations.
+/// \param store - is it a store.
+///
+__attribute__((always_inline)) void recordStridedEvent(uint32_t id, void *last,
+                                                       int64_t stride,
+                                                       uint64_t size,
+                                                       uint64_t count,
+                                                       uint8_t store) {
+  uint64_t base = (uint64_t)last - (count - 1) * (uint64_t)stride;
+  DEBUG("[StridedEvent] id = %u, base = %p, stride = %ld, size = %lu pid=%d\n",
+        id, (void *)base, stride, size, getpid());
+  if (count_mode) {
+    Count(id, count, 0, store ? count * size : 0, 0);
+    return;
+  }
+  if (Untraced())
+    return;
+  if (event_buffer.online_dep) {
+    if (strided_accesses == NULL)
+      strided_accesses = new std::vector<StridedAccess>();
+    StridedAccess a = {id, store != 0, base, (uint64_t)stride, size};
+    strided_accesses->push_back(a);
+    return;
+  }
+
+  char *buffer = event_buffer.StartAppend(SizeOfStridedEvent);
+
+  *buffer = StridedEventLabel;
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = base;
+  (*(uint64_t *)(buffer + 21)) = (uint64_t)stride;
+  (*(uint64_t *)(buffer + 29)) = size;
+  *(buffer + 37) = StridedEventLabel;
+
+  event_buffer.EndAppend();
+}
+
+/// Append a SilentStoreEvent, i.e., a store of a summarized loop that writes
+/// the same value as the original one.
+///
+/// \param id - the instruction ID.
+/// \param iteration - the iteration of the store, counted from 0.
+/// \param size - the length of the store, which is only counted.
+///
+void recordSilentStore(uint32_t id, uint64_t iteration, uint64_t size) {
+  DEBUG("[SilentStoreEvent] id = %u, iteration = %lu pid=%d\n", id, iteration,
+        getpid());
+  if (count_mode) {
+    // Its bytes are counted by the StridedEvent
+    Count(id, 0, 1, 0, size);
+    return;
+  }
+  if (Untraced())
+    return;
+  if (event_buffer.online_dep) {
+    if (silent_stores == NULL)
+      silent_stores = new std::vector<std::pair<uint32_t, uint64_t> >();
+    silent_stores->push_back(std::make_pair(id, iteration));
+    return;
+  }
+
+  char *buffer = event_buffer.StartAppend(SizeOfSilentStoreEvent);
+
+  *buffer = SilentStoreEventLabel;
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = iteration;
+  *(buffer + 21) = SilentStoreEventLabel;
+
+  event_buffer.EndAppend();
+}
+
+/// Append a LoopEvent after the StridedEvents of a summarized loop.
+///
+/// \param id - the basic block ID of the loop.
+/// \param count - the number of iterations.
+///
+__attribute__((always_inline)) void recordLoopEvent(uint32_t id,
+                                                    uint64_t count) {
+  DEBUG("[LoopEvent] id = %u, count = %lu pid=%d\n", id, count, getpid());
+  if (count_mode || Untraced())
+    return;
+  if (!event_buffer.online_dep) {
+    char *buffer = event_buffer.StartAppend(SizeOfLoopEvent);
+
+    *buffer = LoopEventLabel;
+    (*(uint64_t *)(buffer + 1)) = local_tid;
+    (*(uint32_t *)(buffer + 9)) = id;
+    (*(uint64_t *)(buffer + 13)) = count;
+    *(buffer + 21) = LoopEventLabel;
+
+    event_buffer.EndAppend();
+    return;
+  }
+
+  // Replay the iterations. The silent stores are recorded in the order of
+  // their iterations, thus those of iteration k are silent[first, next).
+  static std::vector<StridedAccess> none;
+  static std::vector<std::pair<uint32_t, uint64_t> > no_silent;
+  std::vector<StridedAccess> &accesses =
+      strided_accesses ? *strided_accesses : none;
+  std::vector<std::pair<uint32_t, uint64_t> > &silent =
+      silent_stores ? *silent_stores : no_silent;
+  size_t next = 0;
+  for (uint64_t k = 0; k < count; ++k) {
+    recordBasicBlockEvent(id);
+    size_t first = next;
+    while (next < silent.size() && silent[next].second <= k)
+      ++next;
+    for (auto &a : accesses) {
+      uint64_t addr = a.Base + k * a.Stride;
+      if (!a.Store) {
+        event_buffer.AppendLoad(local_tid, a.ID, addr, a.Size);
+        continue;
+      }
+      uint64_t length = a.Size;
+      for (size_t i = first; i < next; ++i)
+        if (silent[i] == std::make_pair(a.ID, k))
+          length = 0;
+      AppendStore(a.ID, addr, length);
+    }
+  }
+  accesses.clear();
+  silent.clear();
+}
+
+/// Append a BatchEvent, i.e., the loads and stores of a straight-line part of
+/// a basic block, which is recorded after the last of them.
+/// In the online dependency mode, it is appended as the normal events.
+///
+/// \param id - the batch ID.
+/// \param accesses - the BatchAccess of each load and store.
+/// \param n - the number of accesses.
+/// \param bases - the base addresses.
+/// \param k - the number of base addresses.
+/// \param silent - bit i is set if the i-th access is a silent store.
+///
+__attribute__((always_inline)) void recordBatchEvent(uint32_t id,
+                                                     const void *accesses,
+                                                     uint32_t n,
+                                                     const uint64_t *bases,
+                                                     uint32_t k,
+                                                     uint64_t silent) {
+  DEBUG("[BatchEvent] id = %u, n = %u, k = %u, silent = %lx pid=%d\n", id, n,
+        k, silent, getpid());
+  if (count_mode) {
+    const BatchAccess *a = (const BatchAccess *)accesses;
+    for (uint32_t i = 0; i < n; ++i) {
+      uint64_t silent_bit = (silent >> i) & 1;
+      uint64_t bytes = a[i].Store ? a[i].Length : 0;
+      Count(a[i].ID, 1, silent_bit, bytes, silent_bit ? bytes : 0);
+    }
+    return;
+  }
+  if (Untraced())
+    return;
+  if (event_buffer.online_dep) {
+    const BatchAccess *a = (const BatchAccess *)accesses;
+    for (uint32_t i = 0; i < n; ++i) {
+      uint64_t addr = bases[a[i].Base] + a[i].Offset;
+      if (!a[i].Store)
+        event_buffer.AppendLoad(local_tid, a[i].ID, addr, a[i].Length);
+      else
+        AppendStore(a[i].ID, addr, (silent >> i) & 1 ? 0 : a[i].Length);
+    }
+    return;
+  }
+
+  char *buffer = event_buffer.StartAppend(SizeOfBatchEvent + 8 * k);
+
+  *buffer = BatchEventLabel;
+  (*(uint64_t *)(buffer + 1)) = local_tid;
+  (*(uint32_t *)(buffer + 9)) = id;
+  (*(uint64_t *)(buffer + 13)) = k;
+  (*(uint64_t *)(buffer + 21)) = silent;
+  memcpy(buffer + 29, bases, 8 * k);
+  (*(uint64_t *)(buffer + 29 + 8 * k)) = k;
+  *(buffer + 37 + 8 * k) = BatchEventLabel;
+
+  event_buffer.EndAppend();
+}
+
 /// Append a ReturnEvent to the trace buffer.
 ///
 /// \param id - the instruction ID.
 /// \param fun - the address of the called function.
 ///
 __attribute__((always_inline)) void recordReturnEvent(uint32_t id, void *fun) {
+  if (count_mode || Untraced())
+    return;
   DEBUG("[ReturnEvent] tid = %lu id = %u, fun = %p clock()=%lu pid=%d\n", local_tid,
         id, fun, (uint64_t)clock(), getpid());
 
@@ -400,6 +2066,8 @@ __attribute__((always_inline)) void recordReturnEvent(uint32_t id, void *fun) {
 /// \param arg - the pointer argument.
 ///
 __attribute__((always_inline)) void recordArgumentEvent(void *arg) {
+  if (count_mode || Untraced())
+    return;
   DEBUG("[ArgumentEvent] arg = %p pid=%d\n", arg, getpid());
 
   char *buffer = event_buffer.StartAppend(SizeOfArgumentEvent);
@@ -425,7 +2093,6 @@ __attribute__((always_inline)) void recordMemset(uint32_t id, void *addr,
   DEBUG("[MemsetEvent] id = %u, addr = %p, len = %lu, value = %u pid=%d\n", id, addr,
         length, value, getpid());
 
-  char *buffer = event_buffer.StartAppend(SizeOfMemsetEvent);
   // If it writes the same value as the original one,
   // it is an inefficacious write.
   bool changed = false;
@@ -435,10 +2102,19 @@ __attribute__((always_inline)) void recordMemset(uint32_t id, void *addr,
       break;
     }
   }
+  if (count_mode) {
+    Count(id, 1, !changed, length, changed ? 0 : length);
+    return;
+  }
+  if (Untraced())
+    return;
+
+  char *buffer = event_buffer.StartAppend(SizeOfMemsetEvent);
   if (!changed) {
     DEBUG("Inefficacious write!!!\n");
     length = 0;
   }
+  event_buffer.RecordWrite((uint64_t)addr, length);
 
   *buffer = MemsetEventLabel;
   (*(uint64_t *)(buffer + 1)) = local_tid;
@@ -462,13 +2138,22 @@ __attribute__((always_inline)) void recordMemmove(uint32_t id, void *dest,
   DEBUG("[MemmoveEvent] id = %u, dest = %p, src = %p, len = %lu pid=%d\n", id, dest,
         src, length, getpid());
 
-  char *buffer = event_buffer.StartAppend(SizeOfMemmoveEvent);
   // If it writes the same value as the original one,
   // it is an inefficacious write.
-  if (memcmp(dest, src, length) == 0) {
+  bool changed = memcmp(dest, src, length) != 0;
+  if (count_mode) {
+    Count(id, 1, !changed, length, changed ? 0 : length);
+    return;
+  }
+  if (Untraced())
+    return;
+
+  char *buffer = event_buffer.StartAppend(SizeOfMemmoveEvent);
+  if (!changed) {
     DEBUG("Inefficacious write!!!\n");
     length = 0;
   }
+  event_buffer.RecordWrite((uint64_t)dest, length);
 
   *buffer = MemmoveEventLabel;
   (*(uint64_t *)(buffer + 1)) = local_tid;
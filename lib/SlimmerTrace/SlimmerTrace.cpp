@@ -1,15 +1,34 @@
 #include "SlimmerTrace.h"
 #include "SlimmerUtil.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/DebugInfo.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/CallSite.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <map>
@@ -23,6 +42,58 @@ static cl::opt<std::string> InfoDir(
     "slimmer-info-dir",
     cl::desc("The directory that reserves all the generated code infomation"),
     cl::init("/scratch1/zhangmx/SlimmerInfo"));
+static cl::opt<bool> StridedLoops(
+    "slimmer-strided-loops",
+    cl::desc("Summarize the single-block loops whose accesses are strided"),
+    cl::init(false));
+static cl::opt<bool> PathProfile(
+    "slimmer-path-profile",
+    cl::desc("Record the acyclic paths of the functions that call no other "
+             "function, instead of their basic blocks"),
+    cl::init(false));
+static cl::opt<bool> FunctionEvents(
+    "slimmer-function-events",
+    cl::desc("Record the entry and the exits of each function, which keep the "
+             "call stack of print-bug"),
+    cl::init(false));
+static cl::opt<bool> BatchAccesses(
+    "slimmer-batch-accesses",
+    cl::desc("Record the loads and stores of each straight-line part of a "
+             "basic block by a single event"),
+    cl::init(false));
+static cl::opt<bool> DualVersion(
+    "slimmer-dual-version",
+    cl::desc("Keep an uninstrumented version of each instrumented function, "
+             "which is run while the tracing is switched off"),
+    cl::init(false));
+static cl::opt<bool> BBCounters(
+    "slimmer-bb-counters",
+    cl::desc("Count the executions of each basic block in an array of each "
+             "thread, instead of recording BasicBlockEvents, for profiling"),
+    cl::init(false));
+static cl::opt<bool> PerUnit(
+    "slimmer-per-tu",
+    cl::desc("Instrument a translation unit by itself, whose IDs are rebased "
+             "at run time, instead of the whole program at link time"),
+    cl::init(false));
+static cl::opt<std::string> AllowFunctions(
+    "slimmer-allow",
+    cl::desc("Only instrument the functions whose names match this regex"),
+    cl::init(""));
+static cl::opt<std::string> DenyFunctions(
+    "slimmer-deny",
+    cl::desc("Do not instrument the functions whose names match this regex"),
+    cl::init(""));
+static cl::opt<std::string> FunctionProfile(
+    "slimmer-profile",
+    cl::desc("A profile of \"function count\" lines, the execution counts of "
+             "the functions"),
+    cl::init(""));
+static cl::opt<uint64_t> HotThreshold(
+    "slimmer-hot-threshold",
+    cl::desc("Do not instrument the functions executed more than this many "
+             "times in the profile, 0 for no limit"),
+    cl::init(0));
 
 namespace {
 struct SlimmerTrace : public ModulePass {
@@ -30,10 +101,16 @@ struct SlimmerTrace : public ModulePass {
   SlimmerTrace() : ModulePass(ID) {
     PassRegistry &registry = (*PassRegistry::getPassRegistry());
     initializeDataLayoutPass(registry);
+    initializeLoopInfoPass(registry);
+    initializeScalarEvolutionPass(registry);
     initializeSlimmerTracePass(registry);
   }
   virtual void getAnalysisUsage(AnalysisUsage &au) const {
     au.addRequired<DataLayout>();
+    if (StridedLoops) {
+      au.addRequired<LoopInfo>();
+      au.addRequired<ScalarEvolution>();
+    }
     // au.addRequired<PostDominatorTree>();
     // au.addRequired<DominatorTree>();
   }
@@ -47,21 +124,78 @@ struct SlimmerTrace : public ModulePass {
   const DataLayout *dataLayout;
   Function *MainFunction = NULL;
 
-  // The output files
+  // The output files, in the information directory of the module
+  std::string infoDir;
   std::fstream fInst;
   std::fstream fInstrumentedFun;
   std::fstream fBBGraph;
+  std::fstream fPathFun;
+  std::fstream fFunEntry;
+  std::fstream fBatch;
+  std::fstream fCountedFun;
   std::set<std::string> instrumentedFun;
 
+  // The selection of the instrumented functions, NULL for no regex
+  Regex *allowFun = NULL, *denyFun = NULL;
+  // The execution count of each function, from the profile
+  std::map<std::string, uint64_t> funCounts;
+
   // Map a basic block to its ID
-  std::map<BasicBlock *, uint32_t> bb2ID;
+  DenseMap<BasicBlock *, uint32_t> bb2ID;
   // Map an instruction to its ID
-  std::map<Instruction *, uint32_t> ins2ID;
+  DenseMap<Instruction *, uint32_t> ins2ID;
+  // The base64-encoded path of each source file, keyed by the (uniqued)
+  // strings of its directory and name in the debug information.
+  DenseMap<std::pair<const char *, const char *>, std::string> encodedPaths;
+
+  // A single-block loop whose loads and stores are all strided.
+  // It is recorded by a StridedEvent of each access and a LoopEvent when it
+  // exits, instead of the events of each iteration.
+  struct StridedLoop {
+    BasicBlock *Body, *Preheader, *Exit;
+    std::vector<Instruction *> Accesses; // In the order of the body
+    std::vector<int64_t> Strides;
+  };
+  // Map the body of a summarized loop to the loop
+  std::map<BasicBlock *, StridedLoop> stridedLoops;
+
+  // The path-encoded functions, which record a PathEvent for each acyclic
+  // path instead of a BasicBlockEvent for each basic block but the entry.
+  std::map<Function *, PathNumbering> pathFuns;
+
+  // The loads and stores of a straight-line part of a basic block, i.e.,
+  // with no other event in between, are recorded by a BatchEvent after the
+  // last of them. A batch is identified by its index.
+  std::vector<std::vector<Instruction *> > batches;
+  std::set<Instruction *> batched;
+
+  // The execution counters of the current thread, indexed by the basic block
+  // IDs, which are claimed at the entry of each function.
+  std::map<Function *, Value *> localBBCounters;
+  void createBBCounters(Module &module, uint32_t num_bb);
+
+  // The hash of the module, which names its information directory. A unit
+  // instrumented with -slimmer-per-tu registers itself by its hash.
+  std::string moduleHash;
+  // Add the bases of the unit to the IDs of the record calls, and register
+  // the unit at the constructor.
+  void rebaseIDs(Module &module, uint32_t num_bb, uint32_t num_ins);
+
+  // Whether a function is selected by the options for instrumenting
+  bool isSelected(Function *fun);
+
+  // The uninstrumented version of each dual-version function, which is
+  // called at its entry if slimmer_tracing is 0.
+  std::map<Function *, Function *> fastFuns;
+  std::set<Function *> fastClones;
+  GlobalVariable *tracingFlag;
+  void cloneFastVersions(Module &module);
+  void instrumentDispatch(Function *fun, Function *fast);
 
   // Get a printable representation of the Value V
   std::string value2String(Value *v);
-  // Return the common information of an instruction.
-  std::string CommonInfo(Instruction *ins);
+  // Write the common information of an instruction.
+  void CommonInfo(Instruction *ins, std::ostream &os);
 
   // The instrumentation functions
   // void instrumentAddLock(Instruction *ins_ptr);
@@ -76,19 +210,41 @@ struct SlimmerTrace : public ModulePass {
   void instrumentAllocaInst(AllocaInst *alloca_ptr);
   void instrumentAllocaInst(CallInst *call_ptr);
   void instrumentAllocaInst2(CallInst *call_ptr);
+  void findStridedLoops(Function *fun);
+  void instrumentStridedLoop(StridedLoop &loop);
+  bool isPathFunction(Function *fun);
+  void instrumentFunctionEnter(Function *fun);
+  void instrumentFunctionExit(Function *fun);
+  void instrumentPaths(Function *fun, PathNumbering &paths);
+  void findBatches(BasicBlock *bb);
+  void instrumentBatch(uint32_t id, std::vector<Instruction *> &accesses);
 
   // Functions for recording events during execution
   Function *recordInit;
   // Function *recordAddLock;
   Function *recordBasicBlockEvent;
+  Function *recordPathEvent;
+  Function *recordFunctionEnter;
+  Function *recordFunctionExit;
   Function *recordMemoryEvent;
+  Function *recordLoadEvent;
   Function *recordStoreEvent;
+  // recordLoadN and recordStoreN for the accesses of 1, 2, 4, 8 and 16 bytes
+  Function *recordSizedLoad[5];
+  Function *recordSizedStore[5];
   Function *recordCallocEvent;
   // Function *recordCallEvent;
   Function *recordReturnEvent;
   Function *recordArgumentEvent;
   Function *recordMemset;
   Function *recordMemmove;
+  Function *recordStridedEvent;
+  Function *recordSilentStore;
+  Function *recordLoopEvent;
+  Function *recordBatchEvent;
+  Function *recordBBCounters;
+  Function *recordThreadBBCounters;
+  Function *recordUnit;
 
   // Integer types
   Type *Int8Type;
@@ -104,6 +260,32 @@ INITIALIZE_PASS(SlimmerTrace, "slimmer-trace",
                 "The Instrumentation Pass for Slimmer", false, false)
 ModulePass *llvm::createSlimmerTracePass() { return new SlimmerTrace(); }
 
+// Loaded by "opt -load SlimmerTrace.so", the pass is registered when the
+// library is loaded, since no one constructs it before the pass list is
+// parsed. INITIALIZE_PASS only registers it once.
+namespace {
+struct RegisterSlimmerTrace {
+  RegisterSlimmerTrace() {
+    initializeSlimmerTracePass(*PassRegistry::getPassRegistry());
+  }
+} registerSlimmerTrace;
+}
+
+/// Add SlimmerTrace to the passes of clang, loaded by
+/// "-Xclang -load -Xclang SlimmerTrace.so", for -slimmer-per-tu only, since
+/// the program is instrumented as a whole while linking otherwise.
+///
+static void addSlimmerTrace(const PassManagerBuilder &builder,
+                            PassManagerBase &pm) {
+  if (PerUnit)
+    pm.add(createSlimmerTracePass());
+}
+static RegisterStandardPasses
+    addSlimmerTraceLast(PassManagerBuilder::EP_OptimizerLast, addSlimmerTrace);
+static RegisterStandardPasses
+    addSlimmerTraceO0(PassManagerBuilder::EP_EnabledOnOptLevel0,
+                      addSlimmerTrace);
+
 /// Get the string representation of a LLVM Value.
 ///
 /// \param v - the LLVM Value.
@@ -115,54 +297,61 @@ std::string SlimmerTrace::value2String(Value *v) {
   return s;
 }
 
-/// Get the common part of an instruction's infomation,
+/// Write the common part of an instruction's infomation,
 /// no matter which type of instruction it is.
 ///
+/// It is written to the stream directly, and the encoded paths are cached,
+/// since it is called for every instruction of the program.
+///
 /// \param ins - the LLVM IR instruction.
+/// \param os - the output stream.
 ///
-std::string SlimmerTrace::CommonInfo(Instruction *ins) {
-  std::string s;
-  raw_string_ostream rso(s);
-
+void SlimmerTrace::CommonInfo(Instruction *ins, std::ostream &os) {
   // InstructionID:
   assert(ins2ID.count(ins) > 0);
-  rso << ins2ID[ins] << "\n";
+  os << ins2ID[ins] << "\n";
 
   // BasicBlockID,
   assert(bb2ID.count(ins->getParent()) > 0);
-  rso << "\t" << bb2ID[ins->getParent()] << "\n";
+  os << "\t" << bb2ID[ins->getParent()] << "\n";
 
   // Is pointer,
-  rso << "\t" << ins->getType()->isPointerTy() << "\n";
+  os << "\t" << ins->getType()->isPointerTy() << "\n";
 
   // Line of code, Path to the code file,
-  if (MDNode *dbg = ins->getMetadata("dbg")) {
+  if (MDNode *dbg = ins->getMetadata(LLVMContext::MD_dbg)) {
     DILocation loc(dbg);
-    rso << "\t" << loc.getLineNumber() << "\n";
-    std::string path = loc.getFilename().str();
-    if (path.substr(0, 1) != "/") {
-      path = loc.getDirectory().str() + "/" + path;
+    os << "\t" << loc.getLineNumber() << "\n";
+    StringRef file = loc.getFilename(), dir = loc.getDirectory();
+    std::string &encoded =
+        encodedPaths[std::make_pair(dir.data(), file.data())];
+    if (encoded.empty()) {
+      std::string path = file.str();
+      if (path.substr(0, 1) != "/") {
+        path = dir.str() + "/" + path;
+      }
+      encoded = base64_encode((unsigned char const *)path.c_str(),
+                              path.length());
     }
-    rso << "\t" << base64_encode((unsigned char const *)path.c_str(),
-                                 path.length()) << "\n";
+    os << "\t" << encoded << "\n";
   } else {
-    rso << "\t-1\n\t[UNKNOWN]\n";
+    os << "\t-1\n\t[UNKNOWN]\n";
   }
 
   // The instruction's LLVM IR
 #ifdef SLIMMER_PRINT_CODE
   std::string ins_string = value2String(ins);
-  // rso << "\t" << ins_string << "\n"; // TODO: remove this line
-  rso << "\t" << base64_encode((unsigned char const *)ins_string.c_str(),
-                               ins_string.length()) << "\n";
+  // os << "\t" << ins_string << "\n"; // TODO: remove this line
+  os << "\t" << base64_encode((unsigned char const *)ins_string.c_str(),
+                              ins_string.length()) << "\n";
 #else
   if (ReturnInst *return_ptr = dyn_cast<ReturnInst>(ins)) {
     if (return_ptr->getReturnValue() == NULL)
-      rso << "\t" << "cmV0IHZvaWQK" << "\n";
+      os << "\t" << "cmV0IHZvaWQK" << "\n";
     else
-      rso << "\t" << "[UNKNOWN]\n";
+      os << "\t" << "[UNKNOWN]\n";
   } else {
-    rso << "\t" << "[UNKNOWN]\n";
+    os << "\t" << "[UNKNOWN]\n";
   }
 #endif
 
@@ -175,24 +364,82 @@ std::string SlimmerTrace::CommonInfo(Instruction *ins) {
     }
     op_cnt++;
   }
-  rso << "\t" << op_cnt << " ";
+  os << "\t" << op_cnt << " ";
   for (unsigned index = 0; index < ins->getNumOperands(); ++index) {
     if (Instruction *tmp = dyn_cast<Instruction>(ins->getOperand(index))) {
-      if (ins2ID.count(tmp) == 0)
+      DenseMap<Instruction *, uint32_t>::iterator it = ins2ID.find(tmp);
+      if (it == ins2ID.end())
         continue;
-      rso << "Inst " << ins2ID[tmp] << " ";
+      os << "Inst " << it->second << " ";
     } else if (Argument *arg = dyn_cast<Argument>(ins->getOperand(index))) {
       if (arg->getType()->isPointerTy()) {
-        rso << "PointerArg " << arg->getArgNo() << " ";
+        os << "PointerArg " << arg->getArgNo() << " ";
       } else {
-        rso << "Arg " << arg->getArgNo() << " ";
+        os << "Arg " << arg->getArgNo() << " ";
       }
     } else { // A constant
-      rso << "Constan 0 ";
+      os << "Constan 0 ";
     }
   }
-  rso << "\n";
-  return s;
+  os << "\n";
+}
+
+/// Return the MD5 of a module before instrumenting, together with the
+/// options of SlimmerTrace, in hex.
+///
+/// The LTO code generator computes it while looking up its cache, and
+/// passes it by the named metadata slimmer.hash, which is removed here.
+///
+/// \param module - the module.
+///
+std::string llvm::SlimmerModuleHash(Module &module) {
+  if (NamedMDNode *md = module.getNamedMetadata("slimmer.hash")) {
+    std::string hash = cast<MDString>(md->getOperand(0)->getOperand(0))
+                           ->getString().str();
+    md->eraseFromParent();
+    return hash;
+  }
+
+  std::string bitcode;
+  raw_string_ostream os(bitcode);
+  WriteBitcodeToFile(&module, os);
+  os << SlimmerOptions();
+  os.flush();
+
+  MD5 md5;
+  md5.update(bitcode);
+  MD5::MD5Result result;
+  md5.final(result);
+  SmallString<32> hex;
+  MD5::stringifyResult(result, hex);
+  return hex.str();
+}
+
+/// Return the values of all the options of SlimmerTrace, which decide how a
+/// module is instrumented.
+///
+std::string llvm::SlimmerOptions() {
+  std::string s;
+  raw_string_ostream os(s);
+  os << TraceFilename << " " << StridedLoops << PathProfile << FunctionEvents
+     << BatchAccesses << DualVersion << BBCounters << PerUnit << " "
+     << AllowFunctions
+     << " " << DenyFunctions << " " << FunctionProfile << " " << HotThreshold;
+  if (FunctionProfile != "") {
+    // The content of the profile, which may change without its path
+    OwningPtr<MemoryBuffer> profile;
+    if (!MemoryBuffer::getFile(FunctionProfile, profile))
+      os << profile->getBuffer();
+  }
+  return os.str();
+}
+
+/// Return the information directory of a module.
+///
+/// \param hash - the hash of the module, see SlimmerModuleHash.
+///
+std::string llvm::SlimmerInfoDir(const std::string &hash) {
+  return InfoDir + "/" + hash;
 }
 
 bool SlimmerTrace::doInitialization(Module &module) {
@@ -206,16 +453,62 @@ bool SlimmerTrace::doInitialization(Module &module) {
       MainFunction = fun_ptr;
     }
   }
-  if (MainFunction == NULL) return false;
+  // A unit without main is only instrumented with -slimmer-per-tu
+  if (MainFunction == NULL && !PerUnit) return false;
+  if (PerUnit && (BatchAccesses || BBCounters)) {
+    // A batch (a counter) is indexed by a module-wide number, which is not
+    // rebased
+    LOG(ERROR, "SlimmerTrace::PerUnit")
+        << "Ignoring -slimmer-batch-accesses and -slimmer-bb-counters";
+    BatchAccesses = false;
+    BBCounters = false;
+  }
+
+  // Reserve the infomation directory and the files, which is named by the
+  // hash of the module and the options, thus a module is always instrumented
+  // into the same directory.
+  moduleHash = SlimmerModuleHash(module);
+  infoDir = SlimmerInfoDir(moduleHash);
+  LOG(DEBUG, "SlimmerTrace::InfoDir") << infoDir;
+  system(("mkdir -p " + infoDir).c_str());
+  fInst.open(infoDir + "/Inst", std::fstream::out);
+  fInstrumentedFun.open(infoDir + "/InstrumentedFun", std::fstream::out);
+  fBBGraph.open(infoDir + "/BBGraph", std::fstream::out);
+  fPathFun.open(infoDir + "/PathFun", std::fstream::out);
+  fFunEntry.open(infoDir + "/FunEntry", std::fstream::out);
+  fBatch.open(infoDir + "/Batch", std::fstream::out);
+  fCountedFun.open(infoDir + "/CountedFun", std::fstream::out);
+
+  // The selection of the instrumented functions
+  std::string err;
+  if (AllowFunctions != "") {
+    allowFun = new Regex(AllowFunctions);
+    if (!allowFun->isValid(err)) {
+      LOG(ERROR, "SlimmerTrace::Allow") << err;
+      delete allowFun;
+      allowFun = NULL;
+    }
+  }
+  if (DenyFunctions != "") {
+    denyFun = new Regex(DenyFunctions);
+    if (!denyFun->isValid(err)) {
+      LOG(ERROR, "SlimmerTrace::Deny") << err;
+      delete denyFun;
+      denyFun = NULL;
+    }
+  }
 
-  // Reserve the infomation directory and the files
-  srand(time(NULL));
-  InfoDir = InfoDir + "/" + std::to_string(rand());
-  LOG(DEBUG, "SlimmerTrace::InfoDir") << InfoDir;
-  system(("mkdir -p " + InfoDir).c_str());
-  fInst.open(InfoDir + "/Inst", std::fstream::out);
-  fInstrumentedFun.open(InfoDir + "/InstrumentedFun", std::fstream::out);
-  fBBGraph.open(InfoDir + "/BBGraph", std::fstream::out);
+  // The execution counts of the functions
+  if (FunctionProfile != "") {
+    std::ifstream profile(FunctionProfile.c_str());
+    if (!profile)
+      LOG(ERROR, "SlimmerTrace::Profile") << "Cannot open " << FunctionProfile;
+    std::string name;
+    uint64_t count;
+    while (profile >> name >> count)
+      funCounts[name] = count;
+    LOG(DEBUG, "SlimmerTrace::Profile") << funCounts.size() << " functions";
+  }
 
   // Get references to the different types that we'll need.
   Int8Type = IntegerType::getInt8Ty(module.getContext());
@@ -237,15 +530,40 @@ bool SlimmerTrace::doInitialization(Module &module) {
   recordBasicBlockEvent = cast<Function>(module.getOrInsertFunction(
       "recordBasicBlockEvent", VoidType, Int32Type, nullptr));
 
+  // Recording an acyclic path of a path-encoded function.
+  recordPathEvent = cast<Function>(module.getOrInsertFunction(
+      "recordPathEvent", VoidType, Int32Type, Int64Type, nullptr));
+
+  // Recording the entry and the exits of a function.
+  recordFunctionEnter = cast<Function>(module.getOrInsertFunction(
+      "recordFunctionEnter", VoidType, Int32Type, nullptr));
+  recordFunctionExit = cast<Function>(module.getOrInsertFunction(
+      "recordFunctionExit", VoidType, Int32Type, nullptr));
+
   // Recording a MemoryEvent
   recordMemoryEvent = cast<Function>(
       module.getOrInsertFunction("recordMemoryEvent", VoidType, Int32Type,
                                  VoidPtrType, Int64Type, nullptr));
 
+  recordLoadEvent = cast<Function>(
+      module.getOrInsertFunction("recordLoadEvent", VoidType, Int32Type,
+                                 VoidPtrType, Int64Type, nullptr));
+
   recordStoreEvent = cast<Function>(
       module.getOrInsertFunction("recordStoreEvent", VoidType, Int32Type,
                                  VoidPtrType, Int64Type, Int64Type, nullptr));
 
+  // Recording a load or a store of 1, 2, 4, 8 or 16 bytes
+  for (int i = 0; i < 5; ++i) {
+    std::string size = std::to_string(1 << i);
+    recordSizedLoad[i] = cast<Function>(
+        module.getOrInsertFunction("recordLoad" + size, VoidType, Int32Type,
+                                   VoidPtrType, nullptr));
+    recordSizedStore[i] = cast<Function>(
+        module.getOrInsertFunction("recordStore" + size, VoidType, Int32Type,
+                                   VoidPtrType, Int64Type, nullptr));
+  }
+
   recordCallocEvent = cast<Function>(
       module.getOrInsertFunction("recordCallocEvent", VoidType, Int32Type,
                                  VoidPtrType, Int64Type, Int64Type, nullptr));
@@ -268,6 +586,37 @@ bool SlimmerTrace::doInitialization(Module &module) {
       module.getOrInsertFunction("recordMemmove", VoidType, Int32Type,
                                  VoidPtrType, VoidPtrType, Int64Type, nullptr));
 
+  // Recording the summary of a loop
+  recordStridedEvent = cast<Function>(module.getOrInsertFunction(
+      "recordStridedEvent", VoidType, Int32Type, VoidPtrType, Int64Type,
+      Int64Type, Int64Type, Int8Type, nullptr));
+  recordSilentStore = cast<Function>(module.getOrInsertFunction(
+      "recordSilentStore", VoidType, Int32Type, Int64Type, Int64Type,
+      nullptr));
+  recordLoopEvent = cast<Function>(module.getOrInsertFunction(
+      "recordLoopEvent", VoidType, Int32Type, Int64Type, nullptr));
+
+  // Recording the loads and stores of a batch
+  recordBatchEvent = cast<Function>(module.getOrInsertFunction(
+      "recordBatchEvent", VoidType, Int32Type, VoidPtrType, Int32Type,
+      PointerType::getUnqual(Int64Type), Int32Type, Int64Type, nullptr));
+
+  // Registering the execution counters of the basic blocks, and claiming the
+  // ones of a thread
+  recordBBCounters = cast<Function>(module.getOrInsertFunction(
+      "recordBBCounters", VoidType, Int32Type, nullptr));
+  recordThreadBBCounters = cast<Function>(module.getOrInsertFunction(
+      "recordThreadBBCounters", PointerType::getUnqual(Int64Type), nullptr));
+  // Registering a unit of -slimmer-per-tu
+  recordUnit = cast<Function>(module.getOrInsertFunction(
+      "recordUnit", VoidType, VoidPtrType, PointerType::getUnqual(Int32Type),
+      PointerType::getUnqual(Int32Type), Int32Type, Int32Type, nullptr));
+
+  // The switch of the dual-version functions
+  if (DualVersion)
+    tracingFlag = cast<GlobalVariable>(
+        module.getOrInsertGlobal("slimmer_tracing", Int32Type));
+
   // Create the constructor
   appendCtor(module);
   // LOG(DEBUG, "SlimmerTrace::doInitialization") << "End";
@@ -298,6 +647,24 @@ void SlimmerTrace::appendCtor(Module &module) {
   appendToGlobalCtors(module, ctor, 0);
 }
 
+/// Check whether a function is selected for instrumenting, i.e., its name
+/// matches -slimmer-allow (if given) but not -slimmer-deny, and it is not
+/// hotter than -slimmer-hot-threshold in the profile.
+///
+/// \param fun - the function.
+///
+bool SlimmerTrace::isSelected(Function *fun) {
+  std::string fun_name = fun->stripPointerCasts()->getName().str();
+  if (allowFun && !allowFun->match(fun_name))
+    return false;
+  if (denyFun && denyFun->match(fun_name))
+    return false;
+  if (HotThreshold > 0 && funCounts.count(fun_name) &&
+      funCounts[fun_name] > HotThreshold)
+    return false;
+  return true;
+}
+
 bool notTraced(Instruction *ins) {
   if (CallInst *call_ptr = dyn_cast<CallInst>(ins)) {
     Function *called_fun = call_ptr->getCalledFunction();
@@ -320,25 +687,68 @@ bool notTraced(Instruction *ins) {
 
 bool SlimmerTrace::runOnModule(Module &module) {
   // LOG(DEBUG, "SlimmerTrace::runOnModule") << "Start";
-  if (MainFunction == NULL) return false;
+  if (MainFunction == NULL && !PerUnit) return false;
+  auto start_time = std::chrono::steady_clock::now();
 
   dataLayout = &getAnalysis<DataLayout>();
 
   // The basic block (instruction) ID is started from 0
   uint32_t bb_id = 0, ins_id = 0;
   
+  // The fast versions are cloned before instrumenting
+  if (DualVersion)
+    cloneFastVersions(module);
+
   std::vector<Instruction *> ins_list;
+  uint32_t defined_funs = 0;
   for (Module::iterator fun_ptr = module.begin(), fun_end = module.end();
        fun_ptr != fun_end; ++fun_ptr) {
-    if (fun_ptr->isDeclaration() || IsSlimmerFunction(fun_ptr))
+    if (fun_ptr->isDeclaration() || IsSlimmerFunction(fun_ptr) ||
+        fastClones.count(fun_ptr))
+      continue;
+    // The unselected functions are treated as the external ones
+    defined_funs++;
+    if (!isSelected(fun_ptr))
       continue;
     std::string fun_name = fun_ptr->stripPointerCasts()->getName().str();
     instrumentedFun.insert(fun_name);
     fInstrumentedFun << fun_name << "\n";
+    if (StridedLoops)
+      findStridedLoops(fun_ptr);
 
     for (Function::iterator bb_ptr = fun_ptr->begin(), bb_end = fun_ptr->end();
-         bb_ptr != bb_end; ++bb_ptr) {
+         bb_ptr != bb_end; ++bb_ptr)
       bb2ID[bb_ptr] = bb_id++;
+    if (FunctionEvents)
+      fFunEntry << bb2ID[fun_ptr->begin()] << " " << fun_ptr->size() << "\n";
+    if (BBCounters)
+      fCountedFun << fun_name << " " << bb2ID[fun_ptr->begin()] << " "
+                  << fun_ptr->size() << "\n";
+
+    // Number the paths by the IDs of the basic blocks, as print-bug does
+    bool path_fun = false;
+    if (PathProfile && isPathFunction(fun_ptr)) {
+      std::map<uint32_t, std::vector<uint32_t> > successor;
+      for (Function::iterator bb_ptr = fun_ptr->begin(),
+                              bb_end = fun_ptr->end();
+           bb_ptr != bb_end; ++bb_ptr) {
+        TerminatorInst *terminator_ptr = bb_ptr->getTerminator();
+        for (unsigned index = 0; index < terminator_ptr->getNumSuccessors();
+             ++index)
+          successor[bb2ID[bb_ptr]].push_back(
+              bb2ID[terminator_ptr->getSuccessor(index)]);
+      }
+      PathNumbering &paths = pathFuns[fun_ptr];
+      uint32_t entry = bb2ID[&fun_ptr->getEntryBlock()];
+      path_fun = paths.Build(entry, successor);
+      if (path_fun)
+        fPathFun << entry << " " << paths.NumPaths << "\n";
+      else
+        pathFuns.erase(fun_ptr);
+    }
+
+    for (Function::iterator bb_ptr = fun_ptr->begin(), bb_end = fun_ptr->end();
+         bb_ptr != bb_end; ++bb_ptr) {
       for (BasicBlock::iterator ins_ptr = bb_ptr->begin(),
                                 ins_end = bb_ptr->end();
            ins_ptr != ins_end; ++ins_ptr) {
@@ -348,16 +758,32 @@ bool SlimmerTrace::runOnModule(Module &module) {
         ins2ID[ins_ptr] = ins_id++;
         ins_list.push_back(ins_ptr);
       }
-      instrumentBasicBlock(bb_ptr);
+      if (BatchAccesses && stridedLoops.count(bb_ptr) == 0)
+        findBatches(bb_ptr);
+      // The entry of a path-encoded function is still recorded, which tells
+      // print-bug to wait for the PathEvents of the function.
+      if (BBCounters || (stridedLoops.count(bb_ptr) == 0 &&
+                         (!path_fun || bb_ptr == fun_ptr->begin())))
+        instrumentBasicBlock(bb_ptr);
     }
+    if (FunctionEvents)
+      instrumentFunctionEnter(fun_ptr);
   }
 
+  LOG(DEBUG, "SlimmerTrace::SelectedFunctions")
+      << instrumentedFun.size() << " of " << defined_funs;
+
   {
-    Instruction *last = MainFunction->begin()->begin();
+    // The globals of a unit are recorded by its constructor, and the external
+    // ones by the units defining them.
+    Instruction *last =
+        PerUnit ? module.getFunction("slimmerCtor")->begin()->getTerminator()
+                : MainFunction->begin()->begin();
     for (Module::global_iterator gi = module.global_begin(),
                                  gend = module.global_end();
          gi != gend; ++gi) {
-      if (value2String(gi).substr(0, 6) == "@llvm.")
+      if (gi->getName().startswith("llvm.") ||
+          (PerUnit && gi->isDeclaration()))
         continue;
       Value *id = ConstantInt::get(Int32Type, (uint32_t) - 1);
       Constant *cons = ConstantExpr::getPointerCast(gi, VoidPtrType);
@@ -375,13 +801,19 @@ bool SlimmerTrace::runOnModule(Module &module) {
   }
 
   for (auto &ins_ptr : ins_list) {
-    fInst << CommonInfo(ins_ptr);
+    CommonInfo(ins_ptr, fInst);
+    // The accesses of a summarized loop are recorded when it exits, and the
+    // ones of a batch after the last of them.
+    bool summarized = stridedLoops.count(ins_ptr->getParent()) > 0 ||
+                      batched.count(ins_ptr) > 0;
     if (LoadInst *load_ptr = dyn_cast<LoadInst>(ins_ptr)) {
       fInst << "\tLoadInst\n";
-      instrumentLoadInst(load_ptr);
+      if (!summarized)
+        instrumentLoadInst(load_ptr);
     } else if (StoreInst *store_ptr = dyn_cast<StoreInst>(ins_ptr)) {
       fInst << "\tStoreInst\n";
-      instrumentStoreInst(store_ptr);
+      if (!summarized)
+        instrumentStoreInst(store_ptr);
     } else if (AtomicRMWInst *atomic_rmw_ptr =
                    dyn_cast<AtomicRMWInst>(ins_ptr)) {
       fInst << "\tAtomicInst\n"; // Treat AtomicRMWInst as a special tStoreInst
@@ -500,25 +932,179 @@ bool SlimmerTrace::runOnModule(Module &module) {
       fInst << "\tNormalInst\n";
     }
   }
+
+  for (uint32_t i = 0; i < batches.size(); ++i)
+    instrumentBatch(i, batches[i]);
+  if (BatchAccesses)
+    LOG(DEBUG, "SlimmerTrace::Batches") << batches.size();
+
+  // The loops are instrumented at last, since their blocks may be split.
+  for (auto &i : stridedLoops)
+    instrumentStridedLoop(i.second);
+  if (StridedLoops)
+    LOG(DEBUG, "SlimmerTrace::StridedLoops") << stridedLoops.size();
+  for (auto &i : pathFuns)
+    instrumentPaths(i.first, i.second);
+  if (PathProfile)
+    LOG(DEBUG, "SlimmerTrace::PathFunctions") << pathFuns.size();
+
+  // The exits are instrumented at last, after all the other events of the
+  // returning blocks.
+  if (FunctionEvents) {
+    for (Module::iterator fun_ptr = module.begin(), fun_end = module.end();
+         fun_ptr != fun_end; ++fun_ptr) {
+      std::string fun_name = fun_ptr->stripPointerCasts()->getName().str();
+      if (!fun_ptr->isDeclaration() && instrumentedFun.count(fun_name))
+        instrumentFunctionExit(fun_ptr);
+    }
+  }
+
+  if (BBCounters)
+    createBBCounters(module, bb_id);
+  if (PerUnit)
+    rebaseIDs(module, bb_id, ins_id);
+
+  // The dispatches are added at last, before the events of the entries.
+  for (auto &i : fastFuns)
+    instrumentDispatch(i.first, i.second);
+  if (DualVersion)
+    LOG(DEBUG, "SlimmerTrace::DualVersionFunctions") << fastFuns.size();
+  LOG(DEBUG, "SlimmerTrace::Time")
+      << std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start_time).count()
+      << "s for " << ins_id << " instructions";
   // LOG(DEBUG, "SlimmerTrace::runOnModule") << "End";
   return true;
 }
 
 /// Add a call to the recordBasicBlockEvent function
-/// a the begining of a basic block.
+/// a the begining of a basic block, or increase its counter with
+/// -slimmer-bb-counters.
 ///
 /// \param bb - the basic block.
 ///
 void SlimmerTrace::instrumentBasicBlock(BasicBlock *bb) {
   assert(bb2ID.count(bb) > 0);
   Value *bb_ID = ConstantInt::get(Int32Type, bb2ID[bb]);
+  if (BBCounters) {
+    // The counters of the thread are claimed at the entry, which is the
+    // first instrumented block of the function and dominates the others.
+    Function *fun = bb->getParent();
+    Instruction *pt = bb->getFirstInsertionPt();
+    if (localBBCounters.count(fun) == 0) {
+      assert(bb == &fun->getEntryBlock());
+      localBBCounters[fun] =
+          CallInst::Create(recordThreadBBCounters, "slimmer.bb.local", pt);
+    }
+    // A plain increment, as no other thread writes the counter
+    Value *counter = GetElementPtrInst::Create(
+        localBBCounters[fun], ConstantInt::get(Int64Type, bb2ID[bb]), "", pt);
+    Value *execs = new LoadInst(counter, "", pt);
+    execs = BinaryOperator::CreateAdd(execs, ConstantInt::get(Int64Type, 1),
+                                      "", pt);
+    new StoreInst(execs, counter, pt);
+    return;
+  }
   std::vector<Value *> args = make_vector<Value *>(bb_ID, 0);
 
   // Insert a call to recordBasicBlockEvent at the beginning of the basic block
   CallInst::Create(recordBasicBlockEvent, args, "", bb->getFirstInsertionPt());
 }
 
-/// Add a call to the recordMemoryEvent function after a load.
+/// Register the number of the basic block counters at the constructor, before
+/// initializing the runtime, which allocates the counters of each thread.
+///
+/// \param module - the module.
+/// \param num_bb - the number of the basic blocks.
+///
+void SlimmerTrace::createBBCounters(Module &module, uint32_t num_bb) {
+  Function *ctor = module.getFunction("slimmerCtor");
+  std::vector<Value *> args =
+      make_vector<Value *>(ConstantInt::get(Int32Type, num_bb), 0);
+  CallInst::Create(recordBBCounters, args, "", ctor->begin()->begin());
+  LOG(DEBUG, "SlimmerTrace::BBCounters") << num_bb;
+}
+
+/// Turn the constant IDs of the record calls into the ones relative to the
+/// bases of the unit, which are assigned by recordUnit at the constructor.
+/// The globals, whose ID is -1, are not rebased.
+///
+/// \param module - the module.
+/// \param num_bb - the number of the basic blocks.
+/// \param num_ins - the number of the instructions.
+///
+void SlimmerTrace::rebaseIDs(Module &module, uint32_t num_bb,
+                             uint32_t num_ins) {
+  GlobalVariable *bb_base = new GlobalVariable(
+      module, Int32Type, false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Type, 0), "slimmer.unit.bb_base");
+  GlobalVariable *ins_base = new GlobalVariable(
+      module, Int32Type, false, GlobalValue::InternalLinkage,
+      ConstantInt::get(Int32Type, 0), "slimmer.unit.ins_base");
+
+  // The functions whose first argument is a basic block ID, and the ones
+  // whose first argument is an instruction ID
+  std::vector<Function *> bb_funs = make_vector<Function *>(
+      recordBasicBlockEvent, recordPathEvent, recordFunctionEnter,
+      recordFunctionExit, recordLoopEvent, 0);
+  std::vector<Function *> ins_funs = make_vector<Function *>(
+      recordMemoryEvent, recordLoadEvent, recordStoreEvent, recordCallocEvent,
+      recordReturnEvent, recordMemset, recordMemmove, recordStridedEvent,
+      recordSilentStore, 0);
+  for (int i = 0; i < 5; ++i) {
+    ins_funs.push_back(recordSizedLoad[i]);
+    ins_funs.push_back(recordSizedStore[i]);
+  }
+
+  uint32_t rebased = 0;
+  auto rebase = [&](Function *fun, GlobalVariable *base) {
+    std::vector<CallInst *> calls;
+    for (Value::use_iterator use = fun->use_begin(), end = fun->use_end();
+         use != end; ++use)
+      if (CallInst *call = dyn_cast<CallInst>(*use))
+        calls.push_back(call);
+    for (auto call : calls) {
+      ConstantInt *id = dyn_cast<ConstantInt>(call->getArgOperand(0));
+      if (id == NULL || id->isAllOnesValue())
+        continue;
+      Value *b = new LoadInst(base, "", call);
+      call->setArgOperand(0, BinaryOperator::CreateAdd(b, id, "", call));
+      rebased++;
+    }
+  };
+  for (auto fun : bb_funs)
+    rebase(fun, bb_base);
+  for (auto fun : ins_funs)
+    rebase(fun, ins_base);
+
+  // Register the unit right after initializing the runtime
+  Function *ctor = module.getFunction("slimmerCtor");
+  Constant *hash = StringToGV(moduleHash, module);
+  std::vector<Value *> args = make_vector<Value *>(
+      ConstantExpr::getZExtOrBitCast(hash, VoidPtrType), (Value *)bb_base,
+      (Value *)ins_base, ConstantInt::get(Int32Type, num_bb),
+      ConstantInt::get(Int32Type, num_ins), 0);
+  CallInst::Create(recordUnit, args, "", ++ctor->begin()->begin());
+  LOG(DEBUG, "SlimmerTrace::PerUnit") << moduleHash << ", " << rebased
+                                      << " calls rebased";
+}
+
+/// Return the index of recordSizedLoad (recordSizedStore) for the accesses of
+/// size bytes, -1 if there is no such entry point.
+///
+static int sizedIndex(uint64_t size) {
+  switch (size) {
+  case 1: return 0;
+  case 2: return 1;
+  case 4: return 2;
+  case 8: return 3;
+  case 16: return 4;
+  default: return -1;
+  }
+}
+
+/// Add a call to the recordLoadEvent function after a load,
+/// or to recordLoadN if its size is N bytes.
 ///
 /// \param load_ptr - the load instruction.
 ///
@@ -535,11 +1121,18 @@ void SlimmerTrace::instrumentLoadInst(LoadInst *load_ptr) {
   uint64_t size = dataLayout->getTypeStoreSize(load_ptr->getType());
   Value *load_size = ConstantInt::get(Int64Type, size);
 
+  if (sizedIndex(size) >= 0) {
+    std::vector<Value *> args = make_vector<Value *>(load_id, addr, 0);
+    CallInst::Create(recordSizedLoad[sizedIndex(size)], args)
+        ->insertAfter(load_ptr);
+    return;
+  }
   std::vector<Value *> args = make_vector<Value *>(load_id, addr, load_size, 0);
-  CallInst::Create(recordMemoryEvent, args)->insertAfter(load_ptr);
+  CallInst::Create(recordLoadEvent, args)->insertAfter(load_ptr);
 }
 
-/// Add a call to the recordMemoryEvent function after a store.
+/// Add a call to the recordStoreEvent function before a store,
+/// or to recordStoreN if its size is N bytes.
 ///
 /// \param store_ptr - the store instruction.
 ///
@@ -556,17 +1149,24 @@ void SlimmerTrace::instrumentStoreInst(StoreInst *store_ptr) {
   Value *store_size = ConstantInt::get(Int64Type, size);
 
   auto type = store_ptr->getOperand(0)->getType();
+  Value *value;
   if (type->isSingleValueType() && !type->isVectorTy() && size <= 8) {
     // Cast the pointer into a void pointer type.
-    Value *value = store_ptr->getValueOperand();
+    value = store_ptr->getValueOperand();
     value = LLVMCastTo(value, Int64Type, value->getName(), store_ptr);
+  } else {
+    // The stored value is not compared, but the runtime still needs to know
+    // that it is a store.
+    value = ConstantInt::get(Int64Type, 0);
+  }
+  if (sizedIndex(size) >= 0) {
+    std::vector<Value *> args = make_vector<Value *>(store_id, addr, value, 0);
+    CallInst::Create(recordSizedStore[sizedIndex(size)], args)
+        ->insertBefore(store_ptr);
+  } else {
     std::vector<Value *> args =
         make_vector<Value *>(store_id, addr, store_size, value, 0);
     CallInst::Create(recordStoreEvent, args)->insertBefore(store_ptr);
-  } else {
-    std::vector<Value *> args =
-        make_vector<Value *>(store_id, addr, store_size, 0);
-    CallInst::Create(recordMemoryEvent, args)->insertAfter(store_ptr);
   }
 }
 
@@ -755,3 +1355,564 @@ void SlimmerTrace::instrumentMemmove(CallInst *call_ptr) {
   std::vector<Value *> args = make_vector<Value *>(call_id, dest, src, len, 0);
   CallInst::Create(recordMemmove, args)->insertBefore(call_ptr);
 }
+
+/// Get the distance between the addresses of two iterations of a loop.
+///
+/// \param se - the ScalarEvolution of the function.
+/// \param loop - the loop.
+/// \param ptr - the address.
+/// \param stride - the distance, 0 for a loop invariant address.
+/// \return - false if the address is not an affine function of the
+/// iteration, or its stride is not a constant.
+///
+static bool getStride(ScalarEvolution &se, Loop *loop, Value *ptr,
+                      int64_t &stride) {
+  const SCEV *scev = se.getSCEV(ptr);
+  if (se.isLoopInvariant(scev, loop)) {
+    stride = 0;
+    return true;
+  }
+  const SCEVAddRecExpr *rec = dyn_cast<SCEVAddRecExpr>(scev);
+  if (!rec || rec->getLoop() != loop || !rec->isAffine())
+    return false;
+  const SCEVConstant *step =
+      dyn_cast<SCEVConstant>(rec->getStepRecurrence(se));
+  if (!step)
+    return false;
+  stride = step->getValue()->getSExtValue();
+  return true;
+}
+
+/// Find the loops of a function that can be summarized, i.e., the loops
+/// that consist of a single basic block, have a preheader and an exit block
+/// only reached from the loop, and whose loads and stores are all strided.
+/// Such a loop executes the same instructions in each iteration, hence it is
+/// recorded by the addresses of its last iteration and the number of
+/// iterations.
+///
+/// \param fun - the function.
+///
+void SlimmerTrace::findStridedLoops(Function *fun) {
+  LoopInfo &li = getAnalysis<LoopInfo>(*fun);
+  ScalarEvolution &se = getAnalysis<ScalarEvolution>(*fun);
+
+  for (Function::iterator bb = fun->begin(), bb_end = fun->end();
+       bb != bb_end; ++bb) {
+    Loop *loop = li.getLoopFor(bb);
+    if (loop == NULL || loop->getNumBlocks() != 1)
+      continue;
+
+    StridedLoop l;
+    l.Body = bb;
+    l.Preheader = loop->getLoopPreheader();
+    l.Exit = loop->getExitBlock();
+    if (l.Preheader == NULL || l.Exit == NULL ||
+        l.Exit->getSinglePredecessor() != bb || l.Exit->isLandingPad() ||
+        std::distance(pred_begin(bb), pred_end(bb)) != 2)
+      continue;
+
+    bool ok = true;
+    for (BasicBlock::iterator ins = bb->begin(), ins_end = bb->end();
+         ok && ins != ins_end; ++ins) {
+      int64_t stride;
+      if (LoadInst *load_ptr = dyn_cast<LoadInst>(ins)) {
+        ok = load_ptr->isSimple() &&
+             getStride(se, loop, load_ptr->getPointerOperand(), stride);
+      } else if (StoreInst *store_ptr = dyn_cast<StoreInst>(ins)) {
+        ok = store_ptr->isSimple() &&
+             getStride(se, loop, store_ptr->getPointerOperand(), stride);
+      } else {
+        // Only the calls that are not traced, e.g., intrinsics, are allowed
+        ok = !(isa<CallInst>(ins) && !notTraced(ins)) &&
+             !isa<InvokeInst>(ins) && !isa<AllocaInst>(ins) &&
+             !isa<AtomicRMWInst>(ins) && !isa<AtomicCmpXchgInst>(ins);
+        continue;
+      }
+      l.Accesses.push_back(ins);
+      l.Strides.push_back(stride);
+    }
+    if (ok && l.Accesses.size() <= SLIMMER_MAX_STRIDED)
+      stridedLoops[bb] = l;
+  }
+}
+
+/// Instrument a summarized loop.
+///
+/// The iterations are counted by a PHINode of the body. When the loop exits,
+/// a call to recordStridedEvent is added for each access, with the address of
+/// its last iteration, followed by a call to recordLoopEvent. The silence of
+/// a store is checked in each iteration, as recordStoreEvent does, and
+/// recordSilentStore is only called for the silent ones.
+///
+/// \param loop - the loop.
+///
+void SlimmerTrace::instrumentStridedLoop(StridedLoop &loop) {
+  BasicBlock *bb = loop.Body;
+  assert(bb2ID.count(bb) > 0);
+  Value *bb_id = ConstantInt::get(Int32Type, bb2ID[bb]);
+
+  // Count the iterations
+  PHINode *iter = PHINode::Create(Int64Type, 2, "slimmer.iter", bb->begin());
+  Instruction *count =
+      BinaryOperator::CreateAdd(iter, ConstantInt::get(Int64Type, 1),
+                                "slimmer.count", bb->getFirstInsertionPt());
+  iter->addIncoming(ConstantInt::get(Int64Type, 0), loop.Preheader);
+  iter->addIncoming(count, bb);
+
+  // Record the loop before the BasicBlockEvent of the exit block
+  Instruction *exit_pt = loop.Exit->getFirstInsertionPt();
+  for (size_t i = 0; i < loop.Accesses.size(); ++i) {
+    Instruction *ins = loop.Accesses[i];
+    assert(ins2ID.count(ins) > 0);
+    Value *id = ConstantInt::get(Int32Type, ins2ID[ins]);
+    Value *ptr;
+    uint64_t size;
+    bool store = false;
+    if (LoadInst *load_ptr = dyn_cast<LoadInst>(ins)) {
+      ptr = load_ptr->getPointerOperand();
+      size = dataLayout->getTypeStoreSize(load_ptr->getType());
+    } else {
+      StoreInst *store_ptr = cast<StoreInst>(ins);
+      ptr = store_ptr->getPointerOperand();
+      size = dataLayout->getTypeStoreSize(
+          store_ptr->getValueOperand()->getType());
+      store = true;
+    }
+    Value *last = LLVMCastTo(ptr, VoidPtrType, "", exit_pt);
+    std::vector<Value *> args = make_vector<Value *>(
+        id, last, ConstantInt::get(Int64Type, loop.Strides[i]),
+        ConstantInt::get(Int64Type, size), count,
+        ConstantInt::get(Int8Type, store), 0);
+    CallInst::Create(recordStridedEvent, args, "", exit_pt);
+  }
+  std::vector<Value *> args = make_vector<Value *>(bb_id, count, 0);
+  CallInst::Create(recordLoopEvent, args, "", exit_pt);
+
+  // Check the silence of the stores
+  for (auto ins : loop.Accesses) {
+    StoreInst *store_ptr = dyn_cast<StoreInst>(ins);
+    if (store_ptr == NULL)
+      continue;
+    Type *type = store_ptr->getValueOperand()->getType();
+    if (!type->isSingleValueType() || type->isVectorTy() ||
+        dataLayout->getTypeStoreSize(type) > 8)
+      continue; // Never silent, as in instrumentStoreInst
+
+    // silent = value != 0 && *(int64_t *)addr == value
+    Value *value = LLVMCastTo(store_ptr->getValueOperand(), Int64Type, "",
+                              store_ptr);
+    Value *addr = LLVMCastTo(store_ptr->getPointerOperand(),
+                             PointerType::getUnqual(Int64Type), "", store_ptr);
+    Value *old = new LoadInst(addr, "slimmer.old", false, 1, store_ptr);
+    Value *zero = ConstantInt::get(Int64Type, 0);
+    Value *silent = BinaryOperator::CreateAnd(
+        new ICmpInst(store_ptr, ICmpInst::ICMP_NE, value, zero),
+        new ICmpInst(store_ptr, ICmpInst::ICMP_EQ, old, value),
+        "slimmer.silent", store_ptr);
+
+    BasicBlock *head = store_ptr->getParent();
+    BasicBlock *tail = head->splitBasicBlock(store_ptr, "slimmer.store");
+    BasicBlock *cold = BasicBlock::Create(bb->getContext(), "slimmer.silent",
+                                          bb->getParent(), tail);
+    head->getTerminator()->eraseFromParent();
+    BranchInst::Create(cold, tail, silent, head);
+    Value *id = ConstantInt::get(Int32Type, ins2ID[store_ptr]);
+    Value *size =
+        ConstantInt::get(Int64Type, dataLayout->getTypeStoreSize(type));
+    std::vector<Value *> args = make_vector<Value *>(id, iter, size, 0);
+    CallInst::Create(recordSilentStore, args, "", cold);
+    BranchInst::Create(tail, cold);
+  }
+}
+
+/// Check whether the paths of a function can be recorded instead of its basic
+/// blocks, i.e., it calls no function but the intrinsics, hence all the events
+/// between two of its PathEvents belong to it, and it has no summarized loop.
+///
+/// \param fun - the function.
+///
+bool SlimmerTrace::isPathFunction(Function *fun) {
+  for (Function::iterator bb = fun->begin(), bb_end = fun->end();
+       bb != bb_end; ++bb) {
+    if (stridedLoops.count(bb))
+      return false;
+    TerminatorInst *terminator_ptr = bb->getTerminator();
+    if (isa<InvokeInst>(terminator_ptr) ||
+        isa<IndirectBrInst>(terminator_ptr) || isa<ResumeInst>(terminator_ptr))
+      return false;
+    for (BasicBlock::iterator ins = bb->begin(), ins_end = bb->end();
+         ins != ins_end; ++ins) {
+      if (CallInst *call_ptr = dyn_cast<CallInst>(ins)) {
+        Function *called_fun = call_ptr->getCalledFunction();
+        if (!called_fun || !called_fun->isIntrinsic())
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+/// Instrument a path-encoded function with a Ball-Larus path register.
+///
+/// The register is increased on each edge of the DAG with a non-zero value. A
+/// PathEvent is recorded on each back edge, after which the register is reset
+/// to the value of the loop header, and before each return. The register is
+/// kept in an alloca, which is promoted at last.
+///
+/// \param fun - the function.
+/// \param paths - the numbering of its paths.
+///
+void SlimmerTrace::instrumentPaths(Function *fun, PathNumbering &paths) {
+  Value *fun_id = ConstantInt::get(Int32Type, paths.Entry);
+  BasicBlock *entry = &fun->getEntryBlock();
+  AllocaInst *reg = new AllocaInst(Int64Type, "slimmer.path", entry->begin());
+  (new StoreInst(ConstantInt::get(Int64Type, 0), reg))->insertAfter(reg);
+
+  std::map<uint32_t, BasicBlock *> id2BB;
+  for (Function::iterator bb = fun->begin(), bb_end = fun->end();
+       bb != bb_end; ++bb)
+    id2BB[bb2ID[bb]] = bb;
+
+  // The code of an edge is put at the beginning of its target if the source
+  // is its only predecessor (e.g., a switch whose cases share the target),
+  // otherwise at the end of its source if the source has a single successor,
+  // otherwise the edge is split.
+  std::vector<std::pair<BasicBlock *, BasicBlock *> > at_target, at_source;
+  for (auto &i : paths.Out) {
+    BasicBlock *from = id2BB[i.first];
+    TerminatorInst *terminator_ptr = from->getTerminator();
+    std::set<BasicBlock *> visited;
+    for (unsigned index = 0; index < terminator_ptr->getNumSuccessors();
+         ++index) {
+      BasicBlock *to = terminator_ptr->getSuccessor(index);
+      std::pair<uint32_t, uint32_t> e(i.first, bb2ID[to]);
+      if (!visited.insert(to).second ||
+          (paths.EdgeVal.count(e) && paths.EdgeVal[e] == 0))
+        continue;
+      if (to->getUniquePredecessor() == from)
+        at_target.push_back(std::make_pair(from, to));
+      else
+        at_source.push_back(std::make_pair(from, to));
+    }
+  }
+
+  auto instrument_edge = [&](BasicBlock *from, BasicBlock *to,
+                             Instruction *pt) {
+    std::pair<uint32_t, uint32_t> e(bb2ID[from], bb2ID[to]);
+    Value *path = new LoadInst(reg, "", pt);
+    if (paths.EdgeVal.count(e)) {
+      path = BinaryOperator::CreateAdd(
+          path, ConstantInt::get(Int64Type, paths.EdgeVal[e]), "", pt);
+      new StoreInst(path, reg, pt);
+      return;
+    }
+    // A back edge ends a path and starts a new one from the loop header
+    assert(paths.BackVal.count(e) > 0);
+    path = BinaryOperator::CreateAdd(
+        path, ConstantInt::get(Int64Type, paths.BackVal[e]), "", pt);
+    std::vector<Value *> args = make_vector<Value *>(fun_id, path, 0);
+    CallInst::Create(recordPathEvent, args, "", pt);
+    new StoreInst(ConstantInt::get(Int64Type, paths.HeaderVal[e.second]), reg,
+                  pt);
+  };
+
+  // The code at the beginning of a block goes before the code at its end
+  for (auto &i : at_target)
+    instrument_edge(i.first, i.second, i.second->getFirstInsertionPt());
+  for (auto &i : at_source) {
+    TerminatorInst *terminator_ptr = i.first->getTerminator();
+    if (terminator_ptr->getNumSuccessors() == 1) {
+      instrument_edge(i.first, i.second, terminator_ptr);
+      continue;
+    }
+    unsigned index = 0;
+    while (terminator_ptr->getSuccessor(index) != i.second)
+      ++index;
+    // The edge is not split if it is not critical, i.e., all the edges into
+    // the target come from the source.
+    BasicBlock *split = SplitCriticalEdge(terminator_ptr, index, NULL, true);
+    instrument_edge(i.first, i.second,
+                    split ? split->getTerminator()
+                          : (Instruction *)i.second->getFirstInsertionPt());
+  }
+
+  // Record the last path before returning
+  for (auto &i : paths.ReturnVal) {
+    ReturnInst *return_ptr =
+        dyn_cast<ReturnInst>(id2BB[i.first]->getTerminator());
+    if (return_ptr == NULL)
+      continue; // Unreachable
+    Value *path = new LoadInst(reg, "", return_ptr);
+    path = BinaryOperator::CreateAdd(
+        path, ConstantInt::get(Int64Type, i.second), "", return_ptr);
+    std::vector<Value *> args = make_vector<Value *>(fun_id, path, 0);
+    CallInst::Create(recordPathEvent, args, "", return_ptr);
+  }
+
+  DominatorTree dt;
+  dt.recalculate(*fun);
+  std::vector<AllocaInst *> allocas(1, reg);
+  PromoteMemToReg(allocas, dt);
+}
+
+/// Add a call to the recordFunctionEnter function before the BasicBlockEvent
+/// of the entry block.
+///
+/// \param fun - the function.
+///
+void SlimmerTrace::instrumentFunctionEnter(Function *fun) {
+  BasicBlock *entry = &fun->getEntryBlock();
+  assert(bb2ID.count(entry) > 0);
+  Value *fun_id = ConstantInt::get(Int32Type, bb2ID[entry]);
+  std::vector<Value *> args = make_vector<Value *>(fun_id, 0);
+  CallInst::Create(recordFunctionEnter, args, "",
+                   entry->getFirstInsertionPt());
+}
+
+/// Add a call to the recordFunctionExit function before each return and
+/// each resume, i.e., the exception is unwound to the caller.
+///
+/// \param fun - the function.
+///
+void SlimmerTrace::instrumentFunctionExit(Function *fun) {
+  assert(bb2ID.count(&fun->getEntryBlock()) > 0);
+  Value *fun_id = ConstantInt::get(Int32Type, bb2ID[&fun->getEntryBlock()]);
+  for (Function::iterator bb = fun->begin(), bb_end = fun->end();
+       bb != bb_end; ++bb) {
+    TerminatorInst *terminator_ptr = bb->getTerminator();
+    if (isa<ReturnInst>(terminator_ptr) || isa<ResumeInst>(terminator_ptr)) {
+      std::vector<Value *> args = make_vector<Value *>(fun_id, 0);
+      CallInst::Create(recordFunctionExit, args, "", terminator_ptr);
+    }
+  }
+}
+
+/// Group the loads and stores of a basic block into batches, i.e., the
+/// straight-line parts with at least two accesses and no other instruction
+/// that records an event or calls a function.
+///
+/// \param bb - the basic block.
+///
+void SlimmerTrace::findBatches(BasicBlock *bb) {
+  std::vector<Instruction *> accesses;
+  auto close = [&]() {
+    if (accesses.size() >= 2) {
+      for (auto ins : accesses)
+        batched.insert(ins);
+      batches.push_back(accesses);
+    }
+    accesses.clear();
+  };
+
+  for (BasicBlock::iterator ins_ptr = bb->begin(), ins_end = bb->end();
+       ins_ptr != ins_end; ++ins_ptr) {
+    if (isa<LoadInst>(ins_ptr) || isa<StoreInst>(ins_ptr)) {
+      if (accesses.size() == SLIMMER_MAX_BATCH)
+        close();
+      accesses.push_back(ins_ptr);
+    } else if (!notTraced(ins_ptr) && !isa<BinaryOperator>(ins_ptr) &&
+               !isa<CastInst>(ins_ptr) && !isa<GetElementPtrInst>(ins_ptr) &&
+               !isa<CmpInst>(ins_ptr) && !isa<SelectInst>(ins_ptr) &&
+               !isa<PHINode>(ins_ptr) && !isa<ExtractValueInst>(ins_ptr) &&
+               !isa<InsertValueInst>(ins_ptr) &&
+               !isa<ExtractElementInst>(ins_ptr) &&
+               !isa<InsertElementInst>(ins_ptr) &&
+               !isa<ShuffleVectorInst>(ins_ptr)) {
+      close();
+    }
+  }
+  close();
+}
+
+/// Add a call to the recordBatchEvent function after the last access of a
+/// batch. The addresses are recorded as the distinct bases plus constant
+/// offsets, e.g., the fields of a struct share one base, and the silence of
+/// each store is checked before it as in instrumentStoreInst.
+///
+/// \param id - the batch ID.
+/// \param accesses - the loads and stores of the batch.
+///
+void SlimmerTrace::instrumentBatch(uint32_t id,
+                                   std::vector<Instruction *> &accesses) {
+  BasicBlock::iterator insert_pt = accesses.back();
+  ++insert_pt;
+  Function *fun = insert_pt->getParent()->getParent();
+
+  std::vector<Value *> bases;
+  std::vector<Constant *> descs;
+  StructType *desc_type = StructType::get(Int32Type, Int32Type, Int64Type,
+                                          Int32Type, Int32Type, nullptr);
+  Value *silent_mask = ConstantInt::get(Int64Type, 0);
+  fBatch << id << " " << accesses.size();
+  for (size_t i = 0; i < accesses.size(); ++i) {
+    Instruction *ins = accesses[i];
+    assert(ins2ID.count(ins) > 0);
+    Value *ptr;
+    uint64_t size;
+    StoreInst *store_ptr = dyn_cast<StoreInst>(ins);
+    if (store_ptr) {
+      ptr = store_ptr->getPointerOperand();
+      size = dataLayout->getTypeStoreSize(
+          store_ptr->getValueOperand()->getType());
+    } else {
+      ptr = cast<LoadInst>(ins)->getPointerOperand();
+      size = dataLayout->getTypeStoreSize(ins->getType());
+    }
+
+    int64_t offset = 0;
+    Value *base = GetPointerBaseWithConstantOffset(ptr, offset, dataLayout);
+    size_t base_index =
+        std::find(bases.begin(), bases.end(), base) - bases.begin();
+    if (base_index == bases.size())
+      bases.push_back(base);
+
+    fBatch << " " << ins2ID[ins] << " " << base_index << " " << offset << " "
+           << size << " " << (store_ptr != NULL);
+    descs.push_back(ConstantStruct::get(
+        desc_type, ConstantInt::get(Int32Type, ins2ID[ins]),
+        ConstantInt::get(Int32Type, base_index),
+        ConstantInt::get(Int64Type, offset), ConstantInt::get(Int32Type, size),
+        ConstantInt::get(Int32Type, store_ptr != NULL), nullptr));
+
+    if (store_ptr == NULL)
+      continue;
+    Type *type = store_ptr->getValueOperand()->getType();
+    if (!type->isSingleValueType() || type->isVectorTy() || size > 8)
+      continue; // Never silent, as in instrumentStoreInst
+
+    // silent = value != 0 && *(int64_t *)addr == value
+    Value *value = LLVMCastTo(store_ptr->getValueOperand(), Int64Type, "",
+                              store_ptr);
+    Value *addr = LLVMCastTo(ptr, PointerType::getUnqual(Int64Type), "",
+                             store_ptr);
+    Value *old = new LoadInst(addr, "slimmer.old", false, 1, store_ptr);
+    Value *zero = ConstantInt::get(Int64Type, 0);
+    Value *silent = BinaryOperator::CreateAnd(
+        new ICmpInst(store_ptr, ICmpInst::ICMP_NE, value, zero),
+        new ICmpInst(store_ptr, ICmpInst::ICMP_EQ, old, value),
+        "slimmer.silent", store_ptr);
+    Value *bit = BinaryOperator::CreateShl(
+        new ZExtInst(silent, Int64Type, "", store_ptr),
+        ConstantInt::get(Int64Type, i), "", store_ptr);
+    silent_mask = BinaryOperator::CreateOr(silent_mask, bit, "slimmer.mask",
+                                           store_ptr);
+  }
+  fBatch << "\n";
+
+  // The descriptors of the accesses, for replaying them in the runtime
+  ArrayType *descs_type = ArrayType::get(desc_type, descs.size());
+  GlobalVariable *descs_gv = new GlobalVariable(
+      *fun->getParent(), descs_type, true, GlobalValue::PrivateLinkage,
+      ConstantArray::get(descs_type, descs), "slimmer.batch");
+  Value *descs_ptr = ConstantExpr::getPointerCast(descs_gv, VoidPtrType);
+
+  // The base addresses are passed in an array on the stack
+  ArrayType *bases_type = ArrayType::get(Int64Type, bases.size());
+  AllocaInst *bases_array =
+      new AllocaInst(bases_type, "slimmer.bases",
+                     fun->getEntryBlock().getFirstInsertionPt());
+  Value *zero = ConstantInt::get(Int32Type, 0);
+  for (size_t i = 0; i < bases.size(); ++i) {
+    Value *indices[] = {zero, ConstantInt::get(Int32Type, i)};
+    Value *slot =
+        GetElementPtrInst::CreateInBounds(bases_array, indices, "", insert_pt);
+    new StoreInst(LLVMCastTo(bases[i], Int64Type, "", insert_pt), slot,
+                  insert_pt);
+  }
+  Value *indices[] = {zero, zero};
+  Value *bases_ptr =
+      GetElementPtrInst::CreateInBounds(bases_array, indices, "", insert_pt);
+
+  std::vector<Value *> args = make_vector<Value *>(
+      ConstantInt::get(Int32Type, id), descs_ptr,
+      ConstantInt::get(Int32Type, accesses.size()), bases_ptr,
+      ConstantInt::get(Int32Type, bases.size()), silent_mask, 0);
+  CallInst::Create(recordBatchEvent, args, "", insert_pt);
+}
+
+/// Clone an uninstrumented version (NAME.slimmer.fast) of each selected
+/// function, except main, the variadic functions and the ones whose blocks
+/// are address-taken. The calls between the fast versions are redirected to
+/// each other, hence a call from a fast version never checks the switch.
+///
+/// \param module - the module.
+///
+void SlimmerTrace::cloneFastVersions(Module &module) {
+  std::vector<Function *> funs;
+  for (Module::iterator fun_ptr = module.begin(), fun_end = module.end();
+       fun_ptr != fun_end; ++fun_ptr) {
+    if (fun_ptr->isDeclaration() || IsSlimmerFunction(fun_ptr) ||
+        fun_ptr == MainFunction || fun_ptr->isVarArg() ||
+        fun_ptr->hasFnAttribute(Attribute::Naked) || !isSelected(fun_ptr))
+      continue;
+    bool address_taken = false;
+    for (Function::iterator bb_ptr = fun_ptr->begin(), bb_end = fun_ptr->end();
+         bb_ptr != bb_end; ++bb_ptr)
+      address_taken |= bb_ptr->hasAddressTaken();
+    if (!address_taken)
+      funs.push_back(fun_ptr);
+  }
+
+  for (auto fun : funs) {
+    ValueToValueMapTy vmap;
+    Function *fast = CloneFunction(fun, vmap, false);
+    fast->setName(fun->getName() + ".slimmer.fast");
+    fast->setLinkage(GlobalValue::InternalLinkage);
+    module.getFunctionList().push_back(fast);
+    fastFuns[fun] = fast;
+    fastClones.insert(fast);
+  }
+
+  for (auto fast : fastClones) {
+    for (Function::iterator bb_ptr = fast->begin(), bb_end = fast->end();
+         bb_ptr != bb_end; ++bb_ptr)
+      for (BasicBlock::iterator ins_ptr = bb_ptr->begin(),
+                                ins_end = bb_ptr->end();
+           ins_ptr != ins_end; ++ins_ptr) {
+        CallSite call(&*ins_ptr);
+        if (!call)
+          continue;
+        Function *callee = call.getCalledFunction();
+        if (callee && fastFuns.count(callee))
+          call.setCalledFunction(fastFuns[callee]);
+      }
+  }
+}
+
+/// Add a dispatch block before the entry of a dual-version function, which
+/// calls its fast version if slimmer_tracing is 0. The static allocas of the
+/// entry are moved into the dispatch block, which is the new entry.
+///
+/// \param fun - the instrumented function.
+/// \param fast - its fast version.
+///
+void SlimmerTrace::instrumentDispatch(Function *fun, Function *fast) {
+  LLVMContext &context = fun->getContext();
+  BasicBlock *entry = &fun->getEntryBlock();
+  BasicBlock *dispatch =
+      BasicBlock::Create(context, "slimmer.dispatch", fun, entry);
+  BasicBlock *fast_bb = BasicBlock::Create(context, "slimmer.fast", fun, entry);
+
+  Value *on = new LoadInst(tracingFlag, "slimmer.on", dispatch);
+  Value *traced = new ICmpInst(*dispatch, ICmpInst::ICMP_NE, on,
+                               ConstantInt::get(Int32Type, 0));
+  Instruction *branch = BranchInst::Create(entry, fast_bb, traced, dispatch);
+  for (BasicBlock::iterator ins_ptr = entry->begin(), ins_end = entry->end();
+       ins_ptr != ins_end;) {
+    AllocaInst *alloca_ptr = dyn_cast<AllocaInst>(ins_ptr++);
+    if (alloca_ptr && isa<Constant>(alloca_ptr->getArraySize()))
+      alloca_ptr->moveBefore(branch);
+  }
+
+  std::vector<Value *> args;
+  for (Function::arg_iterator arg = fun->arg_begin(), arg_end = fun->arg_end();
+       arg != arg_end; ++arg)
+    args.push_back(arg);
+  CallInst *call = CallInst::Create(fast, args, "", fast_bb);
+  call->setCallingConv(fun->getCallingConv());
+  call->setAttributes(fun->getAttributes());
+  if (fun->getReturnType()->isVoidTy())
+    ReturnInst::Create(context, fast_bb);
+  else
+    ReturnInst::Create(context, call, fast_bb);
+}
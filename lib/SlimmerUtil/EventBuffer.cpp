@@ -25,11 +25,13 @@ void EventBuffer::Init(const char *name) {
   size = COMPRESS_BLOCK_SIZE;
   
   buffer = (char *)malloc(size);
-  compressed = (char *)malloc(LZ4_compressBound(size));
+  compressed = (char *)malloc(TraceCodec::Bound(size));
   assert(buffer && compressed && "Failed to malloc the event bufffer!\n");
 
   stream = fopen(name, "wb");
   assert(stream && "Failed to open tracing file!\n");
+  codec.Configure(codec_id, codec_level);
+  codec.WriteHeader(stream, codec_id);
 
   DEBUG("[SLIMMER] Opened trace file: %s\n", name);
 
@@ -51,14 +53,7 @@ void EventBuffer::CloseBufferFile() {
   // Create an end event to terminate the log.
   Append(&EndEventLabel, sizeof(EndEventLabel));
 
-  uint64_t after_compress = LZ4_compress_limitedOutput((const char *)buffer, (char *)compressed, offset, LZ4_compressBound(size));
-  fwrite(&after_compress, sizeof(after_compress), 1, stream);
-  size_t cur = 0;
-  while (cur < after_compress) {
-    size_t tmp = fwrite(compressed + cur, 1, after_compress - cur, stream);
-    if (tmp > 0) cur += tmp;
-  }
-  fwrite(&after_compress, sizeof(after_compress), 1, stream);
+  codec.WriteBlock(stream, codec_id, codec_level, buffer, offset, compressed);
   
   // size_t cur = 0;
   // while (cur < offset) {
@@ -79,14 +74,8 @@ void EventBuffer::CloseBufferFile() {
 __attribute__((always_inline))
 void EventBuffer::Append(const char *event, size_t length) {
   if (offset + length > size) {
-    uint64_t after_compress = LZ4_compress_limitedOutput((const char *)buffer, (char *)compressed, offset, LZ4_compressBound(size));
-    fwrite(&after_compress, sizeof(after_compress), 1, stream);
-    size_t cur = 0;
-    while (cur < after_compress) {
-      size_t tmp = fwrite(compressed + cur, 1, after_compress - cur, stream);
-      if (tmp > 0) cur += tmp;
-    }
-    fwrite(&after_compress, sizeof(after_compress), 1, stream);
+    codec.WriteBlock(stream, codec_id, codec_level, buffer, offset,
+                     compressed);
 
     // size_t cur = 0;
     // while (cur < offset) {
@@ -0,0 +1,177 @@
+#include "SlimmerUtil.h"
+
+#include <algorithm>
+#include <fstream>
+using namespace std;
+
+//===----------------------------------------------------------------------===//
+//                           Path Numbering
+//===----------------------------------------------------------------------===//
+
+/// Number the acyclic paths of a function.
+///
+/// \param entry - the entry basic block of the function.
+/// \param successor - the successors of each basic block, which may contain
+/// the blocks of the other functions and duplicated edges.
+/// \return - false if the function has more than SLIMMER_MAX_PATHS paths.
+///
+bool PathNumbering::Build(uint32_t entry,
+                          const map<uint32_t, vector<uint32_t> > &successor) {
+  Entry = entry;
+  NumPaths = 0;
+  EntryEdges.clear();
+  Out.clear();
+  EdgeVal.clear();
+  BackVal.clear();
+  HeaderVal.clear();
+  ReturnVal.clear();
+
+  // The successors without duplication, in the order of their first edges
+  map<uint32_t, vector<uint32_t> > succ;
+  auto get_succ = [&](uint32_t v) -> vector<uint32_t> & {
+    if (succ.count(v) == 0) {
+      vector<uint32_t> &s = succ[v];
+      auto it = successor.find(v);
+      if (it != successor.end())
+        for (auto w : it->second)
+          if (find(s.begin(), s.end(), w) == s.end())
+            s.push_back(w);
+    }
+    return succ[v];
+  };
+
+  // An iterative DFS, where an edge to a block on the stack is a back edge
+  map<uint32_t, uint8_t> state; // 1 for on the stack, 2 for finished
+  set<pair<uint32_t, uint32_t> > back;
+  vector<uint32_t> post_order;
+  vector<pair<uint32_t, size_t> > stack;
+  state[entry] = 1;
+  stack.push_back(make_pair(entry, 0));
+  while (!stack.empty()) {
+    uint32_t v = stack.back().first;
+    vector<uint32_t> &s = get_succ(v);
+    if (stack.back().second < s.size()) {
+      uint32_t w = s[stack.back().second++];
+      if (state[w] == 1) {
+        back.insert(make_pair(v, w));
+      } else if (state[w] == 0) {
+        state[w] = 1;
+        stack.push_back(make_pair(w, 0));
+      }
+    } else {
+      state[v] = 2;
+      post_order.push_back(v);
+      stack.pop_back();
+    }
+  }
+
+  // The post order is a reversed topological order of the DAG
+  map<uint32_t, uint64_t> num_paths;
+  for (auto v : post_order) {
+    vector<Edge> &out = Out[v];
+    uint64_t n = 0;
+    for (auto w : succ[v]) {
+      if (back.count(make_pair(v, w)))
+        continue;
+      out.push_back(Edge(w, n));
+      EdgeVal[make_pair(v, w)] = n;
+      n += num_paths[w];
+      if (n > SLIMMER_MAX_PATHS)
+        return false;
+    }
+    for (auto w : succ[v]) {
+      if (back.count(make_pair(v, w)) == 0)
+        continue;
+      out.push_back(Edge(-1, n));
+      BackVal[make_pair(v, w)] = n++;
+    }
+    if (succ[v].empty()) {
+      out.push_back(Edge(-1, n));
+      ReturnVal[v] = n++;
+    }
+    num_paths[v] = n;
+  }
+
+  EntryEdges.push_back(Edge(entry, 0));
+  NumPaths = num_paths[entry];
+  for (auto &i : back) {
+    uint32_t w = i.second;
+    if (HeaderVal.count(w))
+      continue;
+    EntryEdges.push_back(Edge(w, NumPaths));
+    HeaderVal[w] = NumPaths;
+    NumPaths += num_paths[w];
+    if (NumPaths > SLIMMER_MAX_PATHS)
+      return false;
+  }
+  return true;
+}
+
+/// Decode a path number into its basic blocks.
+///
+/// \param path - the path number.
+/// \param blocks - the basic blocks of the path.
+/// \param returned - whether the path ends with returning from the function,
+/// otherwise it ends with a back edge.
+/// \return - false if the path number is invalid.
+///
+bool PathNumbering::Decode(uint64_t path, vector<uint32_t> &blocks,
+                           bool &returned) const {
+  blocks.clear();
+  const vector<Edge> *out = &EntryEdges;
+  while (true) {
+    // The values of the edges of a block are increasing
+    const Edge *e = NULL;
+    for (auto &i : *out) {
+      if (i.Val > path)
+        break;
+      e = &i;
+    }
+    if (e == NULL)
+      return false;
+    path -= e->Val;
+    if (e->To < 0) {
+      returned = ReturnVal.count(blocks.back()) > 0;
+      return path == 0;
+    }
+    blocks.push_back(e->To);
+    auto it = Out.find(e->To);
+    if (it == Out.end())
+      return false;
+    out = &it->second;
+  }
+}
+
+/// Read the path-encoded functions.
+///
+/// \param path - the path to the PathFun file.
+/// \param bbgraph - the path to the BBGraph file.
+/// \param funs - map the entry basic block of each function to its numbering.
+///
+void LoadPathFun(string path, string bbgraph,
+                 map<uint32_t, PathNumbering> &funs) {
+  funs.clear();
+  ifstream file(path);
+  vector<pair<uint32_t, uint64_t> > entries; // <Entry, number of paths>
+  uint32_t entry;
+  uint64_t num_paths;
+  while (file >> entry >> num_paths)
+    entries.push_back(make_pair(entry, num_paths));
+  if (entries.empty())
+    return;
+
+  map<uint32_t, vector<uint32_t> > successor;
+  ifstream graph(bbgraph);
+  uint32_t a, b;
+  while (graph >> a >> b)
+    successor[a].push_back(b);
+
+  // The numbering must be the same as the one of SlimmerTrace
+  for (auto i : entries) {
+    if (!funs[i.first].Build(i.first, successor) ||
+        funs[i.first].NumPaths != i.second) {
+      ERROR("[SLIMMER] Cannot number the paths of basic block %u\n", i.first);
+      funs.erase(i.first);
+    }
+  }
+}
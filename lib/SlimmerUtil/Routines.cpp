@@ -11,43 +11,26 @@ CompressBuffer::CompressBuffer(const char *path) {
   size = COMPRESS_BLOCK_SIZE;
 
   buffer = (char *)malloc(size);
-  compressed = (char *)malloc(LZ4_compressBound(size));
+  compressed = (char *)malloc(TraceCodec::Bound(size));
   assert(buffer && compressed && "Failed to malloc the CompressBuffer!\n");
 
   stream = fopen(path, "wb");
   assert(stream && "Failed to open tracing file!\n");
+  codec.Configure(codec_id, codec_level);
+  codec.WriteHeader(stream, codec_id);
   offset = 0;
 }
 
 CompressBuffer::~CompressBuffer() {
-  uint64_t after_compress =
-      LZ4_compress_limitedOutput((const char *)buffer, (char *)compressed,
-                                 offset, LZ4_compressBound(size));
-  fwrite(&after_compress, sizeof(after_compress), 1, stream);
-  size_t cur = 0;
-  while (cur < after_compress) {
-    size_t tmp = fwrite(compressed + cur, 1, after_compress - cur, stream);
-    if (tmp > 0)
-      cur += tmp;
-  }
-  fwrite(&after_compress, sizeof(after_compress), 1, stream);
+  codec.WriteBlock(stream, codec_id, codec_level, buffer, offset, compressed);
   fclose(stream);
 }
 
 /// Prepare a buffer larger than len
 void CompressBuffer::Prepare(size_t len) {
   if (offset + len > size) {
-    uint64_t after_compress =
-        LZ4_compress_limitedOutput((const char *)buffer, (char *)compressed,
-                                   offset, LZ4_compressBound(size));
-    fwrite(&after_compress, sizeof(after_compress), 1, stream);
-    size_t cur = 0;
-    while (cur < after_compress) {
-      size_t tmp = fwrite(compressed + cur, 1, after_compress - cur, stream);
-      if (tmp > 0)
-        cur += tmp;
-    }
-    fwrite(&after_compress, sizeof(after_compress), 1, stream);
+    codec.WriteBlock(stream, codec_id, codec_level, buffer, offset,
+                     compressed);
     offset = 0;
   }
 }
@@ -77,6 +60,44 @@ void LoadInstrumentedFun(string path, set<string> &instrumented) {
   }
 }
 
+/// Read the basic blocks of each function, which is only written if the
+/// function events are enabled.
+///
+/// \param path - the path to the FunEntry file.
+/// \param bb2fun - map a basic block ID to the entry basic block of its
+/// function, empty if there is no function event.
+///
+void LoadFunEntry(string path, vector<uint32_t> &bb2fun) {
+  bb2fun.clear();
+  ifstream file(path);
+  uint32_t entry, cnt;
+  while (file >> entry >> cnt) {
+    if (bb2fun.size() < entry + cnt)
+      bb2fun.resize(entry + cnt, (uint32_t) - 1);
+    for (uint32_t i = entry; i < entry + cnt; ++i)
+      bb2fun[i] = entry;
+  }
+}
+
+/// Read the batched memory accesses.
+///
+/// \param path - the path to the Batch file.
+/// \param batches - the accesses of each batch, indexed by the batch ID.
+///
+void LoadBatch(string path, vector<vector<BatchAccess> > &batches) {
+  batches.clear();
+  ifstream file(path);
+  uint32_t id, cnt;
+  while (file >> id >> cnt) {
+    if (batches.size() <= id)
+      batches.resize(id + 1);
+    vector<BatchAccess> &accesses = batches[id];
+    accesses.resize(cnt);
+    for (auto &a : accesses)
+      file >> a.ID >> a.Base >> a.Offset >> a.Length >> a.Store;
+  }
+}
+
 /// Read the instruction infomation.
 ///
 /// \param path - the path to the Inst file.
@@ -250,6 +271,107 @@ int GetEvent(bool backward, const char *cur, char &event_label,
     addr2_ptr = (const uint64_t *)(cur + 21);
     length_ptr = (const uint64_t *)(cur + 29);
     return SizeOfMemmoveEvent;
+  case GapEventLabel:
+    if (backward)
+      cur -= SizeOfGapEvent - 1;
+    addr_ptr = (const uint64_t *)(cur + 1);
+    length_ptr = (const uint64_t *)(cur + 9);
+    return SizeOfGapEvent;
+  case ForkEventLabel:
+    if (backward)
+      cur -= SizeOfForkEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    addr2_ptr = (const uint64_t *)(cur + 21);
+    return SizeOfForkEvent;
+  case DepLoadEventLabel:
+    if (backward)
+      cur -= SizeOfDepLoadEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    length_ptr = (const uint64_t *)(cur + 21);
+    addr2_ptr = (const uint64_t *)(cur + 29); // The last writer
+    return SizeOfDepLoadEvent;
+  case DepEdgeEventLabel:
+    if (backward)
+      cur -= SizeOfDepEdgeEvent - 1;
+    addr_ptr = (const uint64_t *)(cur + 1);
+    return SizeOfDepEdgeEvent;
+  case StampEventLabel:
+    if (backward)
+      cur -= SizeOfStampEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    return SizeOfStampEvent;
+  case LoopEventLabel:
+    if (backward)
+      cur -= SizeOfLoopEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    length_ptr = (const uint64_t *)(cur + 13);
+    return SizeOfLoopEvent;
+  case StridedEventLabel:
+    if (backward)
+      cur -= SizeOfStridedEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    addr2_ptr = (const uint64_t *)(cur + 21);
+    length_ptr = (const uint64_t *)(cur + 29);
+    return SizeOfStridedEvent;
+  case SilentStoreEventLabel:
+    if (backward)
+      cur -= SizeOfSilentStoreEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    return SizeOfSilentStoreEvent;
+  case PathEventLabel:
+    if (backward)
+      cur -= SizeOfPathEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    return SizeOfPathEvent;
+  case FunctionEnterEventLabel:
+  case FunctionExitEventLabel:
+    if (backward)
+      cur -= SizeOfFunctionEvent - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    return SizeOfFunctionEvent;
+  case BatchEventLabel:
+    // The number of base addresses is kept at both ends
+    if (backward)
+      cur -= SizeOfBatchEvent + 8 * (*(const uint64_t *)(cur - 8)) - 1;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    length_ptr = (const uint64_t *)(cur + 13);
+    addr2_ptr = (const uint64_t *)(cur + 21);
+    addr_ptr = (const uint64_t *)(cur + 29);
+    return SizeOfBatchEvent + 8 * (*length_ptr);
+  case Memory1EventLabel:
+  case Memory2EventLabel:
+  case Memory4EventLabel:
+  case Memory8EventLabel:
+  case Memory16EventLabel: {
+    static const uint64_t lengths[] = {1, 2, 4, 8, 16};
+    if (backward)
+      cur -= SizeOfSizedMemoryEvent - 1;
+    length_ptr = &lengths[event_label - Memory1EventLabel];
+    event_label = MemoryEventLabel;
+    tid_ptr = (const uint64_t *)(cur + 1);
+    id_ptr = (const uint32_t *)(cur + 9);
+    addr_ptr = (const uint64_t *)(cur + 13);
+    return SizeOfSizedMemoryEvent;
+  }
+  default:
+    // An unknown label, e.g., of a corrupted trace, ends the trace.
+    event_label = EndEventLabel;
+    return 1;
   }
 }
 
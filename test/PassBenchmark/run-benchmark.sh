@@ -0,0 +1,53 @@
+#!/bin/bash
+# Time the SlimmerTrace pass on a large synthetic program.
+#
+# Usage: run-benchmark.sh [number of functions] [statements per function]
+#
+# The program is generated as bench.cpp, and the time spent by the pass is
+# printed by the [DEBUG::SlimmerTrace::Time] line of the linker's output.
+
+FUNS=${1:-20000}
+STMTS=${2:-50}
+
+awk -v funs=$FUNS -v stmts=$STMTS 'BEGIN {
+  print "#include <string.h>"
+  print "int g[1024];"
+  for (f = 0; f < funs; ++f) {
+    printf "int f%d(int *a, int n) {\n  int s = 0;\n", f
+    for (i = 0; i < stmts; ++i) {
+      if (i % 10 == 0)
+        printf "  for (int i = 0; i < n; ++i) a[i] += g[(i + %d) & 1023];\n", i
+      else if (i % 10 == 5)
+        printf "  if (s & %d) memset(a, 0, n * sizeof(int)); else s ^= a[%d];\n", i, i % 16
+      else
+        printf "  s += a[%d] * %d; g[%d] = s;\n", i % 16, i, (f + i) % 1024
+    }
+    if (f > 0)
+      printf "  return s + (n > 16 ? f%d(a, n - 1) : 0);\n}\n", f - 1
+    else
+      printf "  return s;\n}\n"
+  }
+  print "int main() {\n  int a[64] = {0};"
+  printf "  return f%d(a, 32) & 1;\n}\n", funs - 1
+}' > bench.cpp
+echo "Generated $FUNS functions of $STMTS statements, $(wc -l < bench.cpp) lines"
+
+$CXX -std=c++11 -flto -g -O0 bench.cpp -c -o bench.o
+/usr/bin/time -v $LD_NEW -z relro --hash-style=gnu --build-id --eh-frame-hdr -m elf_x86_64 -dynamic-linker /lib64/ld-linux-x86-64.so.2 \
+  -o bench \
+  /usr/lib/gcc/x86_64-linux-gnu/4.8/../../../x86_64-linux-gnu/crt1.o \
+  /usr/lib/gcc/x86_64-linux-gnu/4.8/../../../x86_64-linux-gnu/crti.o  \
+  /usr/lib/gcc/x86_64-linux-gnu/4.8/crtbegin.o \
+  -L/usr/lib/gcc/x86_64-linux-gnu/4.8 -L/usr/lib/gcc/x86_64-linux-gnu/4.8/../../../x86_64-linux-gnu \
+  -L/usr/lib/gcc/x86_64-linux-gnu/4.8/../../../../lib64 -L/lib/x86_64-linux-gnu \
+  -L/lib/../lib64 -L/usr/lib/x86_64-linux-gnu -L/usr/lib/../lib64 \
+  -L/usr/lib/x86_64-linux-gnu/../../lib64 -L/usr/lib/gcc/x86_64-linux-gnu/4.8/../../.. -L/lib -L/usr/lib \
+  -plugin ../../build/Release+Asserts/lib/SlimmerGold.so -plugin-opt=mcpu=x86-64 \
+  bench.o \
+  -lstdc++ -lm -lgcc_s -lgcc -lc -lgcc_s -lgcc \
+  /usr/lib/gcc/x86_64-linux-gnu/4.8/crtend.o \
+  /usr/lib/gcc/x86_64-linux-gnu/4.8/../../../x86_64-linux-gnu/crtn.o \
+  -plugin-opt=--slimmer-info-dir=Slimmer \
+  -L../../build/Release+Asserts/lib \
+  -lSlimmerRuntime -lSlimmerUtil -lpthread -lstdc++ -llz4 2>&1 |
+  grep -E "SlimmerTrace::Time|Elapsed|Maximum resident"
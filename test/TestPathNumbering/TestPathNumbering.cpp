@@ -0,0 +1,49 @@
+#include "SlimmerUtil.h"
+
+using namespace std;
+
+void Print(PathNumbering &paths, uint64_t path) {
+  vector<uint32_t> blocks;
+  bool returned;
+  if (!paths.Decode(path, blocks, returned)) {
+    printf("%lu: invalid\n", path);
+    return;
+  }
+  printf("%lu:", path);
+  for (auto i : blocks)
+    printf(" %u", i);
+  printf(" (%s)\n", returned ? "return" : "back edge");
+}
+
+int main() {
+  // 0 -> 1 -> 2 -> 4 -> 1 (back edge)
+  //        -> 3 -> 4 -> 5
+  //   -> 5 (twice, e.g., a switch)
+  map<uint32_t, vector<uint32_t> > successor;
+  successor[0] = {1, 5, 5};
+  successor[1] = {2, 3};
+  successor[2] = {4};
+  successor[3] = {4};
+  successor[4] = {1, 5};
+  successor[9] = {0}; // Another function
+
+  PathNumbering paths;
+  paths.Build(0, successor);
+  printf("%lu paths\n", paths.NumPaths); // 9
+  for (uint64_t i = 0; i <= paths.NumPaths; ++i)
+    Print(paths, i);
+  // 0: 0 1 2 4 5 (return)
+  // 1: 0 1 2 4 (back edge)
+  // 2: 0 1 3 4 5 (return)
+  // 3: 0 1 3 4 (back edge)
+  // 4: 0 5 (return)
+  // 5: 1 2 4 5 (return)
+  // 6: 1 2 4 (back edge)
+  // 7: 1 3 4 5 (return)
+  // 8: 1 3 4 (back edge)
+  // 9: invalid
+
+  // The values of an iteration that returns through 3
+  printf("%lu\n", paths.HeaderVal[1] + paths.EdgeVal[make_pair(1, 3)] +
+                      paths.EdgeVal[make_pair(4, 5)] + paths.ReturnVal[5]); // 7
+}
@@ -0,0 +1,52 @@
+#include "ShadowMemory.hpp"
+#include <stdio.h>
+
+using namespace std;
+
+void Print(ShadowMemory<uint32_t> &shadow, uint64_t l, uint64_t r) {
+  vector<uint32_t> cur;
+  shadow.Collect(l, r, cur);
+  printf("[%lu,%lu):", l, r);
+  for (auto i : cur)
+    printf(" %u", i);
+  printf("\n");
+}
+
+int main() {
+  ShadowMemory<uint32_t> shadow;
+
+  // Test granules and split granules
+  shadow.Set(16, 32, 1);
+  shadow.Set(20, 22, 2);
+  shadow.Set(30, 41, 3);
+  printf("=========\n");
+  Print(shadow, 0, 64);        // 1 2 1 3
+  Print(shadow, 20, 22);       // 2
+  printf("%u %u %u %u\n", shadow.Get(19), shadow.Get(21), shadow.Get(40),
+         shadow.Get(41)); // 1 2 3 0
+
+  // Test merging a split granule
+  shadow.Set(16, 24, 4);
+  printf("=========\n");
+  Print(shadow, 16, 24);       // 4
+
+  // Test whole pages
+  uint64_t page = ShadowMemory<uint32_t>::PageBytes;
+  shadow.Set(page - 8, 4 * page + 8, 5);
+  shadow.Set(2 * page + 100, 2 * page + 104, 6);
+  printf("=========\n");
+  Print(shadow, page - 16, 4 * page + 16);  // 5 6 5
+  printf("%lu pages\n", shadow.NumPages()); // 3
+
+  // Test addresses above 2^48
+  shadow.Set(1lu << 60, (1lu << 60) + 3, 7);
+  printf("=========\n");
+  Print(shadow, (1lu << 60) - 8, (1lu << 60) + 8); // 7
+
+  // Test renumbering the values
+  shadow.Remap([](uint32_t v) { return v * 10; });
+  printf("=========\n");
+  Print(shadow, 0, 64);                             // 40 10 30
+  Print(shadow, page - 16, 4 * page + 16);          // 50 60 50
+  Print(shadow, (1lu << 60) - 8, (1lu << 60) + 8); // 70
+}
@@ -85,71 +85,118 @@ void getSymbols(string img_name, uint64_t start) {
   fclose(fres);
 }
 
-// Maintain the depth of call stack for each thread.
-// Only uninstrumented functions are counted.
-map<uint64_t, int> pdepth;
-// This is the very event buffer used by all record functions
+// This is the very event buffer used by all threads, which only receives
+// the filled buffers of the threads.
 // Call EventBuffer::Init(...) before usage
 EventBuffer pin_event_buffer;
-char syscall_event[66];
-char call_event[130];
-char return_event[130];
 
-/// Append a CallEvent before the first layer of external functions.
+#define PIN_THREAD_BUFFER (64lu << 10)
+
+/// The state of a thread, which is kept in the PIN TLS.
+struct PinThread {
+  uint64_t TID; // The thread ID of the OS
+  // The depth of call stack.
+  // Only uninstrumented functions are counted.
+  int Depth;
+  size_t Offset;
+  char Buffer[PIN_THREAD_BUFFER];
+};
+TLS_KEY thread_key;
+// All the living threads, for flushing their buffers at exit
+set<PinThread *> threads;
+
+/// Move the events of a thread to the shared buffer.
+/// The caller should hold the lock of pin_event_buffer.
 ///
-/// \param addr - the starting address of the function.
+static void FlushThread(PinThread *t) {
+  if (t->Offset)
+    pin_event_buffer.Append(t->Buffer, t->Offset);
+  t->Offset = 0;
+}
+
+/// Reserve space for an event in the buffer of a thread.
+///
+/// \param t - the thread.
+/// \param length - the length of the event.
+/// \return - the starting address of the event.
 ///
-VOID BeforeCall(ADDRINT fun) {
-  uint64_t tid = PIN_GetTid();
+static inline char *Reserve(PinThread *t, size_t length) {
+  if (t->Offset + length > PIN_THREAD_BUFFER) {
+    pin_event_buffer.Lock();
+    FlushThread(t);
+    pin_event_buffer.Unlock();
+  }
+  char *event = t->Buffer + t->Offset;
+  t->Offset += length;
+  return event;
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
+  PinThread *t = new PinThread;
+  t->TID = PIN_GetTid();
+  t->Depth = 0;
+  t->Offset = 0;
+  PIN_SetThreadData(thread_key, t, tid);
 
   pin_event_buffer.Lock();
-  if ((++pdepth[tid]) == 1) {
-    PINDEBUG("BeforeCall %lu %p %s\n", tid, (void *)fun, Symbols[fun].c_str());
+  threads.insert(t);
+  pin_event_buffer.Unlock();
+}
 
-    call_event[0] = call_event[129] = CallEventLabel;
-    (*(uint64_t *)(call_event + 1)) = tid;
-    (*(uint64_t *)(call_event + 65)) = (uint64_t)fun;
-    pin_event_buffer.Append(call_event, 130);
-  }
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v) {
+  PinThread *t = (PinThread *)PIN_GetThreadData(thread_key, tid);
+  pin_event_buffer.Lock();
+  FlushThread(t);
+  threads.erase(t);
   pin_event_buffer.Unlock();
+  delete t;
 }
 
-/// Append a ReturnEvent after the first layer of external functions.
+/// Append a CallEvent before the first layer of external functions.
 ///
 /// \param addr - the starting address of the function.
 ///
-VOID AfterCall(ADDRINT fun) {
-  uint64_t tid = PIN_GetTid();
+VOID BeforeCall(THREADID tid, ADDRINT fun) {
+  PinThread *t = (PinThread *)PIN_GetThreadData(thread_key, tid);
+  if ((++t->Depth) == 1) {
+    PINDEBUG("BeforeCall %lu %p %s\n", t->TID, (void *)fun,
+             Symbols[fun].c_str());
 
-  pin_event_buffer.Lock();
-  if ((--pdepth[tid]) == 0) {
-    PINDEBUG("AfterCall %lu %p %s\n", tid, (void *)fun, Symbols[fun].c_str());
-
-    return_event[0] = return_event[129] = ReturnEventLabel;
-    (*(uint64_t *)(return_event + 1)) = tid;
-    (*(uint64_t *)(return_event + 65)) = (uint64_t)fun;
-    pin_event_buffer.Append(return_event, 130);
+    char *event = Reserve(t, SizeOfPinCallEvent);
+    event[0] = PinCallEventLabel;
+    (*(uint64_t *)(event + 1)) = t->TID;
+    (*(uint64_t *)(event + 9)) = (uint64_t)fun;
   }
-  pin_event_buffer.Unlock();
 }
 
-/// Append a SyscallEvent for each output syscall.
+/// Append a ReturnEvent after the first layer of external functions.
 ///
-VOID SyscallEntry(THREADID t, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v) {
-  uint64_t tid = PIN_GetTid();
+/// \param addr - the starting address of the function.
+///
+VOID AfterCall(THREADID tid, ADDRINT fun) {
+  PinThread *t = (PinThread *)PIN_GetThreadData(thread_key, tid);
+  if ((--t->Depth) == 0) {
+    PINDEBUG("AfterCall %lu %p %s\n", t->TID, (void *)fun,
+             Symbols[fun].c_str());
 
-  pin_event_buffer.Lock();
-  if (pdepth[tid] == 0) {
-    pin_event_buffer.Unlock();
-    return;
+    char *event = Reserve(t, SizeOfPinCallEvent);
+    event[0] = PinReturnEventLabel;
+    (*(uint64_t *)(event + 1)) = t->TID;
+    (*(uint64_t *)(event + 9)) = (uint64_t)fun;
   }
+}
 
-  PINDEBUG("SysCall: %lu\n", tid);
-  syscall_event[0] = syscall_event[65] = SyscallEventLabel;
-  (*(uint64_t *)(syscall_event + 1)) = tid;
-  pin_event_buffer.Append(syscall_event, 66);
+/// Append a SyscallEvent for each output syscall.
+///
+VOID SyscallEntry(THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v) {
+  PinThread *t = (PinThread *)PIN_GetThreadData(thread_key, tid);
+  if (t->Depth == 0)
+    return;
 
-  pin_event_buffer.Unlock();
+  PINDEBUG("SysCall: %lu\n", t->TID);
+  char *event = Reserve(t, SizeOfPinSyscallEvent);
+  event[0] = PinSyscallEventLabel;
+  (*(uint64_t *)(event + 1)) = t->TID;
 }
 
 /// Instrument all the calling instructions that call an external function.
@@ -174,9 +221,9 @@ VOID ImageLoad(IMG img, VOID *v) {
             INS next = INS_Next(ins);
             if (INS_Valid(next)) {
               INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BeforeCall,
-                             IARG_ADDRINT, target, IARG_END);
+                             IARG_THREAD_ID, IARG_ADDRINT, target, IARG_END);
               INS_InsertCall(next, IPOINT_BEFORE, (AFUNPTR)AfterCall,
-                             IARG_ADDRINT, target, IARG_END);
+                             IARG_THREAD_ID, IARG_ADDRINT, target, IARG_END);
             }
           }
         }
@@ -187,9 +234,20 @@ VOID ImageLoad(IMG img, VOID *v) {
   }
 }
 
-/// Flush the trace buffer.
+/// Flush the buffers of the living threads and the trace buffer.
 ///
-VOID Fini(INT32 code, VOID *p) { printf("[PIN] Fini\n"); pin_event_buffer.CloseBufferFile(); }
+static void FlushAll() {
+  pin_event_buffer.Lock();
+  for (auto t : threads)
+    FlushThread(t);
+  pin_event_buffer.Unlock();
+  pin_event_buffer.CloseBufferFile();
+}
+
+VOID Fini(INT32 code, VOID *p) {
+  printf("[PIN] Fini\n");
+  FlushAll();
+}
 
 static void cleanup_only_tracing(int signum) {
   printf("[PIN] cleanup_only_tracing\n");
@@ -197,7 +255,7 @@ static void cleanup_only_tracing(int signum) {
 }
 static void finish() {
   printf("[PIN] finish\n");
-  pin_event_buffer.CloseBufferFile();
+  FlushAll();
 }
 
 int main(int argc, char *argv[]) {
@@ -207,6 +265,9 @@ int main(int argc, char *argv[]) {
   LoadInstrumentedFun(KnobInstrumentedFun.Value(), instrumentedFun);
 
   pin_event_buffer.Init(KnobTraceFile.Value().c_str());
+  thread_key = PIN_CreateThreadDataKey(NULL);
+  PIN_AddThreadStartFunction(ThreadStart, 0);
+  PIN_AddThreadFiniFunction(ThreadFini, 0);
   IMG_AddInstrumentFunction(ImageLoad, 0);
   PIN_AddSyscallEntryFunction(SyscallEntry, 0);
   PIN_AddFiniFunction(Fini, 0);
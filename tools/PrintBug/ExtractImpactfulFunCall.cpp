@@ -2,6 +2,9 @@
 
 /// Extract the function calls that impact the outside enviroment.
 ///
+/// Both the compact events of the PIN tool and the old padded ones (of 130
+/// and 66 bytes) are read.
+///
 /// \param pin_trace_file_name - path to trace file generated by PIN tool.
 /// \param impactful_fun_call - recording the function calls that impact the
 /// outside enviroment.
@@ -20,32 +23,56 @@ void ExtractImpactfulFunCall(char *pin_trace_file_name,
 
   bool ended = false;
   char *buffer = (char *)malloc(COMPRESS_BLOCK_SIZE);
+  TraceCodec codec;
 
-  for (size_t _ = 0; !ended && _ < trace.size();) {
-    uint64_t length = (*(uint64_t *)(&data[_]));
+  for (size_t _ = codec.ReadHeader(data, trace.size());
+       !ended && _ < trace.size();) {
+    uint64_t word = (*(uint64_t *)(&data[_]));
+    uint64_t length = TraceCodec::Length(word);
     _ += sizeof(uint64_t);
 
-    uint64_t decoded = LZ4_decompress_safe((const char *)&data[_], buffer,
-                                           length, COMPRESS_BLOCK_SIZE);
-    for (uint64_t cur = 0; !ended && cur < decoded;) {
+    int64_t decoded =
+        codec.Decompress(word, &data[_], buffer, COMPRESS_BLOCK_SIZE);
+    if (decoded < 0) {
+      ERROR("[SLIMMER] The PIN trace is corrupted at byte %lu.\n", _);
+      break;
+    }
+    for (uint64_t cur = 0; !ended && cur < (uint64_t)decoded;) {
       event_label = buffer[cur];
+      StatsTick();
       switch (event_label) {
       case EndEventLabel:
         ++cur;
         ended = true;
         break;
+      default:
+        ERROR("[SLIMMER] Unknown event %d in the PIN trace.\n", event_label);
+        ended = true;
+        break;
       case CallEventLabel:
+      case PinCallEventLabel:
         tid_ptr = (uint64_t *)(&buffer[cur + 1]);
-        fun_ptr = (uint64_t *)(&buffer[cur + 65]);
-        cur += 130;
+        if (event_label == CallEventLabel) {
+          fun_ptr = (uint64_t *)(&buffer[cur + 65]);
+          cur += SizeOfOldPinCallEvent;
+        } else {
+          fun_ptr = (uint64_t *)(&buffer[cur + 9]);
+          cur += SizeOfPinCallEvent;
+        }
         // printf("CallEvent %lu %p\n", *tid_ptr, (void*)*fun_ptr);
         fun_stack[*tid_ptr]
             .push(I(*fun_ptr, FunCount[I(*tid_ptr, *fun_ptr)]++));
         break;
       case ReturnEventLabel:
+      case PinReturnEventLabel:
         tid_ptr = (uint64_t *)(&buffer[cur + 1]);
-        fun_ptr = (uint64_t *)(&buffer[cur + 65]);
-        cur += 130;
+        if (event_label == ReturnEventLabel) {
+          fun_ptr = (uint64_t *)(&buffer[cur + 65]);
+          cur += SizeOfOldPinCallEvent;
+        } else {
+          fun_ptr = (uint64_t *)(&buffer[cur + 9]);
+          cur += SizeOfPinCallEvent;
+        }
         // printf("ReturnEvent %lu %p\n", *tid_ptr, (void*)*fun_ptr);
         while (!fun_stack[*tid_ptr].empty() &&
                fun_stack[*tid_ptr].top().first != (*fun_ptr))
@@ -54,9 +81,11 @@ void ExtractImpactfulFunCall(char *pin_trace_file_name,
           fun_stack[*tid_ptr].pop();
         break;
       case SyscallEventLabel:
+      case PinSyscallEventLabel:
         tid_ptr = (uint64_t *)(&buffer[cur + 1]);
         // printf("SyscallEvent %lu\n", *tid_ptr);
-        cur += 66;
+        cur += event_label == SyscallEventLabel ? SizeOfOldPinSyscallEvent
+                                                : SizeOfPinSyscallEvent;
 
         if (fun_stack[*tid_ptr].size() == 0)
           break;
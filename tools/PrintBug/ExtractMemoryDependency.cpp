@@ -10,32 +10,117 @@ void ExtractMemoryDependency(vector<SmallestBlock> &block_trace,
                              map<DynamicInst, vector<DynamicInst> > &mem_dep) {
   map<DynamicInst, set<DynamicInst> > _mem_dep;
 
-  SegmentTree<DynamicInst> *last_store = SegmentTree<DynamicInst>::NewTree();
+  // The last writer of each byte, as an index of writers.
+  ShadowMemory<uint32_t> last_store;
+  // 0 is reserved for "never written"
+  vector<DynamicInst> writers(1, DynamicInst(0, -1, -1));
+  vector<uint32_t> collected;
   map<pair<uint64_t, uint32_t>, uint32_t> ins_count;
 
+  // The writers are renumbered when there are compact_at of them, dropping
+  // the ones that are no longer the last writer of any byte.
+  const uint64_t max_writers = ShadowMemory<uint32_t>::SplitBit;
+  uint64_t compact_at = min(1lu << 24, max_writers);
+  uint64_t compactions = 0;
+  auto compact = [&]() {
+    vector<uint32_t> renumber(writers.size(), 0);
+    last_store.Remap([&](uint32_t v) {
+      renumber[v] = 1;
+      return v;
+    });
+    vector<DynamicInst> live(1, writers[0]);
+    for (size_t i = 1; i < writers.size(); ++i)
+      if (renumber[i]) {
+        renumber[i] = live.size();
+        live.push_back(writers[i]);
+      }
+    last_store.Remap([&](uint32_t v) { return renumber[v]; });
+    writers.swap(live);
+    compactions++;
+    if (writers.size() >= max_writers) {
+      ERROR("[SLIMMER] More than %lu live writers in the shadow memory.\n",
+            max_writers - 1);
+      exit(1);
+    }
+    compact_at = min(max(compact_at, 2 * writers.size()), max_writers);
+  };
+
+  // Record dyn_inst as the last writer of [l, r).
+  auto set_store = [&](uint64_t l, uint64_t r, const DynamicInst &dyn_inst) {
+    if (!(writers.back() == dyn_inst)) {
+      if (writers.size() >= compact_at)
+        compact();
+      writers.push_back(dyn_inst);
+    }
+    last_store.Set(l, r, writers.size() - 1);
+  };
+  // In the online dependency mode, the writer of each write number of each
+  // process, which is kept at Addr[n] of the writing block.
+  map<uint32_t, vector<DynamicInst> > seq_writers;
+  auto record_seq = [&](SmallestBlock &b, size_t n,
+                        const DynamicInst &dyn_inst) {
+    if (!OnlineDependency || b.Addr.size() <= n)
+      return;
+    vector<DynamicInst> &by_seq = seq_writers[b.Proc];
+    if (b.Addr[n] >= by_seq.size())
+      by_seq.resize(b.Addr[n] + 1, DynamicInst(0, -1, -1));
+    by_seq[b.Addr[n]] = dyn_inst;
+  };
+  // Add the last writers of [l, r) to the dependencies of dyn_inst,
+  // only the external calls if external_only.
+  auto collect_stores = [&](uint64_t l, uint64_t r,
+                            const DynamicInst &dyn_inst, bool external_only) {
+    collected.clear();
+    last_store.Collect(l, r, collected);
+    if (collected.empty())
+      return;
+    set<DynamicInst> &dep = _mem_dep[dyn_inst];
+    for (auto j : collected)
+      if (!external_only ||
+          Ins[writers[j].ID].Type == InstInfo::ExternalCallInst)
+        dep.insert(writers[j]);
+  };
+  // Whether an external call has written the memory, in the online
+  // dependency mode.
+  bool external_writes = false;
+
   for (auto &b : block_trace) {
+    StatsTick();
     if (b.Type == SmallestBlock::MemoryAccessBlock) {
       uint32_t ins_id = BB2Ins[b.BBID][b.Start];
       DynamicInst dyn_inst =
           DynamicInst(b.TID, ins_id, ins_count[I(b.TID, ins_id)]++);
 
+      // A load with too many writers is left unresolved by the runtime, i.e.,
+      // a MemoryEvent, which is searched as in the offline mode.
+      if (OnlineDependency && Ins[ins_id].Type == InstInfo::LoadInst &&
+          b.Addr.size() > 2) {
+        // The instrumented writers are already resolved by the runtime.
+        // The skipped writes (e.g., in a forked child) are unknown.
+        vector<DynamicInst> &by_seq = seq_writers[b.Proc];
+        for (size_t i = 2; i < b.Addr.size(); ++i)
+          if (b.Addr[i] < by_seq.size() && by_seq[b.Addr[i]].ID != -1)
+            _mem_dep[dyn_inst].insert(by_seq[b.Addr[i]]);
+        // The groups written by the external calls are only known here.
+        if (external_writes && b.Addr[0] < b.Addr[1])
+          collect_stores(b.Addr[0], b.Addr[1], dyn_inst, true);
+        continue;
+      }
+
       if (b.Addr[0] >= b.Addr[1])
         continue; // Inefficacious write
 
       if (Ins[ins_id].Type == InstInfo::StoreInst) {
         // Recording a store
-        last_store->Set(b.Addr[0], b.Addr[1], dyn_inst);
+        set_store(b.Addr[0], b.Addr[1], dyn_inst);
+        record_seq(b, 2, dyn_inst);
       } else if (Ins[ins_id].Type == InstInfo::LoadInst) {
         // Obtaining all the last writes
-        for (auto j : last_store->Collect(b.Addr[0], b.Addr[1])) {
-          if (j.type == COVERED_SEGMENT) {
-            _mem_dep[dyn_inst].insert(j.value);
-          }
-        }
+        collect_stores(b.Addr[0], b.Addr[1], dyn_inst, false);
 
         if (Ins[ins_id].Type == InstInfo::AtomicInst) {
           // Recording a store from atomic operation
-          last_store->Set(b.Addr[0], b.Addr[1], dyn_inst);
+          set_store(b.Addr[0], b.Addr[1], dyn_inst);
         }
       }
     } else if (b.Type == SmallestBlock::MemsetBlock) {
@@ -47,7 +132,8 @@ void ExtractMemoryDependency(vector<SmallestBlock> &block_trace,
         continue; // Inefficacious write
 
       // Recording a store
-      last_store->Set(b.Addr[0], b.Addr[1], dyn_inst);
+      set_store(b.Addr[0], b.Addr[1], dyn_inst);
+      record_seq(b, 2, dyn_inst);
     } else if (b.Type == SmallestBlock::MemmoveBlock) {
       uint32_t ins_id = BB2Ins[b.BBID][b.Start];
       DynamicInst dyn_inst =
@@ -57,14 +143,11 @@ void ExtractMemoryDependency(vector<SmallestBlock> &block_trace,
         continue; // Inefficacious write
 
       // Obtaining all the last writes
-      for (auto j : last_store->Collect(b.Addr[2], b.Addr[3])) {
-        if (j.type == COVERED_SEGMENT) {
-          _mem_dep[dyn_inst].insert(j.value);
-        }
-      }
+      collect_stores(b.Addr[2], b.Addr[3], dyn_inst, false);
 
       // Recording a store
-      last_store->Set(b.Addr[0], b.Addr[1], dyn_inst);
+      set_store(b.Addr[0], b.Addr[1], dyn_inst);
+      record_seq(b, 4, dyn_inst);
     } else if (b.Type == SmallestBlock::ExternalCallBlock ||
                b.Type == SmallestBlock::ImpactfulCallBlock) {
       uint32_t ins_id = BB2Ins[b.BBID][b.Start];
@@ -79,12 +162,9 @@ void ExtractMemoryDependency(vector<SmallestBlock> &block_trace,
         for (auto i :
              Group2Addr[group_id]->Collect(0, SegmentTree<int>::MAX_RANGE)) {
           if (i.type == COVERED_SEGMENT) {
-            for (auto j : last_store->Collect(i.left, i.right)) {
-              if (j.type == COVERED_SEGMENT) {
-                _mem_dep[dyn_inst].insert(j.value);
-              }
-            }
-            last_store->Set(i.left, i.right, dyn_inst);
+            collect_stores(i.left, i.right, dyn_inst, false);
+            set_store(i.left, i.right, dyn_inst);
+            external_writes = true;
           }
         }
       }
@@ -100,5 +180,7 @@ void ExtractMemoryDependency(vector<SmallestBlock> &block_trace,
       mem_dep[tmp_a].push_back(tmp_b);
     }
   }
-  delete last_store;
+  StatsSize("shadow_pages", last_store.NumPages());
+  StatsSize("writers", writers.size() - 1);
+  StatsSize("writer_compactions", compactions);
 }
@@ -217,6 +217,7 @@ void GroupMemory(vector<SmallestBlock> &block_trace) {
   for (int i = block_trace.size() - 1; i >= 0; --i) {
     SmallestBlock b = block_trace[i];
     // b.Print(Ins, BB2Ins);
+    StatsTick();
     shoud_merge.clear();
 
     if (b.Type == SmallestBlock::MemoryAccessBlock ||
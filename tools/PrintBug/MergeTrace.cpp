@@ -11,23 +11,212 @@ struct StackInfo {
   // The index of the next instruction
   // i.e., the next instruction is BB2Ins[BBID][CurIndex]
   uint32_t CurIndex;
+  // The entry basic block of the function, only with the function events
+  uint32_t Fun;
   StackInfo() {}
-  StackInfo(int32_t bb_id, int32_t last_bb_id, int64_t cur_index)
-      : BBID(bb_id), LastBBID(last_bb_id), CurIndex(cur_index) {}
+  StackInfo(int32_t bb_id, int32_t last_bb_id, int64_t cur_index,
+            uint32_t fun = (uint32_t) - 1)
+      : BBID(bb_id), LastBBID(last_bb_id), CurIndex(cur_index), Fun(fun) {}
 };
 
+/// The accesses of a summarized loop, in the order of the loop body.
+struct StridedAccess {
+  uint32_t ID;
+  uint64_t Base, Stride, Size;
+};
+
+/// Replay the iterations of a summarized loop as the BasicBlockEvent and the
+/// MemoryEvents of each iteration.
+struct LoopReplay {
+  uint64_t TID, Count, K; // K is the current iteration
+  uint32_t BBID;
+  size_t P; // 0 for the BasicBlockEvent, i for the (i-1)-th access
+  vector<StridedAccess> Accesses;
+  set<pair<uint32_t, uint64_t> > Silent; // <Instruction, iteration>
+
+  // The fields of the replayed event
+  uint32_t ID;
+  uint64_t Addr, Length;
+
+  LoopReplay() : Count(0), K(0), P(0) {}
+
+  /// Produce the next replayed event.
+  ///
+  /// \return - return false if the loop is replayed.
+  ///
+  bool Next(char &event_label) {
+    if (K >= Count)
+      return false;
+    if (P == 0) {
+      event_label = BasicBlockEventLabel;
+      ID = BBID;
+    } else {
+      StridedAccess &a = Accesses[P - 1];
+      event_label = MemoryEventLabel;
+      ID = a.ID;
+      Addr = a.Base + K * a.Stride;
+      Length = Silent.count(make_pair(a.ID, K)) ? 0 : a.Size;
+    }
+    if (++P > Accesses.size()) {
+      P = 0;
+      K++;
+    }
+    return true;
+  }
+};
+
+/// Replay a BatchEvent as the MemoryEvents of its accesses.
+struct BatchReplay {
+  uint64_t TID, Silent;
+  vector<uint64_t> Bases;
+  const vector<BatchAccess> *Accesses;
+  size_t P; // The next access
+
+  // The fields of the replayed event
+  uint32_t ID;
+  uint64_t Addr, Length;
+
+  BatchReplay() : Accesses(NULL), P(0) {}
+
+  /// Produce the next replayed event.
+  ///
+  /// \return - return false if the batch is replayed.
+  ///
+  bool Next(char &event_label) {
+    if (Accesses == NULL || P >= Accesses->size())
+      return false;
+    const BatchAccess &a = (*Accesses)[P];
+    event_label = MemoryEventLabel;
+    ID = a.ID;
+    Addr = Bases[a.Base] + a.Offset;
+    Length = (Silent >> P) & 1 ? 0 : a.Length;
+    P++;
+    return true;
+  }
+};
+
+/// An event of a path-encoded function that is waiting for its PathEvent.
+struct BufferedEvent {
+  char Label;
+  uint32_t ID;
+  uint64_t Addr, Addr2, Length;
+  uint64_t Seq;             // The number of a write, see MergeTrace
+  vector<uint64_t> Writers; // The DepEdgeEvents before a DepLoadEvent
+};
+
+/// Replay an acyclic path of a path-encoded function, i.e., the
+/// BasicBlockEvent of each basic block of the path followed by the buffered
+/// events of that block.
+struct PathReplay {
+  uint64_t TID;
+  vector<uint32_t> Blocks;
+  vector<BufferedEvent> Events;
+  size_t B, E; // The next basic block and the next event
+
+  // The fields of the replayed event
+  uint32_t ID;
+  uint64_t Addr, Addr2, Length;
+  const BufferedEvent *Cur; // NULL for a BasicBlockEvent
+
+  PathReplay() : B(0), E(0), Cur(NULL) {}
+
+  /// Check whether the events belong to the blocks in the order of the path.
+  /// Since a path visits a block at most once, it is sufficient for
+  /// interleaving them.
+  ///
+  bool Match() {
+    size_t b = 0;
+    for (auto &e : Events) {
+      while (b < Blocks.size() && Blocks[b] != Ins[e.ID].BB)
+        ++b;
+      if (b == Blocks.size())
+        return false;
+    }
+    return true;
+  }
+
+  /// Produce the next replayed event.
+  ///
+  /// \return - return false if the path is replayed.
+  ///
+  bool Next(char &event_label) {
+    if (B > 0 && E < Events.size() && Ins[Events[E].ID].BB == Blocks[B - 1]) {
+      Cur = &Events[E++];
+      event_label = Cur->Label;
+      ID = Cur->ID;
+      Addr = Cur->Addr;
+      Addr2 = Cur->Addr2;
+      Length = Cur->Length;
+      return true;
+    }
+    if (B < Blocks.size()) {
+      Cur = NULL;
+      event_label = BasicBlockEventLabel;
+      ID = Blocks[B++];
+      return true;
+    }
+    return false;
+  }
+};
+
+/// Pop the top function of a thread's call stack, whose last SmallestBlock
+/// is not generated, e.g., it is left by a longjmp.
+///
+/// \param tid - the thread ID.
+/// \param stack - the call stack of the thread.
+/// \param block_trace - for recording the generated SmallestBlocks.
+///
+void PopCallStack(uint64_t tid, vector<StackInfo> &stack,
+                  vector<SmallestBlock> &block_trace) {
+  StackInfo &info = stack.back();
+  SmallestBlock b(SmallestBlock::NormalBlock, tid, info.BBID, info.CurIndex,
+                  info.CurIndex, make_pair(0, 0), info.LastBBID);
+  stack.pop_back();
+
+  if (stack.empty()) {
+    b.IsLast = 2; // The last SmallestBlock of a thread.
+  } else {
+    b.IsLast = 1;
+    StackInfo last_info = stack.back();
+    assert(last_info.CurIndex < BB2Ins[last_info.BBID].size());
+    if (Ins[BB2Ins[last_info.BBID][last_info.CurIndex - 1]].Type ==
+        InstInfo::CallInst)
+      b.Caller = BB2Ins[last_info.BBID][last_info.CurIndex - 1];
+    else
+      b.Caller = (uint32_t) - 1;
+  }
+#ifdef SLIMMER_PRINT_BLOCKS
+  b.Print(Ins, BB2Ins);
+#endif
+  block_trace.push_back(b);
+}
+
+/// Pop all the functions of a thread's call stack,
+/// i.e., the thread is ended or its trace is interrupted.
+///
+/// \param tid - the thread ID.
+/// \param stack - the call stack of the thread.
+/// \param block_trace - for recording the generated SmallestBlocks.
+///
+void CloseCallStack(uint64_t tid, vector<StackInfo> &stack,
+                    vector<SmallestBlock> &block_trace) {
+  while (!stack.empty())
+    PopCallStack(tid, stack, block_trace);
+}
+
 /// This function takes the trace generated by LLVM and PIN
 /// and generated a list of SmallestBlocks that contain
 /// all the information needed for analyzing.
 ///
 /// \param inst_file - path to Inst file generated by SlimmerTrace pass.
-/// \param trace_file_name - path to trace file generated by the instrumented
-/// application.
+/// \param trace_file_names - paths to trace files generated by the
+/// instrumented application, which are merged by their StampEvents.
 /// \param output_file_name - path to output file.
 /// \param impactful_fun_call - recorded the function calls that impact the
 /// outside enviroment.
 ///
-void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
+void MergeTrace(const vector<string> &trace_file_names,
+                set<uint64_t> &impactful_fun_call,
                 vector<SmallestBlock> &block_trace) {
   block_trace.clear();
 
@@ -44,9 +233,108 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
   // Recording whether this is the first basic block
   map<uint64_t, pair<uint8_t, uint32_t> > is_first;
 
-  TraceIter iter(trace_file_name);
-  while (iter.NextEvent(event_label, tid_ptr, id_ptr, addr_ptr, length_ptr,
-                        addr2_ptr)) {
+  // The gaps left by the lossy mode of the runtime
+  uint64_t gap_cnt = 0, dropped_events = 0, dropped_bytes = 0;
+  uint64_t skipped_events = 0;
+
+  // In the online dependency mode, the writes are numbered by their order
+  // in the trace of their process, and a load carries the numbers of its
+  // writers.
+  vector<uint64_t> write_seq(trace_file_names.size(), 0);
+  vector<uint64_t> dep_writers;
+
+  // The TSC deltas between two StampEvents of a thread are shared by the
+  // instructions of its blocks in between.
+  map<uint64_t, uint64_t> last_stamp;
+  map<uint64_t, vector<size_t> > segment; // Blocks since the last stamp
+  size_t timed_blocks = 0; // The blocks before it are assigned to segments
+  InsCycles.assign(Ins.size(), 0);
+  InsTimedExecs.assign(Ins.size(), 0);
+  TracedCycles = 0;
+
+  // The StridedEvents and SilentStoreEvents of each thread that are waiting
+  // for their LoopEvent, and the loop being replayed.
+  map<uint64_t, map<uint32_t, StridedAccess> > strided;
+  map<uint64_t, set<pair<uint32_t, uint64_t> > > silent;
+  LoopReplay replay;
+  uint64_t replayed_loops = 0, replayed_iterations = 0;
+
+  // The events of each thread in a path-encoded function (path_fun maps the
+  // thread to the entry of the function) that are waiting for the next
+  // PathEvent, and the path being replayed.
+  map<uint64_t, uint32_t> path_fun;
+  map<uint64_t, vector<BufferedEvent> > path_events;
+  PathReplay path;
+  bool from_path = false;
+  uint64_t decoded_paths = 0;
+
+  // The batch being replayed
+  BatchReplay batch;
+  uint64_t replayed_batches = 0;
+
+  // With the function events, a function is pushed by its FunctionEnterEvent
+  // and popped by its FunctionExitEvent, instead of being inferred from the
+  // basic blocks. The functions left by a longjmp or an exception are popped
+  // when the thread continues in one of its callers.
+  bool function_events = !BB2Fun.empty();
+  map<uint64_t, uint32_t> entering; // The function whose entry is next
+  uint64_t resynced_events = 0;
+
+  // The trace, i.e., the process, of the current event. The replayed events
+  // belong to the process of the event that triggers them.
+  uint32_t proc = 0;
+  size_t proc_blocks = 0; // The blocks before it are assigned to processes
+
+  MergedTraceIter iter(trace_file_names);
+  auto next_event = [&]() {
+    from_path = false;
+    if (replay.Next(event_label)) {
+      tid_ptr = &replay.TID;
+      id_ptr = &replay.ID;
+      addr_ptr = &replay.Addr;
+      length_ptr = &replay.Length;
+      return true;
+    }
+    if (path.Next(event_label)) {
+      from_path = true;
+      tid_ptr = &path.TID;
+      id_ptr = &path.ID;
+      addr_ptr = &path.Addr;
+      addr2_ptr = &path.Addr2;
+      length_ptr = &path.Length;
+      if (event_label == DepLoadEventLabel)
+        dep_writers = path.Cur->Writers;
+      return true;
+    }
+    if (batch.Next(event_label)) {
+      tid_ptr = &batch.TID;
+      id_ptr = &batch.ID;
+      addr_ptr = &batch.Addr;
+      length_ptr = &batch.Length;
+      return true;
+    }
+    if (!iter.NextEvent(event_label, tid_ptr, id_ptr, addr_ptr, length_ptr,
+                        addr2_ptr))
+      return false;
+    proc = iter.cur;
+    return true;
+  };
+  while (true) {
+    // The blocks of the last event belong to its process
+    for (; proc_blocks < block_trace.size(); ++proc_blocks)
+      block_trace[proc_blocks].Proc = proc;
+    if (!next_event())
+      break;
+    StatsTick();
+
+    // The blocks of the last event belong to the segment of their thread
+    if (!last_stamp.empty()) {
+      for (; timed_blocks < block_trace.size(); ++timed_blocks) {
+        SmallestBlock &b = block_trace[timed_blocks];
+        if (b.Type != SmallestBlock::DeclareBlock && last_stamp.count(b.TID))
+          segment[b.TID].push_back(timed_blocks);
+      }
+    }
 
 #ifdef SLIMMER_PRINT_BLOCKS
     switch (event_label) {
@@ -72,18 +360,229 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
         printf("MemmoveEvent:     %lu\t%u\t%p\t%p\t%lu\n", *tid_ptr, *id_ptr,
     (void*)*addr_ptr, (void*)*addr2_ptr, *length_ptr);
         break;
+      case GapEventLabel:
+        printf("GapEvent:         %lu\t%lu\n", *addr_ptr, *length_ptr);
+        break;
+      case ForkEventLabel:
+        printf("ForkEvent:        %lu\t%u\t%lu\t%lu\n", *tid_ptr, *id_ptr,
+    *addr_ptr, *addr2_ptr);
+        break;
+      case DepLoadEventLabel:
+        printf("DepLoadEvent:     %lu\t%u\t%lu\t%lu\t%lu\n", *tid_ptr,
+    *id_ptr, *addr_ptr, *length_ptr, *addr2_ptr);
+        break;
+      case DepEdgeEventLabel:
+        printf("DepEdgeEvent:     %lu\n", *addr_ptr);
+        break;
+      case StampEventLabel:
+        printf("StampEvent:       %lu\t%u\t%lu\n", *tid_ptr, *id_ptr,
+    *addr_ptr);
+        break;
+      case LoopEventLabel:
+        printf("LoopEvent:        %lu\t%u\t%lu\n", *tid_ptr, *id_ptr,
+    *length_ptr);
+        break;
+      case StridedEventLabel:
+        printf("StridedEvent:     %lu\t%u\t%p\t%ld\t%lu\n", *tid_ptr, *id_ptr,
+    (void*)*addr_ptr, (int64_t)*addr2_ptr, *length_ptr);
+        break;
+      case SilentStoreEventLabel:
+        printf("SilentStoreEvent: %lu\t%u\t%lu\n", *tid_ptr, *id_ptr,
+    *addr_ptr);
+        break;
+      case PathEventLabel:
+        printf("PathEvent:        %lu\t%u\t%lu\n", *tid_ptr, *id_ptr,
+    *addr_ptr);
+        break;
+      case FunctionEnterEventLabel:
+        printf("FunctionEnter:    %lu\t%u\n", *tid_ptr, *id_ptr);
+        break;
+      case FunctionExitEventLabel:
+        printf("FunctionExit:     %lu\t%u\n", *tid_ptr, *id_ptr);
+        break;
+      case BatchEventLabel:
+        printf("BatchEvent:       %lu\t%u\t%lu\t%lx\n", *tid_ptr, *id_ptr,
+    *length_ptr, *addr2_ptr);
+        break;
     }
 #endif
+    // Some events are dropped, the call stacks of all the threads are lost.
+    // Each thread is restarted from its next BasicBlockEvent.
+    if (event_label == GapEventLabel) {
+      gap_cnt++;
+      dropped_events += *addr_ptr;
+      dropped_bytes += *length_ptr;
+      for (auto &i : call_stack)
+        CloseCallStack(i.first, i.second, block_trace);
+      args.clear();
+      strided.clear();
+      silent.clear();
+      path_fun.clear();
+      path_events.clear();
+      entering.clear();
+      continue;
+    }
+    // The trace of a forked process starts with a ForkEvent, whose thread is
+    // restarted from its next BasicBlockEvent as the other new threads.
+    if (event_label == ForkEventLabel) {
+      if (*addr2_ptr != 0)
+        printf("[SLIMMER] Process %lu is forked from process %lu "
+               "(fork %u of the parent)\n", *addr2_ptr, *addr_ptr, *id_ptr);
+      continue;
+    }
+    if (event_label == StampEventLabel) {
+      if (*id_ptr != TSCStamp)
+        continue; // Only for ordering
+      if (last_stamp.count(*tid_ptr) && *addr_ptr > last_stamp[*tid_ptr]) {
+        vector<size_t> &blocks = segment[*tid_ptr];
+        uint64_t ins_cnt = 0;
+        for (auto i : blocks)
+          ins_cnt += block_trace[i].End - block_trace[i].Start;
+        if (ins_cnt > 0) {
+          double delta = *addr_ptr - last_stamp[*tid_ptr];
+          TracedCycles += delta;
+          for (auto i : blocks) {
+            SmallestBlock &b = block_trace[i];
+            for (uint32_t j = b.Start; j < b.End; ++j) {
+              InsCycles[BB2Ins[b.BBID][j]] += delta / ins_cnt;
+              InsTimedExecs[BB2Ins[b.BBID][j]]++;
+            }
+          }
+        }
+      }
+      segment[*tid_ptr].clear();
+      last_stamp[*tid_ptr] = *addr_ptr;
+      timed_blocks = block_trace.size();
+      continue;
+    }
+    if (event_label == DepLoadEventLabel && *tid_ptr == 0 &&
+        *id_ptr == (uint32_t) - 1) {
+      OnlineDependency = true;
+      continue;
+    }
+    // The other writers of the following DepLoadEvent
+    if (event_label == DepEdgeEventLabel) {
+      dep_writers.push_back(*addr_ptr);
+      continue;
+    }
+    // The accesses of a batch are replayed as MemoryEvents
+    if (event_label == BatchEventLabel) {
+      if (*id_ptr >= Batches.size() || Batches[*id_ptr].empty()) {
+        ERROR("[SLIMMER] Unknown batch %u\n", *id_ptr);
+        skipped_events++;
+        continue;
+      }
+      batch.TID = *tid_ptr;
+      batch.Silent = *addr2_ptr;
+      batch.Bases.assign(addr_ptr, addr_ptr + *length_ptr);
+      batch.Accesses = &Batches[*id_ptr];
+      batch.P = 0;
+      replayed_batches++;
+      continue;
+    }
+    // The accesses of a summarized loop come before its LoopEvent
+    if (event_label == StridedEventLabel) {
+      StridedAccess a = {*id_ptr, *addr_ptr, *addr2_ptr, *length_ptr};
+      strided[*tid_ptr][*id_ptr] = a;
+      continue;
+    }
+    if (event_label == SilentStoreEventLabel) {
+      silent[*tid_ptr].insert(make_pair(*id_ptr, *addr_ptr));
+      continue;
+    }
+    if (event_label == LoopEventLabel) {
+      uint64_t tid = *tid_ptr;
+      bool missing = false;
+      replay.Accesses.clear();
+      for (auto ins_id : BB2Ins[*id_ptr]) {
+        if (Ins[ins_id].Type != InstInfo::LoadInst &&
+            Ins[ins_id].Type != InstInfo::StoreInst)
+          continue;
+        if (strided[tid].count(ins_id) == 0) {
+          ERROR("[SLIMMER] The access of instruction %u is missing in the "
+                "loop of basic block %u\n", ins_id, *id_ptr);
+          missing = true;
+          break;
+        }
+        replay.Accesses.push_back(strided[tid][ins_id]);
+      }
+      if (call_stack[tid].empty() || missing) {
+        skipped_events++; // Waiting for resynchronizing
+      } else {
+        replay.TID = tid;
+        replay.BBID = *id_ptr;
+        replay.Count = *length_ptr;
+        replay.K = replay.P = 0;
+        replay.Silent.swap(silent[tid]);
+        replayed_loops++;
+        replayed_iterations += replay.Count;
+      }
+      strided.erase(tid);
+      silent.erase(tid);
+      continue;
+    }
+    // The events of a path-encoded function come before its PathEvent
+    if (event_label == PathEventLabel) {
+      uint64_t tid = *tid_ptr;
+      if (path_fun.count(tid) == 0 || path_fun[tid] != *id_ptr) {
+        skipped_events += path_events[tid].size() + 1; // Resynchronizing
+        path_events.erase(tid);
+        continue;
+      }
+      bool returned = false;
+      path.Events.swap(path_events[tid]);
+      path_events.erase(tid);
+      if (!PathFuns[*id_ptr].Decode(*addr_ptr, path.Blocks, returned) ||
+          !path.Match()) {
+        ERROR("[SLIMMER] Path %lu of basic block %u does not match its "
+              "events\n", *addr_ptr, *id_ptr);
+        skipped_events += path.Events.size() + 1;
+        path.Blocks.clear();
+        path.Events.clear();
+        path_fun.erase(tid);
+        CloseCallStack(tid, call_stack[tid], block_trace);
+        continue;
+      }
+      path.TID = tid;
+      path.B = path.E = 0;
+      if (returned)
+        path_fun.erase(tid);
+      decoded_paths++;
+      continue;
+    }
+    if (event_label == FunctionEnterEventLabel) {
+      entering[*tid_ptr] = *id_ptr;
+      continue;
+    }
+    // Numbering the writes, including the skipped ones,
+    // in the same way as the runtime.
+    bool is_write = false;
+    if (event_label == MemoryEventLabel) {
+      is_write = *id_ptr != (uint32_t) - 1 &&
+                 Ins[*id_ptr].Type == InstInfo::StoreInst && *length_ptr > 0;
+    } else if (event_label == MemsetEventLabel ||
+               event_label == MemmoveEventLabel) {
+      is_write = *length_ptr > 0;
+    }
+    uint64_t seq = write_seq[proc];
+    if (from_path)
+      seq = path.Cur ? path.Cur->Seq : 0; // Numbered when it was buffered
+    else if (is_write)
+      seq = ++write_seq[proc];
+
     // Collecting the arguments of a function call event
     if (event_label == ArgumentEventLabel) {
-      args[*tid_ptr].insert(*addr_ptr);
+      if (call_stack[*tid_ptr].empty())
+        skipped_events++; // Waiting for resynchronizing
+      else
+        args[*tid_ptr].insert(ProcAddr(proc, *addr_ptr));
       continue;
     }
     if (event_label == MemoryEventLabel && (*id_ptr == (uint32_t) - 1) && (*tid_ptr == 0) ) {
       SmallestBlock b;
       b.Type = SmallestBlock::DeclareBlock;
-      b.Addr.push_back(*addr_ptr);
-      b.Addr.push_back(*addr_ptr + *length_ptr);
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr));
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr) + *length_ptr);
 #ifdef SLIMMER_PRINT_BLOCKS
       b.Print(Ins, BB2Ins);
 #endif
@@ -91,7 +590,114 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
       continue;
     }
 
-    if (event_label == BasicBlockEventLabel) {
+    // The entry of a path-encoded function starts buffering the events of the
+    // thread, which are replayed with the blocks of each PathEvent.
+    if (!from_path && event_label == BasicBlockEventLabel &&
+        PathFuns.count(*id_ptr)) {
+      skipped_events += path_events[*tid_ptr].size(); // A lost PathEvent
+      path_events[*tid_ptr].clear();
+      path_fun[*tid_ptr] = *id_ptr;
+      continue;
+    }
+    if (!from_path && path_fun.count(*tid_ptr) &&
+        (event_label == MemoryEventLabel || event_label == DepLoadEventLabel ||
+         event_label == MemsetEventLabel || event_label == MemmoveEventLabel)) {
+      BufferedEvent e;
+      e.Label = event_label;
+      e.ID = *id_ptr;
+      e.Addr = *addr_ptr;
+      e.Addr2 = (event_label == MemmoveEventLabel ||
+                 event_label == DepLoadEventLabel) ? *addr2_ptr : 0;
+      e.Length = *length_ptr;
+      e.Seq = seq;
+      if (event_label == DepLoadEventLabel)
+        e.Writers.swap(dep_writers);
+      path_events[*tid_ptr].push_back(e);
+      continue;
+    }
+
+    // A thread without a call stack can only be restarted
+    // from a BasicBlockEvent.
+    if (event_label != BasicBlockEventLabel &&
+        call_stack[*tid_ptr].empty()) {
+      skipped_events++;
+      dep_writers.clear();
+      continue;
+    }
+
+    // With the function events, an event that is not of the next instruction
+    // resynchronizes the call stack, e.g., after a longjmp.
+    if (function_events &&
+        ((event_label == MemoryEventLabel && *id_ptr != (uint32_t) - 1) ||
+         event_label == DepLoadEventLabel || event_label == ReturnEventLabel ||
+         event_label == MemsetEventLabel || event_label == MemmoveEventLabel)) {
+      vector<StackInfo> &stack = call_stack[*tid_ptr];
+      StackInfo &info = stack.back();
+      if (info.CurIndex >= BB2Ins[info.BBID].size() ||
+          BB2Ins[info.BBID][info.CurIndex] != *id_ptr) {
+        uint32_t bb = Ins[*id_ptr].BB;
+        while (!stack.empty() && stack.back().Fun != BB2Fun[bb])
+          PopCallStack(*tid_ptr, stack, block_trace);
+        if (stack.empty()) {
+          skipped_events++;
+          dep_writers.clear();
+          continue;
+        }
+        // The instructions of a basic block have continuous IDs
+        stack.back().BBID = bb;
+        stack.back().CurIndex = *id_ptr - BB2Ins[bb][0];
+        resynced_events++;
+      }
+    }
+
+    if (event_label == BasicBlockEventLabel && function_events) {
+      vector<StackInfo> &stack = call_stack[*tid_ptr];
+      if (entering.count(*tid_ptr)) {
+        // The entry of a called function, or of a thread
+        if (stack.empty())
+          is_first[*tid_ptr] = make_pair(2, 0);
+        else if (stack.back().CurIndex > 0)
+          is_first[*tid_ptr] = make_pair(
+              1, BB2Ins[stack.back().BBID][stack.back().CurIndex - 1]);
+        else
+          is_first[*tid_ptr] = make_pair(1, (uint32_t) - 1);
+        stack.push_back(StackInfo(*id_ptr, -1, 0, entering[*tid_ptr]));
+        entering.erase(*tid_ptr);
+      } else {
+        // Another basic block of a function on the stack, the functions
+        // above it are left by a longjmp or an exception.
+        while (!stack.empty() && stack.back().Fun != BB2Fun[*id_ptr])
+          PopCallStack(*tid_ptr, stack, block_trace);
+        if (stack.empty()) {
+          is_first[*tid_ptr] = make_pair(2, 0);
+          stack.push_back(StackInfo(*id_ptr, -1, 0, BB2Fun[*id_ptr]));
+        } else {
+          is_first[*tid_ptr] = make_pair(0, 0);
+          StackInfo info = stack.back();
+          stack.back() = StackInfo(*id_ptr, info.BBID, 0, info.Fun);
+        }
+      }
+    } else if (event_label == FunctionExitEventLabel) {
+      // Pop the function, and the functions above it that are left by a
+      // longjmp or an exception. The exit of a function whose entry is lost
+      // is ignored.
+      vector<StackInfo> &stack = call_stack[*tid_ptr];
+      size_t depth = stack.size();
+      while (depth > 0 && stack[depth - 1].Fun != *id_ptr)
+        --depth;
+      if (depth == 0) {
+        skipped_events++;
+        continue;
+      }
+      while (stack.size() > depth)
+        PopCallStack(*tid_ptr, stack, block_trace);
+      StackInfo &info = stack.back();
+      if (info.CurIndex == BB2Ins[info.BBID].size() &&
+          Ins[BB2Ins[info.BBID].back()].Type == InstInfo::ReturnInst)
+        stack.pop_back(); // Its last SmallestBlock is generated
+      else
+        PopCallStack(*tid_ptr, stack, block_trace); // Unwound
+    } else if (event_label == BasicBlockEventLabel) {
       if (call_stack[*tid_ptr].empty()) {
         // This is the first basic block of a thread.
         is_first[*tid_ptr] = make_pair(2, 0);
@@ -113,8 +719,8 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
       if (*id_ptr == (uint32_t) - 1) { // A declare block
         SmallestBlock b;
         b.Type = SmallestBlock::DeclareBlock;
-        b.Addr.push_back(*addr_ptr);
-        b.Addr.push_back(*addr_ptr + *length_ptr);
+        b.Addr.push_back(ProcAddr(proc, *addr_ptr));
+        b.Addr.push_back(ProcAddr(proc, *addr_ptr) + *length_ptr);
 #ifdef SLIMMER_PRINT_BLOCKS
         b.Print(Ins, BB2Ins);
 #endif
@@ -127,8 +733,10 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
         SmallestBlock b(SmallestBlock::MemoryAccessBlock, *tid_ptr, info.BBID,
                         info.CurIndex - 1, info.CurIndex, is_first[*tid_ptr],
                         call_stack[*tid_ptr].back().LastBBID);
-        b.Addr.push_back(*addr_ptr);
-        b.Addr.push_back(*addr_ptr + *length_ptr);
+        b.Addr.push_back(ProcAddr(proc, *addr_ptr));
+        b.Addr.push_back(ProcAddr(proc, *addr_ptr) + *length_ptr);
+        if (OnlineDependency && is_write)
+          b.Addr.push_back(seq);
 
 #ifdef SLIMMER_PRINT_BLOCKS
         b.Print(Ins, BB2Ins);
@@ -136,6 +744,28 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
         block_trace.push_back(b);
         is_first[*tid_ptr] = make_pair(0, 0);
       }
+    } else if (event_label == DepLoadEventLabel) {
+      StackInfo &info = call_stack[*tid_ptr].back();
+      uint32_t ins_id = BB2Ins[info.BBID][info.CurIndex++];
+      assert((*id_ptr) == ins_id);
+
+      // A load resolved by the runtime keeps its address range, which is
+      // followed by the numbers of its writers, ending with the last one
+      // (0 for none), hence it is distinguished from an unresolved load.
+      SmallestBlock b(SmallestBlock::MemoryAccessBlock, *tid_ptr, info.BBID,
+                      info.CurIndex - 1, info.CurIndex, is_first[*tid_ptr],
+                      call_stack[*tid_ptr].back().LastBBID);
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr));
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr) + *length_ptr);
+      b.Addr.insert(b.Addr.end(), dep_writers.begin(), dep_writers.end());
+      b.Addr.push_back(*addr2_ptr);
+      dep_writers.clear();
+
+#ifdef SLIMMER_PRINT_BLOCKS
+      b.Print(Ins, BB2Ins);
+#endif
+      block_trace.push_back(b);
+      is_first[*tid_ptr] = make_pair(0, 0);
     } else if (event_label == ReturnEventLabel) {
       StackInfo &info = call_stack[*tid_ptr].back();
       uint32_t ins_id = BB2Ins[info.BBID][info.CurIndex++];
@@ -169,8 +799,10 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
       SmallestBlock b(SmallestBlock::MemsetBlock, *tid_ptr, info.BBID,
                       info.CurIndex - 1, info.CurIndex, is_first[*tid_ptr],
                       call_stack[*tid_ptr].back().LastBBID);
-      b.Addr.push_back(*addr_ptr);
-      b.Addr.push_back(*addr_ptr + *length_ptr);
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr));
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr) + *length_ptr);
+      if (OnlineDependency && is_write)
+        b.Addr.push_back(seq);
 
 #ifdef SLIMMER_PRINT_BLOCKS
       b.Print(Ins, BB2Ins);
@@ -185,10 +817,12 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
       SmallestBlock b(SmallestBlock::MemmoveBlock, *tid_ptr, info.BBID,
                       info.CurIndex - 1, info.CurIndex, is_first[*tid_ptr],
                       call_stack[*tid_ptr].back().LastBBID);
-      b.Addr.push_back(*addr_ptr);
-      b.Addr.push_back(*addr_ptr + *length_ptr);
-      b.Addr.push_back(*addr2_ptr);
-      b.Addr.push_back(*addr2_ptr + *length_ptr);
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr));
+      b.Addr.push_back(ProcAddr(proc, *addr_ptr) + *length_ptr);
+      b.Addr.push_back(ProcAddr(proc, *addr2_ptr));
+      b.Addr.push_back(ProcAddr(proc, *addr2_ptr) + *length_ptr);
+      if (OnlineDependency && is_write)
+        b.Addr.push_back(seq);
 
 #ifdef SLIMMER_PRINT_BLOCKS
       b.Print(Ins, BB2Ins);
@@ -236,13 +870,18 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
                         start_index, end_index, is_first[*tid_ptr],
                         call_stack[*tid_ptr].back().LastBBID);
         if (last_bb) {
-          call_stack[*tid_ptr].pop_back();
+          // With the function events, the function is popped by its
+          // FunctionExitEvent, which follows.
+          vector<StackInfo> &stack = call_stack[*tid_ptr];
+          if (!function_events)
+            stack.pop_back();
+          size_t callers = stack.size() - (function_events ? 1 : 0);
 
-          if (call_stack[*tid_ptr].empty()) {
+          if (callers == 0) {
             b.IsLast = 2; // The last SmallestBlock of a thread.
           } else {
             b.IsLast = 1;
-            StackInfo last_info = call_stack[*tid_ptr].back();
+            StackInfo last_info = stack[callers - 1];
             assert(last_info.CurIndex < BB2Ins[last_info.BBID].size());
             if (Ins[BB2Ins[last_info.BBID][last_info.CurIndex - 1]].Type ==
                 InstInfo::CallInst)
@@ -257,36 +896,30 @@ void MergeTrace(char *trace_file_name, set<uint64_t> &impactful_fun_call,
 #endif
         block_trace.push_back(b);
       }
-      if (!last_bb)
+      if (!last_bb || function_events)
         break;
     }
   }
 
-  for (auto &i : call_stack) {
-    auto tid = i.first;
-    while (!i.second.empty()) {
-      StackInfo &info = call_stack[tid].back();
-      SmallestBlock b(SmallestBlock::NormalBlock, tid, info.BBID, info.CurIndex,
-                      info.CurIndex, make_pair(0, 0),
-                      call_stack[*tid_ptr].back().LastBBID);
-      call_stack[tid].pop_back();
+  for (auto &i : call_stack)
+    CloseCallStack(i.first, i.second, block_trace);
 
-      if (call_stack[tid].empty()) {
-        b.IsLast = 2; // The last SmallestBlock of a thread.
-      } else {
-        b.IsLast = 1;
-        StackInfo last_info = call_stack[tid].back();
-        assert(last_info.CurIndex < BB2Ins[last_info.BBID].size());
-        if (Ins[BB2Ins[last_info.BBID][last_info.CurIndex - 1]].Type ==
-            InstInfo::CallInst)
-          b.Caller = BB2Ins[last_info.BBID][last_info.CurIndex - 1];
-        else
-          b.Caller = (uint32_t) - 1;
-      }
-#ifdef SLIMMER_PRINT_BLOCKS
-      b.Print(Ins, BB2Ins);
-#endif
-      block_trace.push_back(b);
-    }
-  }
+  for (auto &i : path_events)
+    skipped_events += i.second.size();
+  if (resynced_events > 0)
+    printf("[SLIMMER] The call stacks are resynchronized by %lu events, "
+           "e.g., after longjmps\n", resynced_events);
+  if (decoded_paths > 0)
+    printf("[SLIMMER] %lu paths of %lu path-encoded functions are decoded\n",
+           decoded_paths, PathFuns.size());
+  if (replayed_batches > 0)
+    printf("[SLIMMER] %lu batches of memory accesses are replayed\n",
+           replayed_batches);
+  if (replayed_loops > 0)
+    printf("[SLIMMER] %lu iterations of %lu summarized loops are replayed\n",
+           replayed_iterations, replayed_loops);
+  if (gap_cnt > 0)
+    printf("[SLIMMER] The trace has %lu gaps, %lu events (%lu bytes) are "
+           "dropped and %lu events are skipped for resynchronizing\n",
+           gap_cnt, dropped_events, dropped_bytes, skipped_events);
 }
@@ -11,10 +11,24 @@
 vector<InstInfo> Ins;
 // Map a basic block ID to all the instructions that belong to it
 vector<vector<uint32_t> > BB2Ins;
+// Map the entry basic block of each path-encoded function to its numbering
+map<uint32_t, PathNumbering> PathFuns;
+// Map a basic block ID to the entry basic block of its function,
+// empty if the trace has no function events
+vector<uint32_t> BB2Fun;
+// Map a batch ID to its memory accesses
+vector<vector<BatchAccess> > Batches;
 // A set of function calls that impact the outside enviroment.
 set<uint64_t> ImpactfulFunCall;
 
 vector<SmallestBlock> BlockTrace;
+// Whether the loads are resolved by the runtime (SLIMMER_ONLINE_DEP)
+bool OnlineDependency = false;
+// The CPU cycles (from the TSC stamps) spent by each instruction, and how many
+// times it is executed within the timed part of the trace.
+vector<double> InsCycles;
+vector<uint64_t> InsTimedExecs;
+double TracedCycles = 0;
 
 // A segment tree that maps a memory address to its group
 SegmentTree<int> *Addr2Group;
@@ -69,6 +83,7 @@ void PreparePostDominator(string bbgraph_file_name,
   int a, b;
   while (fscanf(f, "%d%d", &a, &b) != EOF) {
     successor[a].push_back(b);
+    StatsTick();
   }
 
   for (auto i : successor) {
@@ -211,6 +226,7 @@ void ExtractUneededOperation(vector<SmallestBlock> &block_trace,
   unneeded_di.clear();
   for (int64_t i = block_trace.size() - 1; i >= 0; --i) {
     SmallestBlock b = block_trace[i];
+    StatsTick();
 
     if (b.Type == SmallestBlock::DeclareBlock) continue;
     // b.Print(Ins, BB2Ins);
@@ -430,11 +446,21 @@ void PrintBug(set<DynamicInst> &bug) {
   set<int32_t> printed;
   int bug_cnt = 1;
   for (auto i : uneeded_ins_cnt) {
+    StatsTick();
     if (!printed.count(i.first)) {
       set<int32_t> bug;
       BFSOnUneededGraph(uneeded_graph, i.first, bug, printed);
 
       printf("\n===============\nBug %d\n===============\n", bug_cnt++);
+      if (TracedCycles > 0) {
+        // Weight each instruction by its average cycles
+        double cycles = 0;
+        for (auto j : bug)
+          if (InsTimedExecs[j] > 0)
+            cycles += uneeded_ins_cnt[j] * InsCycles[j] / InsTimedExecs[j];
+        printf("Estimated cost: %.0f cycles (%.2f%% of the traced cycles)\n",
+               cycles, 100 * cycles / TracedCycles);
+      }
 #ifdef SLIMMER_PRINT_CODE
       printf("\n------IR------\n");
       for (auto j : bug) {
@@ -482,38 +508,105 @@ void PrintBug(set<DynamicInst> &bug) {
 //                        Main
 //===----------------------------------------------------------------------===//
 
+/// Print the usage of print-bug and exit.
+void Usage() {
+  printf("Usage: print-bug [options] slimmer_dir slimmer_trace[,...] "
+         "pin_trace\n");
+  printf("Options:\n");
+  printf("  --stats=<file>     dump the time and memory usage of each stage "
+         "as JSON\n");
+  printf("  --progress=<sec>   print a progress line to stderr every <sec> "
+         "seconds\n");
+  exit(1);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 4) {
-    printf("Usage: print-bug slimmer_dir slimmer_trace pin_trace\n");
-    exit(1);
+  const char *stats_file = NULL;
+  vector<char *> args;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--stats=", 8) == 0)
+      stats_file = argv[i] + 8;
+    else if (strncmp(argv[i], "--progress=", 11) == 0)
+      ProgressInterval = atof(argv[i] + 11);
+    else if (strncmp(argv[i], "--", 2) == 0)
+      Usage();
+    else
+      args.push_back(argv[i]);
   }
+  if (args.size() != 3)
+    Usage();
 
-  string slimmer_dir = argv[1];
-  printf("LoadInstInfo\n");
+  string slimmer_dir = args[0];
+  StatsBegin("LoadInstInfo", "instructions");
   LoadInstInfo(slimmer_dir + "/Inst", Ins, BB2Ins);
-  printf("ExtractImpactfulFunCall\n");
-  ExtractImpactfulFunCall(argv[3], ImpactfulFunCall);
-  printf("MergeTrace\n");
-  MergeTrace(argv[2], ImpactfulFunCall, BlockTrace);
+  Stages.back().Items = Ins.size();
+  StatsEnd();
+  StatsSize("basic_blocks", BB2Ins.size());
+  LoadPathFun(slimmer_dir + "/PathFun", slimmer_dir + "/BBGraph", PathFuns);
+  StatsSize("path_functions", PathFuns.size());
+  LoadFunEntry(slimmer_dir + "/FunEntry", BB2Fun);
+  LoadBatch(slimmer_dir + "/Batch", Batches);
+  StatsSize("batches", Batches.size());
+
+  StatsBegin("ExtractImpactfulFunCall", "events");
+  ExtractImpactfulFunCall(args[2], ImpactfulFunCall);
+  StatsEnd();
+  StatsSize("impactful_functions", ImpactfulFunCall.size());
+
+  // Several traces are merged by their StampEvents
+  vector<string> trace_files;
+  stringstream trace_list(args[1]);
+  string trace_file;
+  while (getline(trace_list, trace_file, ','))
+    trace_files.push_back(trace_file);
+
+  StatsBegin("MergeTrace", "events");
+  MergeTrace(trace_files, ImpactfulFunCall, BlockTrace);
+  StatsEnd();
+  StatsSize("block_trace_blocks", BlockTrace.size());
+  StatsSize("block_trace_bytes", BlockTrace.capacity() * sizeof(SmallestBlock));
 
   Addr2Group = SegmentTree<int>::NewTree();
   Group2Addr.clear();
-  printf("GroupMemory\n");
+  StatsBegin("GroupMemory", "blocks");
   GroupMemory(BlockTrace);
-  printf("ExtractMemoryDependency\n");
+  StatsEnd();
+  uint64_t group_nodes = 0;
+  for (auto &i : Group2Addr)
+    group_nodes += CountNodes(i.second);
+  StatsSize("groups", Group2Addr.size());
+  StatsSize("group2addr_nodes", group_nodes);
+  StatsSize("addr2group_nodes", CountNodes(Addr2Group));
+
+  StatsBegin("ExtractMemoryDependency", "blocks");
   ExtractMemoryDependency(BlockTrace, MemDependencies);
+  StatsEnd();
+  uint64_t dep_edges = 0;
+  for (auto &i : MemDependencies)
+    dep_edges += i.second.size();
+  StatsSize("mem_dependencies", MemDependencies.size());
+  StatsSize("mem_dependency_edges", dep_edges);
   delete Addr2Group;
   for (auto &i : Group2Addr) {
     delete i.second;
   }
   Group2Addr.clear();
 
-  printf("PreparePostDominator\n");
+  StatsBegin("PreparePostDominator", "edges");
   PreparePostDominator(slimmer_dir + "/BBGraph", PostDominator);
+  StatsEnd();
+  StatsSize("post_dominator_sets", PostDominator.size());
 
   set<DynamicInst> bug;
-  printf("ExtractUneededOperation\n");
+  StatsBegin("ExtractUneededOperation", "blocks");
   ExtractUneededOperation(BlockTrace, bug);
-  printf("PrintBug\n");
+  StatsEnd();
+  StatsSize("unneeded_dynamic_instructions", bug.size());
+
+  StatsBegin("PrintBug", "instructions");
   PrintBug(bug);
+  StatsEnd();
+
+  if (stats_file)
+    StatsDump(stats_file);
 }
@@ -0,0 +1,163 @@
+#include "SlimmerTools.h"
+
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// Print a progress line every ProgressInterval seconds, 0 for disabled.
+double ProgressInterval = 0;
+
+// The statistics of all the finished stages and the running one.
+vector<StageStat> Stages;
+
+// The starting point of the running stage.
+static double StageWallStart, StageCPUStart, LastProgress;
+
+//===----------------------------------------------------------------------===//
+//                        Clocks
+//===----------------------------------------------------------------------===//
+
+/// Return the wall clock time in seconds.
+static double WallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Return the CPU time (user + system) of this process in seconds.
+static double CPUTime() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+/// Return the current resident set size of this process in KB.
+static long CurrentRSS() {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL)
+    return 0;
+  if (fscanf(f, "%ld%ld", &pages, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/// Return the peak resident set size of this process in KB.
+static long MaxRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+//===----------------------------------------------------------------------===//
+//                        Stages
+//===----------------------------------------------------------------------===//
+
+/// Start a new stage of the analyzing pipeline.
+///
+/// \param name - name of the stage.
+/// \param unit - what the counted items of this stage are.
+///
+void StatsBegin(const char *name, const char *unit) {
+  printf("%s\n", name);
+  fflush(stdout);
+
+  StageStat s;
+  s.Name = name;
+  s.Unit = unit;
+  s.Items = 0;
+  s.RSSBefore = CurrentRSS();
+  Stages.push_back(s);
+
+  StageWallStart = LastProgress = WallTime();
+  StageCPUStart = CPUTime();
+}
+
+/// Count one event (or block) processed by the running stage and print a
+/// progress line if the progress interval is passed.
+///
+/// The clock is only read once every 2^16 items, hence it is cheap enough to
+/// be called in the inner loops.
+///
+void StatsTick() {
+  uint64_t items = ++Stages.back().Items;
+  if (ProgressInterval <= 0 || (items & 0xffff) != 0)
+    return;
+
+  double now = WallTime();
+  if (now - LastProgress < ProgressInterval)
+    return;
+  LastProgress = now;
+  fprintf(stderr, "[%s] %lu %s, %.1fs, %.0f/s, RSS %ld MB\n",
+          Stages.back().Name.c_str(), items, Stages.back().Unit.c_str(),
+          now - StageWallStart, items / (now - StageWallStart),
+          CurrentRSS() / 1024);
+}
+
+/// Finish the running stage.
+///
+void StatsEnd() {
+  StageStat &s = Stages.back();
+  s.WallTime = WallTime() - StageWallStart;
+  s.CPUTime = CPUTime() - StageCPUStart;
+  s.RSSAfter = CurrentRSS();
+  s.MaxRSS = MaxRSS();
+
+  if (ProgressInterval > 0)
+    fprintf(stderr, "[%s] done: %lu %s, %.2fs wall, %.2fs cpu, "
+                    "RSS %+ld MB\n",
+            s.Name.c_str(), s.Items, s.Unit.c_str(), s.WallTime, s.CPUTime,
+            (s.RSSAfter - s.RSSBefore) / 1024);
+}
+
+/// Attach the size of a data structure to the last stage.
+///
+void StatsSize(const char *name, uint64_t value) {
+  Stages.back().Sizes.push_back(make_pair(string(name), value));
+}
+
+/// Count the nodes of a segment tree.
+///
+uint64_t CountNodes(SegmentTree<int> *tree) {
+  if (tree == NULL)
+    return 0;
+  return 1 + CountNodes(tree->l_child) + CountNodes(tree->r_child);
+}
+
+/// Dump the statistics of all the stages as a JSON file.
+///
+/// \param path - path to the output file.
+///
+void StatsDump(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    ERROR("[SLIMMER] Cannot open %s for the statistics.\n", path);
+    return;
+  }
+
+  fprintf(f, "{\n  \"stages\": [");
+  for (size_t i = 0; i < Stages.size(); ++i) {
+    StageStat &s = Stages[i];
+    fprintf(f, "%s\n    {\n", i ? "," : "");
+    fprintf(f, "      \"name\": \"%s\",\n", s.Name.c_str());
+    fprintf(f, "      \"wall_seconds\": %.6f,\n", s.WallTime);
+    fprintf(f, "      \"cpu_seconds\": %.6f,\n", s.CPUTime);
+    fprintf(f, "      \"rss_before_kb\": %ld,\n", s.RSSBefore);
+    fprintf(f, "      \"rss_after_kb\": %ld,\n", s.RSSAfter);
+    fprintf(f, "      \"rss_delta_kb\": %ld,\n", s.RSSAfter - s.RSSBefore);
+    fprintf(f, "      \"max_rss_kb\": %ld,\n", s.MaxRSS);
+    fprintf(f, "      \"unit\": \"%s\",\n", s.Unit.c_str());
+    fprintf(f, "      \"items\": %lu,\n", s.Items);
+    fprintf(f, "      \"items_per_second\": %.1f,\n",
+            s.WallTime > 0 ? s.Items / s.WallTime : 0.0);
+    fprintf(f, "      \"sizes\": {");
+    for (size_t j = 0; j < s.Sizes.size(); ++j)
+      fprintf(f, "%s\n        \"%s\": %lu", j ? "," : "",
+              s.Sizes[j].first.c_str(), s.Sizes[j].second);
+    fprintf(f, "%s}\n    }", s.Sizes.size() ? "\n      " : "");
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+}
@@ -25,6 +25,7 @@ SmallestBlock::SmallestBlock(SmallestBlockType t, uint64_t tid, uint32_t bb_id,
   Caller = first.second;
   IsLast = 0;
   LastBBID = last_bb_id;
+  Proc = 0;
 }
 
 void SmallestBlock::Print(vector<InstInfo> &Ins,
@@ -78,18 +79,36 @@ void SmallestBlock::Print(vector<InstInfo> &Ins,
 
 /// Prepare the decompressed data
 ///
+/// The trace of a crashed program may end with a truncated block,
+/// which ends the trace instead of failing.
+///
 /// \return - return false if the trace is ended.
 ///
 bool TraceIter::Prepare() {
   if (decoded_iter >= decoded_size) {
     if (ended || data_iter >= trace.size())
       return false; // Trace is ended
-    uint64_t length = (*(uint64_t *)(&data[data_iter]));
+    size_t remain = trace.size() - data_iter;
+    uint64_t word = 0;
+    if (remain >= 2 * sizeof(uint64_t))
+      word = (*(uint64_t *)(&data[data_iter]));
+    uint64_t length = TraceCodec::Length(word);
+    if (remain < 2 * sizeof(uint64_t) ||
+        length > remain - 2 * sizeof(uint64_t)) {
+      ERROR("[SLIMMER] The trace is truncated at byte %lu.\n", data_iter);
+      ended = true;
+      return false;
+    }
     data_iter += sizeof(uint64_t);
 
-    decoded_size = LZ4_decompress_safe((const char *)&data[data_iter], decoded,
-                                       length, COMPRESS_BLOCK_SIZE);
-    assert(decoded_size > 0);
+    int64_t ret = codec.Decompress(word, &data[data_iter], decoded,
+                                   COMPRESS_BLOCK_SIZE);
+    if (ret <= 0) {
+      ERROR("[SLIMMER] The trace is corrupted at byte %lu.\n", data_iter);
+      ended = true;
+      return false;
+    }
+    decoded_size = ret;
     decoded_iter = 0;
     data_iter += length + sizeof(uint64_t);
   }
@@ -129,3 +148,95 @@ bool TraceIter::NextEvent(char &event_label, const uint64_t *&tid_ptr,
     ended = true;
   return true;
 }
+
+//===----------------------------------------------------------------------===//
+//                        MergedTraceIter
+//===----------------------------------------------------------------------===//
+
+MergedTraceIter::MergedTraceIter(const vector<string> &trace_file_names) {
+  for (auto &name : trace_file_names) {
+    Stream s;
+    s.Iter = new TraceIter(name.c_str());
+    s.Ended = !Fetch(s);
+    s.Pending = !s.Ended;
+    // The events before the first StampEvent go first
+    s.Stamp = (!s.Ended && s.Label == StampEventLabel) ? *s.Addr : 0;
+    streams.push_back(s);
+  }
+  cur = Pick();
+}
+
+MergedTraceIter::~MergedTraceIter() {
+  for (auto &s : streams) {
+    free(s.Iter->decoded);
+    delete s.Iter;
+  }
+}
+
+/// Fetch the next event of a trace.
+///
+/// \param s - the trace.
+/// \return - return false if the trace is ended.
+///
+bool MergedTraceIter::Fetch(Stream &s) {
+  while (s.Iter->NextEvent(s.Label, s.TID, s.ID, s.Addr, s.Length, s.Addr2)) {
+    if (s.Label == EndEventLabel)
+      return false;
+    if (s.Label != PlaceHolderLabel)
+      return true;
+  }
+  return false;
+}
+
+/// Pick the trace that goes next.
+///
+/// \return - the index of the trace, streams.size() if all are ended.
+///
+size_t MergedTraceIter::Pick() {
+  size_t ret = streams.size();
+  for (size_t i = 0; i < streams.size(); ++i) {
+    if (streams[i].Ended)
+      continue;
+    if (ret == streams.size() || streams[i].Stamp < streams[ret].Stamp)
+      ret = i;
+  }
+  return ret;
+}
+
+/// Obtain the next event.
+///
+/// \param * - stores the corresponding field of the next event.
+/// \return - return false if all the traces are ended.
+///
+bool MergedTraceIter::NextEvent(char &event_label, const uint64_t *&tid_ptr,
+                                const uint32_t *&id_ptr,
+                                const uint64_t *&addr_ptr,
+                                const uint64_t *&length_ptr,
+                                const uint64_t *&addr2_ptr) {
+  while (cur < streams.size()) {
+    Stream &s = streams[cur];
+    if (!s.Pending) {
+      if (!Fetch(s)) {
+        s.Ended = true;
+        cur = Pick();
+        continue;
+      }
+      if (s.Label == StampEventLabel) {
+        // A new segment, the other traces may go first.
+        s.Stamp = *s.Addr;
+        s.Pending = true;
+        cur = Pick();
+        continue;
+      }
+    }
+    s.Pending = false;
+    event_label = s.Label;
+    tid_ptr = s.TID;
+    id_ptr = s.ID;
+    addr_ptr = s.Addr;
+    length_ptr = s.Length;
+    addr2_ptr = s.Addr2;
+    return true;
+  }
+  return false;
+}
@@ -15,6 +15,7 @@
 #include "llvm/Config/config.h" // plugin-api.h requires HAVE_STDINT_H
 #include "plugin-api.h"
 #include "llvm-c/lto.h"
+#include "SlimmerTrace.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/OwningPtr.h"
 #include "llvm/Support/Errno.h"
@@ -29,6 +30,7 @@
 #include <cstring>
 #include <fstream>
 #include <list>
+#include <thread>
 #include <vector>
 
 // Support Windows/MinGW crazyness.
@@ -80,6 +82,8 @@ namespace options {
   static std::string extra_library_path;
   static std::string triple;
   static std::string mcpu;
+  // Generate the code of the instrumented module by this many threads.
+  static unsigned parallel_codegen = 1;
   // Additional options to pass into the code generator.
   // Note: This array will contain all plugin options which are not claimed
   // as plugin exclusive to pass to the code generator.
@@ -101,6 +105,14 @@ namespace options {
       extra_library_path = opt.substr(strlen("extra_library_path="));
     } else if (opt.startswith("mtriple=")) {
       triple = opt.substr(strlen("mtriple="));
+    } else if (opt.startswith("parallel-codegen=")) {
+      if (opt.substr(strlen("parallel-codegen="))
+              .getAsInteger(10, parallel_codegen)) {
+        (*message)(LDPL_WARNING, "Invalid option %s", opt_);
+        parallel_codegen = 1;
+      } else if (parallel_codegen == 0) { // All the cores
+        parallel_codegen = std::thread::hardware_concurrency();
+      }
     } else if (opt.startswith("obj-path=")) {
       obj_path = opt.substr(strlen("obj-path="));
     } else if (opt == "emit-llvm") {
@@ -425,6 +437,12 @@ static ld_plugin_status all_symbols_read_hook(void) {
     }
   }
 
+  if (options::parallel_codegen > 1) {
+    std::string opt = "-slimmer-codegen-threads=" +
+                      std::to_string(options::parallel_codegen);
+    lto_codegen_debug_options(code_gen, opt.c_str());
+  }
+
   if (options::generate_bc_file != options::BC_NO) {
     std::string path;
     if (options::generate_bc_file == options::BC_ONLY)
@@ -475,6 +493,17 @@ static ld_plugin_status all_symbols_read_hook(void) {
   if (options::obj_path.empty())
     Cleanup.push_back(ObjPath);
 
+  // The objects of the other partitions (see parallel-codegen)
+  std::vector<std::string> &partitions = SlimmerPartitionObjects();
+  for (unsigned i = 0; i < partitions.size(); ++i) {
+    if ((*add_input_file)(partitions[i].c_str()) != LDPS_OK) {
+      (*message)(LDPL_ERROR, "Unable to add .o file to the link.");
+      (*message)(LDPL_ERROR, "File left behind in: %s", partitions[i].c_str());
+      return LDPS_ERR;
+    }
+    Cleanup.push_back(partitions[i]);
+  }
+
   return LDPS_OK;
 }
 
@@ -0,0 +1,174 @@
+#include "SlimmerUtil.h"
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+using namespace std;
+
+/// A unit of a program built with -slimmer-per-tu, as registered at run time.
+struct Unit {
+  string Hash;
+  uint32_t BBBase, InsBase, NumBB, NumIns;
+};
+
+/// Read the units file written by the runtime.
+///
+/// \param path - the path to the units file, i.e., TRACE.units.
+/// \param units - the units, in the order of their instruction IDs.
+///
+static void LoadUnits(string path, vector<Unit> &units) {
+  ifstream file(path);
+  Unit u;
+  while (file >> u.Hash >> u.BBBase >> u.InsBase >> u.NumBB >> u.NumIns)
+    units.push_back(u);
+  sort(units.begin(), units.end(), [](const Unit &a, const Unit &b) {
+    return a.InsBase < b.InsBase;
+  });
+}
+
+/// Rewrite the Inst file of a unit by the bases of its IDs, in the format
+/// that LoadInstInfo reads.
+///
+/// \param path - the path to the Inst file of the unit.
+/// \param u - the unit.
+/// \param out - the merged Inst file.
+/// \return - the number of the instructions.
+///
+static uint32_t MergeInst(string path, const Unit &u, ofstream &out) {
+  ifstream file(path);
+  string tmp, type;
+  int cnt, x;
+  uint32_t num = 0;
+  while (file >> x) {
+    int bb, is_pointer, loc;
+    string file_path, code;
+    file >> bb >> is_pointer >> loc >> file_path >> code;
+    out << x + u.InsBase << "\n\t" << bb + u.BBBase << "\n\t" << is_pointer
+        << "\n\t" << loc << "\n\t" << file_path << "\n\t" << code << "\n";
+
+    // SSA dependencies
+    file >> cnt;
+    out << "\t" << cnt << " ";
+    while (cnt--) {
+      file >> tmp >> x;
+      out << tmp << " " << (tmp == "Inst" ? x + u.InsBase : x) << " ";
+    }
+    out << "\n";
+
+    file >> type;
+    out << "\t" << type << "\n";
+    if (type == "CallInst" || type == "ExternalCallInst") {
+      file >> tmp;
+      out << "\t" << tmp << "\n";
+    } else if (type == "TerminatorInst" || type == "ReturnInst") {
+      file >> cnt;
+      out << "\t" << cnt << " ";
+      while (cnt--) {
+        file >> x;
+        out << x + u.BBBase << " ";
+      }
+      out << "\n";
+    } else if (type == "PhiNode") {
+      file >> cnt;
+      out << "\t" << cnt << " ";
+      while (cnt--) {
+        int a, b;
+        file >> a >> tmp >> b;
+        out << " " << a + u.BBBase << " " << tmp << " "
+            << (tmp == "Inst" ? b + u.InsBase : b) << " ";
+      }
+      out << "\n";
+    }
+    num++;
+  }
+  return num;
+}
+
+/// Append the lines of a file whose leading columns are basic block IDs.
+///
+/// \param path - the path to the file of the unit.
+/// \param columns - the number of the leading columns to rebase.
+/// \param base - the base of the basic block IDs.
+/// \param out - the merged file.
+///
+static void MergeBBFile(string path, int columns, uint32_t base,
+                        ofstream &out) {
+  ifstream file(path);
+  string line, rest;
+  while (getline(file, line)) {
+    istringstream is(line);
+    uint64_t x;
+    for (int i = 0; i < columns && is >> x; ++i)
+      out << (i ? " " : "") << x + base;
+    getline(is, rest);
+    out << rest << "\n";
+  }
+}
+
+/// Merge the information directories of the units of a program built with
+/// -slimmer-per-tu into the one of a program instrumented as a whole.
+///
+/// Usage: slimmer-merge-info out_dir units_file [slimmer_info_dir]
+///
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 4) {
+    printf("Usage: slimmer-merge-info out_dir units_file "
+           "[slimmer_info_dir]\n");
+    exit(1);
+  }
+  string out_dir = argv[1];
+  string info_dir = argc == 4 ? argv[3] : "/scratch1/zhangmx/SlimmerInfo";
+
+  vector<Unit> units;
+  LoadUnits(argv[2], units);
+  if (units.empty()) {
+    ERROR("[SLIMMER] No unit is registered in %s\n", argv[2]);
+    exit(1);
+  }
+
+  if (system(("mkdir -p " + out_dir).c_str()) != 0) {
+    ERROR("[SLIMMER] Cannot create %s\n", out_dir.c_str());
+    exit(1);
+  }
+  ofstream inst(out_dir + "/Inst");
+  ofstream bbgraph(out_dir + "/BBGraph");
+  ofstream path_fun(out_dir + "/PathFun");
+  ofstream fun_entry(out_dir + "/FunEntry");
+  ofstream instrumented(out_dir + "/InstrumentedFun");
+  // Batches and counters are not supported by -slimmer-per-tu
+  ofstream(out_dir + "/Batch");
+  ofstream(out_dir + "/CountedFun");
+
+  set<string> funs;
+  uint32_t next_ins = 0;
+  for (auto &u : units) {
+    // The instruction IDs must be contiguous, which LoadInstInfo asserts
+    if (u.InsBase != next_ins) {
+      ERROR("[SLIMMER] The instructions [%u, %u) belong to no unit\n",
+            next_ins, u.InsBase);
+      exit(1);
+    }
+    string dir = info_dir + "/" + u.Hash;
+    uint32_t num = MergeInst(dir + "/Inst", u, inst);
+    if (num != u.NumIns) {
+      ERROR("[SLIMMER] %s has %u instructions, but %u are registered\n",
+            dir.c_str(), num, u.NumIns);
+      exit(1);
+    }
+    next_ins += num;
+
+    MergeBBFile(dir + "/BBGraph", 2, u.BBBase, bbgraph);
+    MergeBBFile(dir + "/PathFun", 1, u.BBBase, path_fun);
+    MergeBBFile(dir + "/FunEntry", 1, u.BBBase, fun_entry);
+
+    ifstream file(dir + "/InstrumentedFun");
+    string fun;
+    while (file >> fun)
+      if (funs.insert(fun).second)
+        instrumented << fun << "\n";
+  }
+  printf("%lu units, %u instructions are merged into %s\n", units.size(),
+         next_ins, out_dir.c_str());
+  return 0;
+}
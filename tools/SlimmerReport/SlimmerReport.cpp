@@ -0,0 +1,196 @@
+#include "SlimmerUtil.h"
+
+#include <algorithm>
+#include <fstream>
+using namespace std;
+
+static const char *TypeName(InstInfo::InstType type) {
+  static const char *names[] = {"normal", "load",   "store",  "call",
+                                "extcall", "return", "term",   "phi",
+                                "vararg", "atomic", "alloca"};
+  return names[type];
+}
+
+/// Read a profile written by the counting mode.
+///
+/// \param path - the path to the profile.
+/// \param records - the records of the executed instructions.
+/// \param bb_records - the records of the executed basic blocks.
+/// \return - false if it is not a profile.
+///
+static bool LoadProfile(const char *path, vector<ProfileRecord> &records,
+                        vector<BBProfileRecord> &bb_records) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return false;
+  ProfileHeader header;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      memcmp(header.Magic, SLIMMER_PROFILE_MAGIC, sizeof(header.Magic)) != 0) {
+    fclose(f);
+    return false;
+  }
+  records.resize(header.NumRecords);
+  size_t n = fread(records.data(), sizeof(ProfileRecord), records.size(), f);
+  if (n != records.size())
+    ERROR("[SLIMMER] The profile is truncated, %lu of %lu records\n", n,
+          records.size());
+  records.resize(n);
+  bb_records.resize(header.NumBBRecords);
+  n = fread(bb_records.data(), sizeof(BBProfileRecord), bb_records.size(), f);
+  if (n != bb_records.size())
+    ERROR("[SLIMMER] The profile is truncated, %lu of %lu basic blocks\n", n,
+          bb_records.size());
+  bb_records.resize(n);
+  fclose(f);
+  return true;
+}
+
+/// A function counted by -slimmer-bb-counters.
+struct CountedFun {
+  string Name;
+  uint32_t Entry, NumBB;
+};
+
+/// Read the CountedFun file.
+///
+/// \param path - the path to the CountedFun file.
+/// \param funs - the functions, in the order of their basic block IDs.
+///
+static void LoadCountedFun(string path, vector<CountedFun> &funs) {
+  ifstream file(path);
+  CountedFun fun;
+  while (file >> fun.Name >> fun.Entry >> fun.NumBB)
+    funs.push_back(fun);
+}
+
+/// Print the hottest basic blocks, and the execution count of each function
+/// (i.e., of its entry block) if list_funs is set, which is a profile for
+/// -slimmer-profile.
+///
+static void ReportBB(const char *info_dir, vector<BBProfileRecord> &bb_records,
+                     const vector<InstInfo> &ins,
+                     const vector<vector<uint32_t> > &bb2ins, size_t top,
+                     bool list_funs) {
+  vector<CountedFun> funs;
+  LoadCountedFun(string(info_dir) + "/CountedFun", funs);
+  auto fun_of = [&](uint32_t bb) -> const CountedFun *{
+    auto it = upper_bound(funs.begin(), funs.end(), bb,
+                          [](uint32_t bb, const CountedFun &f) {
+      return bb < f.Entry;
+    });
+    if (it == funs.begin() || bb >= (it - 1)->Entry + (it - 1)->NumBB)
+      return NULL;
+    return &*(it - 1);
+  };
+
+  if (list_funs) {
+    map<uint32_t, uint64_t> entry_count;
+    for (auto &r : bb_records)
+      entry_count[r.BB] = r.Execs;
+    for (auto &f : funs)
+      printf("%s %lu\n", f.Name.c_str(),
+             entry_count.count(f.Entry) ? entry_count[f.Entry] : 0);
+    return;
+  }
+
+  uint64_t execs = 0;
+  for (auto &r : bb_records)
+    execs += r.Execs;
+  sort(bb_records.begin(), bb_records.end(),
+       [](const BBProfileRecord &a, const BBProfileRecord &b) {
+    return a.Execs > b.Execs;
+  });
+  printf("%lu basic blocks, %lu executions\n", bb_records.size(), execs);
+  printf("%8s %14s %8s %-30s %s\n", "BB", "execs", "%", "location",
+         "function");
+  for (size_t i = 0; i < bb_records.size() && i < top; ++i) {
+    const BBProfileRecord &r = bb_records[i];
+    string loc = "[UNKNOWN]";
+    if (r.BB < bb2ins.size() && !bb2ins[r.BB].empty() &&
+        bb2ins[r.BB][0] < ins.size()) {
+      const InstInfo &first = ins[bb2ins[r.BB][0]];
+      loc = first.File + ":" + to_string(first.LoC);
+    }
+    const CountedFun *fun = fun_of(r.BB);
+    printf("%8lu %14lu %7.2f%% %-30s %s\n", r.BB, r.Execs,
+           execs ? 100.0 * r.Execs / execs : 0.0, loc.c_str(),
+           fun ? fun->Name.c_str() : "[UNKNOWN]");
+  }
+  printf("\n");
+}
+
+/// Rank the instructions of a counting profile by their redundant bytes,
+/// i.e., the bytes written by the silent stores, and by their silent
+/// executions. The basic blocks of a profile of -slimmer-bb-counters are
+/// ranked by their executions.
+///
+/// Usage: slimmer-report [-functions] slimmer_info_dir profile [top]
+///
+int main(int argc, char *argv[]) {
+  bool list_funs = argc > 1 && strcmp(argv[1], "-functions") == 0;
+  if (list_funs) {
+    argc--;
+    argv++;
+  }
+  if (argc != 3 && argc != 4) {
+    printf("Usage: slimmer-report [-functions] slimmer_info_dir profile "
+           "[top]\n");
+    exit(1);
+  }
+  size_t top = argc == 4 ? atol(argv[3]) : 50;
+
+  vector<InstInfo> ins;
+  vector<vector<uint32_t> > bb2ins;
+  LoadInstInfo(string(argv[1]) + "/Inst", ins, bb2ins);
+
+  vector<ProfileRecord> records;
+  vector<BBProfileRecord> bb_records;
+  if (!LoadProfile(argv[2], records, bb_records)) {
+    ERROR("[SLIMMER] %s is not a counting profile\n", argv[2]);
+    exit(1);
+  }
+  if (list_funs || !bb_records.empty())
+    ReportBB(argv[1], bb_records, ins, bb2ins, top, list_funs);
+  if (list_funs)
+    return 0;
+
+  uint64_t execs = 0, silent = 0, bytes = 0, redundant = 0;
+  for (auto &r : records) {
+    execs += r.Counter.Execs;
+    silent += r.Counter.Silent;
+    bytes += r.Counter.Bytes;
+    redundant += r.Counter.RedundantBytes;
+  }
+  sort(records.begin(), records.end(),
+       [](const ProfileRecord &a, const ProfileRecord &b) {
+    if (a.Counter.RedundantBytes != b.Counter.RedundantBytes)
+      return a.Counter.RedundantBytes > b.Counter.RedundantBytes;
+    if (a.Counter.Silent != b.Counter.Silent)
+      return a.Counter.Silent > b.Counter.Silent;
+    return a.Counter.Execs > b.Counter.Execs;
+  });
+
+  printf("%lu instructions, %lu executions, %lu silent (%.2f%%), "
+         "%lu of %lu written bytes are redundant (%.2f%%)\n",
+         records.size(), execs, silent,
+         execs ? 100.0 * silent / execs : 0.0, redundant, bytes,
+         bytes ? 100.0 * redundant / bytes : 0.0);
+  printf("%8s %-8s %-30s %12s %12s %8s %14s %14s  %s\n", "ID", "type",
+         "location", "execs", "silent", "silent%", "bytes", "redundant",
+         "code");
+  for (size_t i = 0; i < records.size() && i < top; ++i) {
+    const ProfileRecord &r = records[i];
+    const InsCounter &c = r.Counter;
+    string loc = "[UNKNOWN]", code, type = "?";
+    if (r.ID < ins.size()) {
+      loc = ins[r.ID].File + ":" + to_string(ins[r.ID].LoC);
+      code = ins[r.ID].Code;
+      type = TypeName(ins[r.ID].Type);
+    }
+    printf("%8lu %-8s %-30s %12lu %12lu %7.2f%% %14lu %14lu  %s\n", r.ID,
+           type.c_str(), loc.c_str(), c.Execs, c.Silent,
+           c.Execs ? 100.0 * c.Silent / c.Execs : 0.0, c.Bytes,
+           c.RedundantBytes, code.c_str());
+  }
+  return 0;
+}
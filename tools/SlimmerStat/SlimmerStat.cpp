@@ -0,0 +1,76 @@
+#include "SlimmerUtil.h"
+
+#include <algorithm>
+#include <time.h>
+
+/// Poll the statistics segment of a traced process and print its
+/// throughput, stalls and compression in each interval.
+///
+/// Usage: slimmer-stat pid [interval in seconds]
+///
+int main(int argc, char *argv[]) {
+  if (argc != 2 && argc != 3) {
+    printf("Usage: slimmer-stat pid [interval]\n");
+    exit(1);
+  }
+  double interval = argc == 3 ? atof(argv[2]) : 1;
+  if (interval <= 0)
+    interval = 1;
+
+  std::string path = std::string(SLIMMER_STAT_PATH) + argv[1];
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ERROR("[SLIMMER] Cannot open %s, is the process traced?\n", path.c_str());
+    exit(1);
+  }
+  const RuntimeStat *stat = (const RuntimeStat *)mmap(
+      NULL, sizeof(RuntimeStat), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stat == MAP_FAILED ||
+      memcmp(stat->Magic, SLIMMER_STAT_MAGIC, sizeof(stat->Magic)) != 0) {
+    ERROR("[SLIMMER] %s is not a statistics segment\n", path.c_str());
+    exit(1);
+  }
+
+  printf("Process %lu, trace %s, %lu blocks of %lu MB\n", stat->PID,
+         stat->TracePath, stat->BlockCnt, stat->BlockSize >> 20);
+  printf("%8s %12s %10s %8s %10s %8s %10s %10s %8s\n", "threads",
+         "events/s", "MB/s", "stalls", "stall(s)", "backlog", "dropped",
+         "ratio", "dump MB/s");
+
+  RuntimeStat last, cur;
+  memset(&last, 0, sizeof(last));
+  struct timespec sleep_time;
+  sleep_time.tv_sec = (time_t)interval;
+  sleep_time.tv_nsec = (long)((interval - sleep_time.tv_sec) * 1e9);
+
+  // The segment is removed when the traced process exits.
+  while (access(path.c_str(), F_OK) == 0) {
+    memcpy(&cur, stat, sizeof(cur));
+
+    uint64_t events = 0, bytes = 0, stalls = 0, stall_nanos = 0;
+    uint64_t threads = std::min(cur.NumThreads,
+                                (uint64_t)SLIMMER_STAT_MAX_THREAD);
+    for (uint64_t i = 0; i < threads; ++i) {
+      events += cur.Threads[i].Events - last.Threads[i].Events;
+      bytes += cur.Threads[i].Bytes - last.Threads[i].Bytes;
+      stalls += cur.Threads[i].Stalls - last.Threads[i].Stalls;
+      stall_nanos += cur.Threads[i].StallNanos - last.Threads[i].StallNanos;
+    }
+    const PipelineStat &ps = cur.Pipeline, &lps = last.Pipeline;
+    uint64_t raw = ps.RawBytes - lps.RawBytes;
+    uint64_t compressed = ps.CompressedBytes - lps.CompressedBytes;
+
+    printf("%8lu %12.0f %10.1f %8lu %10.3f %8lu %10lu %10.2f %8.1f\n",
+           cur.NumThreads, events / interval, bytes / 1048576.0 / interval,
+           stalls, stall_nanos * 1e-9, ps.BlocksFilled - ps.BlocksDumped,
+           ps.EventsDropped - lps.EventsDropped,
+           compressed ? (double)raw / compressed : 0.0,
+           (ps.DumpedBytes - lps.DumpedBytes) / 1048576.0 / interval);
+    fflush(stdout);
+
+    last = cur;
+    nanosleep(&sleep_time, NULL);
+  }
+  return 0;
+}